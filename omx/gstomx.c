@@ -47,6 +47,37 @@ GST_DEBUG_CATEGORY (gstomx_debug);
 G_LOCK_DEFINE_STATIC (core_handles);
 static GHashTable *core_handles;
 
+/* Components released in Loaded state, most recently released
+ * first. See gst_omx_component_acquire(). The cache thread runs
+ * while the cache is not empty and frees the components that were
+ * not reused in time, component_cache_cond is signalled when the
+ * cache changes */
+static GMutex component_cache_lock;
+static GCond component_cache_cond;
+static GQueue component_cache = G_QUEUE_INIT;
+static GThread *component_cache_thread;
+static gboolean component_cache_stop;
+
+#define GST_OMX_COMPONENT_CACHE_SIZE (4)
+#define GST_OMX_COMPONENT_CACHE_TIMEOUT (30 * G_TIME_SPAN_SECOND)
+
+/* Value of a parameter or configuration before it was set for the
+ * first time, see gst_omx_component_save_default() */
+typedef struct
+{
+  gboolean config;
+  OMX_INDEXTYPE index;
+  OMX_U32 port_index;
+  gpointer data;
+} GstOMXDefault;
+
+static void
+gst_omx_default_free (GstOMXDefault * def)
+{
+  g_free (def->data);
+  g_slice_free (GstOMXDefault, def);
+}
+
 GstOMXCore *
 gst_omx_core_acquire (const gchar * filename)
 {
@@ -196,214 +227,633 @@ gst_omx_core_release (GstOMXCore * core)
   G_UNLOCK (core_handles);
 }
 
-/* NOTE: comp->messages_lock will be used */
+/* Size of the message ring, must be a power of two */
+#define GST_OMX_MESSAGE_RING_SIZE 256
+
+/* Overflow messages that are reserved in addition to one per
+ * port buffer, for events */
+#define GST_OMX_MESSAGE_RESERVE 32
+
+/* Makes sure that at least n messages for the overflow queue are
+ * allocated, the callbacks then never allocate memory themselves.
+ *
+ * NOTE: Uses comp->messages_lock */
 static void
-gst_omx_component_flush_messages (GstOMXComponent * comp)
+gst_omx_component_reserve_messages (GstOMXComponent * comp, guint n)
 {
-  GstOMXMessage *msg;
-
   g_mutex_lock (&comp->messages_lock);
-  while ((msg = g_queue_pop_head (&comp->messages))) {
-    g_slice_free (GstOMXMessage, msg);
+  while (comp->messages_allocated < n) {
+    GList *link = g_list_alloc ();
+
+    link->data = g_slice_new (GstOMXMessage);
+    g_queue_push_tail_link (&comp->messages_free, link);
+    comp->messages_allocated++;
   }
   g_mutex_unlock (&comp->messages_lock);
 }
 
-/* NOTE: Call with comp->lock, comp->messages_lock will be used */
 static void
-gst_omx_component_handle_messages (GstOMXComponent * comp)
+gst_omx_component_init_messages (GstOMXComponent * comp)
 {
-  GstOMXMessage *msg;
+  guint i;
 
-  g_mutex_lock (&comp->messages_lock);
-  while ((msg = g_queue_pop_head (&comp->messages))) {
-    g_mutex_unlock (&comp->messages_lock);
+  comp->messages_ring =
+      g_new0 (GstOMXMessageSlot, GST_OMX_MESSAGE_RING_SIZE);
+  comp->messages_ring_mask = GST_OMX_MESSAGE_RING_SIZE - 1;
+  for (i = 0; i < GST_OMX_MESSAGE_RING_SIZE; i++)
+    comp->messages_ring[i].sequence = i;
+  comp->messages_head = 0;
+  comp->messages_tail = 0;
+  comp->messages_waiters = 0;
 
-    switch (msg->type) {
-      case GST_OMX_MESSAGE_STATE_SET:{
-        GST_INFO_OBJECT (comp->parent, "%s state change to %s finished",
-            comp->name, gst_omx_state_to_string (msg->content.state_set.state));
-        comp->state = msg->content.state_set.state;
-        if (comp->state == comp->pending_state)
-          comp->pending_state = OMX_StateInvalid;
+  g_queue_init (&comp->messages);
+  g_queue_init (&comp->messages_free);
+  comp->messages_allocated = 0;
+  comp->messages_overflow = FALSE;
+
+  gst_omx_component_reserve_messages (comp, GST_OMX_MESSAGE_RESERVE);
+}
+
+/* Lock-free, called by the OpenMAX callbacks. Returns FALSE if
+ * the ring is full */
+static gboolean
+gst_omx_component_push_message (GstOMXComponent * comp,
+    const GstOMXMessage * msg)
+{
+  GstOMXMessageSlot *slot;
+  guint pos;
+  gint diff;
+
+  pos = g_atomic_int_get (&comp->messages_head);
+  for (;;) {
+    slot = &comp->messages_ring[pos & comp->messages_ring_mask];
+    diff = (gint) ((guint) g_atomic_int_get (&slot->sequence) - pos);
+
+    if (diff == 0) {
+      /* Slot is free, try to claim it */
+      if (g_atomic_int_compare_and_exchange (&comp->messages_head, pos,
+              pos + 1))
         break;
-      }
-      case GST_OMX_MESSAGE_FLUSH:{
-        GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.flush.port;
+      pos = g_atomic_int_get (&comp->messages_head);
+    } else if (diff < 0) {
+      /* The consumer did not release this slot yet */
+      return FALSE;
+    } else {
+      /* Another producer claimed this slot already */
+      pos = g_atomic_int_get (&comp->messages_head);
+    }
+  }
 
-        port = gst_omx_component_get_port (comp, index);
-        if (!port)
-          break;
+  slot->msg = *msg;
+  g_atomic_int_set (&slot->sequence, pos + 1);
 
-        GST_DEBUG_OBJECT (comp->parent, "%s port %u flushed", comp->name,
-            port->index);
+  return TRUE;
+}
 
-        if (port->flushing) {
-          port->flushed = TRUE;
-        } else {
-          GST_ERROR_OBJECT (comp->parent, "%s port %u was not flushing",
-              comp->name, port->index);
-        }
+/* Maximum number of messages taken out of the ring at once */
+#define GST_OMX_MESSAGE_BATCH_SIZE 32
 
-        break;
-      }
-      case GST_OMX_MESSAGE_ERROR:{
-        OMX_ERRORTYPE error = msg->content.error.error;
+/* NOTE: Call with comp->lock or when no other thread can
+ * access the component anymore. Copies up to max messages out
+ * of the ring, gives their slots back to the producers and
+ * returns the number of messages */
+static guint
+gst_omx_component_pop_messages (GstOMXComponent * comp, GstOMXMessage * msgs,
+    guint max)
+{
+  GstOMXMessageSlot *slot;
+  guint pos, n;
 
-        if (error == OMX_ErrorNone)
-          break;
+  pos = comp->messages_tail;
+  for (n = 0; n < max; n++) {
+    slot = &comp->messages_ring[(pos + n) & comp->messages_ring_mask];
+    if ((guint) g_atomic_int_get (&slot->sequence) != pos + n + 1)
+      break;
+
+    msgs[n] = slot->msg;
+    g_atomic_int_set (&slot->sequence,
+        pos + n + comp->messages_ring_mask + 1);
+  }
 
-        GST_ERROR_OBJECT (comp->parent, "%s got error: %s (0x%08x)", comp->name,
-            gst_omx_error_to_string (error), error);
+  if (n > 0)
+    g_atomic_int_set (&comp->messages_tail, pos + n);
 
-        /* We only set the first error ever from which
-         * we can't recover anymore.
-         */
-        if (comp->last_error == OMX_ErrorNone)
-          comp->last_error = error;
-        g_cond_broadcast (&comp->messages_cond);
+  return n;
+}
+
+/* NOTE: Call with comp->messages_lock */
+static gboolean
+gst_omx_component_has_messages (GstOMXComponent * comp)
+{
+  return g_atomic_int_get (&comp->messages_head) !=
+      g_atomic_int_get (&comp->messages_tail)
+      || !g_queue_is_empty (&comp->messages);
+}
+
+/* NOTE: Call with comp->messages_lock and without comp->lock.
+ * Waits until a message arrives, somebody wakes up the waiters
+ * or wait_until (if not -1) passed. Returns FALSE on timeout.
+ *
+ * If port is not NULL, only buffers done on this port and messages
+ * for the whole component wake us up. Messages of other ports are
+ * still handled by whoever takes comp->lock next */
+static gboolean
+gst_omx_component_wait_messages (GstOMXComponent * comp, GstOMXPort * port,
+    gint64 wait_until)
+{
+  GCond *cond = port ? &port->messages_cond : &comp->messages_cond;
+  gboolean signalled = TRUE;
+
+  /* Must be visible to producers before checking for messages,
+   * otherwise a message could arrive without anybody waking us up */
+  g_atomic_int_inc (&comp->messages_waiters);
+  if (port)
+    g_atomic_int_inc (&port->messages_waiters);
+  if (!gst_omx_component_has_messages (comp)) {
+    if (wait_until == -1)
+      g_cond_wait (cond, &comp->messages_lock);
+    else
+      signalled = g_cond_wait_until (cond, &comp->messages_lock, wait_until);
+  }
+  if (port)
+    g_atomic_int_add (&port->messages_waiters, -1);
+  g_atomic_int_add (&comp->messages_waiters, -1);
+
+  return signalled;
+}
+
+/* NOTE: Call with comp->messages_lock */
+static void
+gst_omx_component_broadcast_locked (GstOMXComponent * comp, GstOMXPort * port)
+{
+  gint i, n;
+
+  if (port) {
+    g_cond_broadcast (&port->messages_cond);
+    return;
+  }
+
+  g_cond_broadcast (&comp->messages_cond);
+  n = (comp->ports ? comp->ports->len : 0);
+  for (i = 0; i < n; i++) {
+    GstOMXPort *tmp = g_ptr_array_index (comp->ports, i);
+
+    g_cond_broadcast (&tmp->messages_cond);
+  }
+}
+
+/* Wakes up the threads waiting on port, or everybody if port
+ * is NULL.
+ *
+ * NOTE: Lock-free if nobody waits, otherwise comp->messages_lock
+ * will be used */
+static void
+gst_omx_component_wake_waiters (GstOMXComponent * comp, GstOMXPort * port)
+{
+  if (port && g_atomic_int_get (&port->messages_waiters) == 0)
+    return;
+  if (!port && g_atomic_int_get (&comp->messages_waiters) == 0)
+    return;
+
+  g_mutex_lock (&comp->messages_lock);
+  gst_omx_component_broadcast_locked (comp, port);
+  g_mutex_unlock (&comp->messages_lock);
+}
+
+/* Returns the port that has to be woken up for msg, or NULL if
+ * it concerns the whole component */
+static GstOMXPort *
+gst_omx_component_get_message_port (const GstOMXMessage * msg)
+{
+  GstOMXBuffer *buf;
+
+  if (!msg || msg->type != GST_OMX_MESSAGE_BUFFER_DONE)
+    return NULL;
+
+  buf = msg->content.buffer_done.buffer->pAppPrivate;
+
+  return buf ? buf->port : NULL;
+}
+
+#define GST_OMX_STATS_ENABLED(comp) \
+    G_UNLIKELY (g_atomic_int_get (&(comp)->stats_enabled))
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_port_stats_update_owned (GstOMXPort * port, gboolean owned)
+{
+  GstOMXPortStats *stats = &port->stats;
+
+  if (owned)
+    stats->owned++;
+  else if (stats->owned > 0)
+    stats->owned--;
+
+  if (stats->owned_samples == 0 || stats->owned < stats->owned_min)
+    stats->owned_min = stats->owned;
+  if (stats->owned > stats->owned_max)
+    stats->owned_max = stats->owned;
+  stats->owned_sum += stats->owned;
+  stats->owned_samples++;
+}
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_port_stats_buffer_given (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  if (!GST_OMX_STATS_ENABLED (port->comp))
+    return;
 
+  buf->process_start = g_get_monotonic_time ();
+  buf->pending_start = 0;
+  gst_omx_port_stats_update_owned (port, TRUE);
+}
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_port_stats_buffer_done (GstOMXPort * port, GstOMXBuffer * buf,
+    gint64 time)
+{
+  GstOMXPortStats *stats = &port->stats;
+
+  if (!GST_OMX_STATS_ENABLED (port->comp))
+    return;
+
+  if (buf->process_start && time > buf->process_start) {
+    guint64 diff = time - buf->process_start;
+
+    stats->n_processed++;
+    stats->processing_time += diff;
+    stats->processing_time_max = MAX (stats->processing_time_max, diff);
+  }
+  buf->process_start = 0;
+  gst_omx_port_stats_update_owned (port, FALSE);
+}
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_port_stats_buffer_acquired (GstOMXPort * port, GstOMXBuffer * buf,
+    gint64 start)
+{
+  GstOMXPortStats *stats = &port->stats;
+  gint64 now = g_get_monotonic_time ();
+
+  stats->n_acquired++;
+  stats->acquire_time += now - start;
+  stats->acquire_time_max = MAX (stats->acquire_time_max, now - start);
+
+  if (buf->pending_start) {
+    guint64 diff = now - buf->pending_start;
+
+    stats->n_pending++;
+    stats->pending_time += diff;
+    stats->pending_time_max = MAX (stats->pending_time_max, diff);
+    buf->pending_start = 0;
+  }
+}
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_port_push_pending_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  if (GST_OMX_STATS_ENABLED (port->comp))
+    buf->pending_start = g_get_monotonic_time ();
+  g_queue_push_tail (&port->pending_buffers, buf);
+}
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_component_handle_message (GstOMXComponent * comp, GstOMXMessage * msg)
+{
+  switch (msg->type) {
+    case GST_OMX_MESSAGE_STATE_SET:{
+      GST_INFO_OBJECT (comp->parent, "%s state change to %s finished",
+          comp->name, gst_omx_state_to_string (msg->content.state_set.state));
+      comp->state = msg->content.state_set.state;
+      if (comp->state == comp->pending_state)
+        comp->pending_state = OMX_StateInvalid;
+      break;
+    }
+    case GST_OMX_MESSAGE_FLUSH:{
+      GstOMXPort *port = NULL;
+      OMX_U32 index = msg->content.flush.port;
+
+      port = gst_omx_component_get_port (comp, index);
+      if (!port)
         break;
+
+      GST_DEBUG_OBJECT (comp->parent, "%s port %u flushed", comp->name,
+          port->index);
+
+      if (port->flushing) {
+        port->flushed = TRUE;
+      } else {
+        GST_ERROR_OBJECT (comp->parent, "%s port %u was not flushing",
+            comp->name, port->index);
       }
-      case GST_OMX_MESSAGE_PORT_ENABLE:{
-        GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.port_enable.port;
-        OMX_BOOL enable = msg->content.port_enable.enable;
 
-        port = gst_omx_component_get_port (comp, index);
-        if (!port)
-          break;
+      break;
+    }
+    case GST_OMX_MESSAGE_ERROR:{
+      OMX_ERRORTYPE error = msg->content.error.error;
+
+      if (error == OMX_ErrorNone)
+        break;
 
-        GST_DEBUG_OBJECT (comp->parent, "%s port %u %s", comp->name,
-            port->index, (enable ? "enabled" : "disabled"));
+      GST_ERROR_OBJECT (comp->parent, "%s got error: %s (0x%08x)", comp->name,
+          gst_omx_error_to_string (error), error);
+
+      /* We only set the first error ever from which
+       * we can't recover anymore.
+       */
+      if (comp->last_error == OMX_ErrorNone)
+        comp->last_error = error;
+      gst_omx_component_wake_waiters (comp, NULL);
 
-        if (enable)
-          port->enabled_pending = FALSE;
-        else
-          port->disabled_pending = FALSE;
+      break;
+    }
+    case GST_OMX_MESSAGE_PORT_ENABLE:{
+      GstOMXPort *port = NULL;
+      OMX_U32 index = msg->content.port_enable.port;
+      OMX_BOOL enable = msg->content.port_enable.enable;
+
+      port = gst_omx_component_get_port (comp, index);
+      if (!port)
         break;
-      }
-      case GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED:{
-        gint i, n;
-        OMX_U32 index = msg->content.port_settings_changed.port;
-        GList *outports = NULL, *l, *k;
 
-        GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port %u)",
-            comp->name, (guint) index);
+      GST_DEBUG_OBJECT (comp->parent, "%s port %u %s", comp->name,
+          port->index, (enable ? "enabled" : "disabled"));
 
-        /* FIXME: This probably can be done better */
+      if (enable)
+        port->enabled_pending = FALSE;
+      else
+        port->disabled_pending = FALSE;
+      break;
+    }
+    case GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED:{
+      gint i, n;
+      OMX_U32 index = msg->content.port_settings_changed.port;
+      GList *outports = NULL, *l, *k;
+
+      GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port %u)",
+          comp->name, (guint) index);
 
-        /* Now update the ports' states */
+      /* Only the visible rectangle changed, the buffers stay valid */
+      if (msg->content.port_settings_changed.index ==
+          OMX_IndexConfigCommonOutputCrop) {
         n = (comp->ports ? comp->ports->len : 0);
         for (i = 0; i < n; i++) {
           GstOMXPort *port = g_ptr_array_index (comp->ports, i);
 
-          if (index == OMX_ALL || index == port->index) {
-            port->settings_cookie++;
-            gst_omx_port_update_port_definition (port, NULL);
-            if (port->port_def.eDir == OMX_DirOutput && !port->tunneled)
-              outports = g_list_prepend (outports, port);
-          }
+          if (index == OMX_ALL || index == port->index)
+            g_atomic_int_inc (&port->crop_cookie);
+        }
+        break;
+      }
+
+      /* Now update the ports' states. The port definitions are
+       * only queried once after all pending messages were handled,
+       * see gst_omx_component_update_changed_ports() */
+      n = (comp->ports ? comp->ports->len : 0);
+      for (i = 0; i < n; i++) {
+        GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+        if (index == OMX_ALL || index == port->index) {
+          port->settings_cookie++;
+          if (port->settings_changed)
+            comp->messages_coalesced++;
+          port->settings_changed = TRUE;
+          if (port->port_def.eDir == OMX_DirOutput && !port->tunneled)
+            outports = g_list_prepend (outports, port);
         }
+      }
 
-        for (k = outports; k; k = k->next) {
-          gboolean found = FALSE;
+      for (k = outports; k; k = k->next) {
+        gboolean found = FALSE;
 
-          for (l = comp->pending_reconfigure_outports; l; l = l->next) {
-            if (l->data == k->data) {
-              found = TRUE;
-              break;
-            }
+        for (l = comp->pending_reconfigure_outports; l; l = l->next) {
+          if (l->data == k->data) {
+            found = TRUE;
+            break;
           }
-
-          if (!found)
-            comp->pending_reconfigure_outports =
-                g_list_prepend (comp->pending_reconfigure_outports, k->data);
         }
 
-        g_list_free (outports);
+        if (!found)
+          comp->pending_reconfigure_outports =
+              g_list_prepend (comp->pending_reconfigure_outports, k->data);
+      }
+
+      g_list_free (outports);
 
+      break;
+    }
+    case GST_OMX_MESSAGE_BUFFER_FLAG:{
+      GstOMXPort *port = NULL;
+      OMX_U32 index = msg->content.buffer_flag.port;
+      OMX_U32 flags = msg->content.buffer_flag.flags;
+
+      port = gst_omx_component_get_port (comp, index);
+      if (!port)
         break;
-      }
-      case GST_OMX_MESSAGE_BUFFER_FLAG:{
-        GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.buffer_flag.port;
-        OMX_U32 flags = msg->content.buffer_flag.flags;
 
-        port = gst_omx_component_get_port (comp, index);
-        if (!port)
-          break;
+      GST_DEBUG_OBJECT (comp->parent, "%s port %u got buffer flags 0x%08x",
+          comp->name, port->index, (guint) flags);
+      if ((flags & OMX_BUFFERFLAG_EOS)
+          && port->port_def.eDir == OMX_DirOutput)
+        port->eos = TRUE;
 
-        GST_DEBUG_OBJECT (comp->parent, "%s port %u got buffer flags 0x%08x",
-            comp->name, port->index, (guint) flags);
-        if ((flags & OMX_BUFFERFLAG_EOS)
+      break;
+    }
+    case GST_OMX_MESSAGE_BUFFER_DONE:{
+      GstOMXBuffer *buf = msg->content.buffer_done.buffer->pAppPrivate;
+      GstOMXPort *port;
+
+      port = buf->port;
+
+      if (msg->content.buffer_done.empty) {
+        /* Input buffer is empty again and can be used to contain new input */
+        GST_LOG_OBJECT (port->comp->parent,
+            "%s port %u emptied buffer %p (%p)", port->comp->name,
+            port->index, buf, buf->omx_buf->pBuffer);
+
+        /* Reset offset and filled length */
+        buf->omx_buf->nOffset = 0;
+        buf->omx_buf->nFilledLen = 0;
+
+        /* Reset all flags, some implementations don't
+         * reset them themselves and the flags are not
+         * valid anymore after the buffer was consumed
+         */
+        buf->omx_buf->nFlags = 0;
+      } else {
+        /* Output buffer contains output now or
+         * the port was flushed */
+        GST_LOG_OBJECT (port->comp->parent,
+            "%s port %u filled buffer %p (%p)", port->comp->name, port->index,
+            buf, buf->omx_buf->pBuffer);
+
+        if ((buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS)
             && port->port_def.eDir == OMX_DirOutput)
           port->eos = TRUE;
-
-        break;
       }
-      case GST_OMX_MESSAGE_BUFFER_DONE:{
-        GstOMXBuffer *buf = msg->content.buffer_done.buffer->pAppPrivate;
-        GstOMXPort *port;
-
-        port = buf->port;
-
-        if (msg->content.buffer_done.empty) {
-          /* Input buffer is empty again and can be used to contain new input */
-          GST_LOG_OBJECT (port->comp->parent,
-              "%s port %u emptied buffer %p (%p)", port->comp->name,
-              port->index, buf, buf->omx_buf->pBuffer);
-
-          /* Reset offset and filled length */
-          buf->omx_buf->nOffset = 0;
-          buf->omx_buf->nFilledLen = 0;
-
-          /* Reset all flags, some implementations don't
-           * reset them themselves and the flags are not
-           * valid anymore after the buffer was consumed
-           */
-          buf->omx_buf->nFlags = 0;
-        } else {
-          /* Output buffer contains output now or
-           * the port was flushed */
-          GST_LOG_OBJECT (port->comp->parent,
-              "%s port %u filled buffer %p (%p)", port->comp->name, port->index,
-              buf, buf->omx_buf->pBuffer);
-
-          if ((buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS)
-              && port->port_def.eDir == OMX_DirOutput)
-            port->eos = TRUE;
-        }
 
-        buf->used = FALSE;
+      buf->used = FALSE;
+      gst_omx_port_stats_buffer_done (port, buf,
+          msg->content.buffer_done.time);
 
-        g_queue_push_tail (&port->pending_buffers, buf);
+      /* Held buffers are put back by gst_omx_port_unhold_buffer() */
+      if (!buf->held)
+        gst_omx_port_push_pending_buffer (port, buf);
 
-        break;
-      }
-      default:{
-        g_assert_not_reached ();
-        break;
-      }
+      break;
     }
+    default:{
+      g_assert_not_reached ();
+      break;
+    }
+  }
+}
 
-    g_slice_free (GstOMXMessage, msg);
+/* NOTE: comp->messages_lock will be used */
+static gboolean
+gst_omx_component_pop_overflow_messages (GstOMXComponent * comp,
+    GQueue * overflow)
+{
+  if (!g_atomic_int_get (&comp->messages_overflow))
+    return FALSE;
 
-    g_mutex_lock (&comp->messages_lock);
+  g_mutex_lock (&comp->messages_lock);
+  *overflow = comp->messages;
+  g_queue_init (&comp->messages);
+  g_atomic_int_set (&comp->messages_overflow, FALSE);
+  g_mutex_unlock (&comp->messages_lock);
+
+  return TRUE;
+}
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_component_update_changed_ports (GstOMXComponent * comp)
+{
+  gint i, n;
+
+  n = (comp->ports ? comp->ports->len : 0);
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    if (port->settings_changed) {
+      port->settings_changed = FALSE;
+      gst_omx_port_update_port_definition (port, NULL);
+    }
   }
+}
 
+/* Puts the messages of the overflow queue back to the
+ * preallocated ones
+ *
+ * NOTE: comp->messages_lock will be used */
+static void
+gst_omx_component_recycle_messages (GstOMXComponent * comp, GQueue * overflow)
+{
+  GList *link;
+
+  g_mutex_lock (&comp->messages_lock);
+  while ((link = g_queue_pop_head_link (overflow)))
+    g_queue_push_tail_link (&comp->messages_free, link);
   g_mutex_unlock (&comp->messages_lock);
 }
 
 /* NOTE: comp->messages_lock will be used */
 static void
-gst_omx_component_send_message (GstOMXComponent * comp, GstOMXMessage * msg)
+gst_omx_component_flush_messages (GstOMXComponent * comp)
+{
+  GstOMXMessage msgs[GST_OMX_MESSAGE_BATCH_SIZE];
+  GQueue overflow;
+
+  while (gst_omx_component_pop_messages (comp, msgs, G_N_ELEMENTS (msgs)));
+
+  if (gst_omx_component_pop_overflow_messages (comp, &overflow))
+    gst_omx_component_recycle_messages (comp, &overflow);
+}
+
+/* NOTE: Call with comp->lock, comp->messages_lock will be used */
+static void
+gst_omx_component_handle_messages (GstOMXComponent * comp)
+{
+  GstOMXMessage msgs[GST_OMX_MESSAGE_BATCH_SIZE];
+  GQueue overflow;
+  GList *l;
+  guint i, n, n_handled = 0;
+
+  do {
+    /* Messages in the ring are always older than the ones in the
+     * overflow queue, producers only go back to the ring once the
+     * overflow queue was taken */
+    while ((n =
+            gst_omx_component_pop_messages (comp, msgs,
+                G_N_ELEMENTS (msgs))) > 0) {
+      for (i = 0; i < n; i++)
+        gst_omx_component_handle_message (comp, &msgs[i]);
+      n_handled += n;
+    }
+
+    if (!gst_omx_component_pop_overflow_messages (comp, &overflow))
+      break;
+
+    for (l = overflow.head; l; l = l->next) {
+      gst_omx_component_handle_message (comp, l->data);
+      n_handled++;
+    }
+    gst_omx_component_recycle_messages (comp, &overflow);
+  } while (TRUE);
+
+  if (n_handled == 0)
+    return;
+
+  gst_omx_component_update_changed_ports (comp);
+
+  comp->messages_drains++;
+  comp->messages_handled += n_handled;
+  comp->messages_max_batch = MAX (comp->messages_max_batch, n_handled);
+}
+
+/* NOTE: Lock-free unless the ring is full or somebody waits
+ * for messages, then comp->messages_lock will be used.
+ * msg is copied and can be NULL to only wake up all waiters.
+ * Buffers done only wake up the waiters of their port */
+static void
+gst_omx_component_send_message (GstOMXComponent * comp,
+    const GstOMXMessage * msg)
 {
+  GstOMXPort *port = gst_omx_component_get_message_port (msg);
+
+  if (msg && !g_atomic_int_get (&comp->messages_overflow)
+      && gst_omx_component_push_message (comp, msg)) {
+    gst_omx_component_wake_waiters (comp, port);
+    return;
+  }
+
   g_mutex_lock (&comp->messages_lock);
-  if (msg)
-    g_queue_push_tail (&comp->messages, msg);
-  g_cond_broadcast (&comp->messages_cond);
+  if (msg) {
+    GList *link;
+
+    /* Only allocates if more messages are pending than
+     * were reserved */
+    link = g_queue_pop_head_link (&comp->messages_free);
+    if (!link) {
+      link = g_list_alloc ();
+      link->data = g_slice_new (GstOMXMessage);
+      comp->messages_allocated++;
+    }
+    *((GstOMXMessage *) link->data) = *msg;
+
+    /* Keep the order of messages: once something is in the
+     * overflow queue everything else goes there too until the
+     * consumer took it */
+    g_queue_push_tail_link (&comp->messages, link);
+    g_atomic_int_set (&comp->messages_overflow, TRUE);
+  }
+  gst_omx_component_broadcast_locked (comp, port);
   g_mutex_unlock (&comp->messages_lock);
 }
 
@@ -423,41 +873,41 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
 
       switch (cmd) {
         case OMX_CommandStateSet:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+          GstOMXMessage msg;
 
-          msg->type = GST_OMX_MESSAGE_STATE_SET;
-          msg->content.state_set.state = nData2;
+          msg.type = GST_OMX_MESSAGE_STATE_SET;
+          msg.content.state_set.state = nData2;
 
           GST_DEBUG_OBJECT (comp->parent, "%s state change to %s finished",
               comp->name,
-              gst_omx_state_to_string (msg->content.state_set.state));
+              gst_omx_state_to_string (msg.content.state_set.state));
 
-          gst_omx_component_send_message (comp, msg);
+          gst_omx_component_send_message (comp, &msg);
           break;
         }
         case OMX_CommandFlush:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+          GstOMXMessage msg;
 
-          msg->type = GST_OMX_MESSAGE_FLUSH;
-          msg->content.flush.port = nData2;
+          msg.type = GST_OMX_MESSAGE_FLUSH;
+          msg.content.flush.port = nData2;
           GST_DEBUG_OBJECT (comp->parent, "%s port %u flushed", comp->name,
-              (guint) msg->content.flush.port);
+              (guint) msg.content.flush.port);
 
-          gst_omx_component_send_message (comp, msg);
+          gst_omx_component_send_message (comp, &msg);
           break;
         }
         case OMX_CommandPortEnable:
         case OMX_CommandPortDisable:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+          GstOMXMessage msg;
 
-          msg->type = GST_OMX_MESSAGE_PORT_ENABLE;
-          msg->content.port_enable.port = nData2;
-          msg->content.port_enable.enable = (cmd == OMX_CommandPortEnable);
+          msg.type = GST_OMX_MESSAGE_PORT_ENABLE;
+          msg.content.port_enable.port = nData2;
+          msg.content.port_enable.enable = (cmd == OMX_CommandPortEnable);
           GST_DEBUG_OBJECT (comp->parent, "%s port %u %s", comp->name,
-              (guint) msg->content.port_enable.port,
-              (msg->content.port_enable.enable ? "enabled" : "disabled"));
+              (guint) msg.content.port_enable.port,
+              (msg.content.port_enable.enable ? "enabled" : "disabled"));
 
-          gst_omx_component_send_message (comp, msg);
+          gst_omx_component_send_message (comp, &msg);
           break;
         }
         default:
@@ -467,33 +917,33 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
     }
     case OMX_EventError:
     {
-      GstOMXMessage *msg;
+      GstOMXMessage msg;
 
       /* Yes, this really happens... */
       if (nData1 == OMX_ErrorNone)
         break;
 
-      msg = g_slice_new (GstOMXMessage);
-
-      msg->type = GST_OMX_MESSAGE_ERROR;
-      msg->content.error.error = nData1;
+      msg.type = GST_OMX_MESSAGE_ERROR;
+      msg.content.error.error = nData1;
       GST_ERROR_OBJECT (comp->parent, "%s got error: %s (0x%08x)", comp->name,
-          gst_omx_error_to_string (msg->content.error.error),
-          msg->content.error.error);
+          gst_omx_error_to_string (msg.content.error.error),
+          msg.content.error.error);
 
-      gst_omx_component_send_message (comp, msg);
+      gst_omx_component_send_message (comp, &msg);
       break;
     }
     case OMX_EventPortSettingsChanged:
     {
-      GstOMXMessage *msg = g_slice_new (GstOMXMessage);
-      OMX_U32 index;
+      GstOMXMessage msg;
+      OMX_U32 index, param;
 
       if (!(comp->hacks &
               GST_OMX_HACK_EVENT_PORT_SETTINGS_CHANGED_NDATA_PARAMETER_SWAP)) {
         index = nData1;
+        param = nData2;
       } else {
         index = nData2;
+        param = nData1;
       }
 
 
@@ -503,27 +953,27 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
         index = 1;
 
 
-      msg->type = GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED;
-      msg->content.port_settings_changed.port = index;
-      GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port index: %u)",
-          comp->name, (guint) msg->content.port_settings_changed.port);
+      msg.type = GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED;
+      msg.content.port_settings_changed.port = index;
+      msg.content.port_settings_changed.index = param;
+      GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port index: %u, "
+          "index 0x%08x)", comp->name,
+          (guint) msg.content.port_settings_changed.port, (guint) param);
 
-      gst_omx_component_send_message (comp, msg);
+      gst_omx_component_send_message (comp, &msg);
       break;
     }
     case OMX_EventBufferFlag:{
-      GstOMXMessage *msg;
-
-      msg = g_slice_new (GstOMXMessage);
+      GstOMXMessage msg;
 
-      msg->type = GST_OMX_MESSAGE_BUFFER_FLAG;
-      msg->content.buffer_flag.port = nData1;
-      msg->content.buffer_flag.flags = nData2;
+      msg.type = GST_OMX_MESSAGE_BUFFER_FLAG;
+      msg.content.buffer_flag.port = nData1;
+      msg.content.buffer_flag.flags = nData2;
       GST_DEBUG_OBJECT (comp->parent, "%s port %u got buffer flags 0x%08x",
-          comp->name, (guint) msg->content.buffer_flag.port,
-          (guint) msg->content.buffer_flag.flags);
+          comp->name, (guint) msg.content.buffer_flag.port,
+          (guint) msg.content.buffer_flag.flags);
 
-      gst_omx_component_send_message (comp, msg);
+      gst_omx_component_send_message (comp, &msg);
       break;
     }
     case OMX_EventPortFormatDetected:
@@ -542,7 +992,7 @@ EmptyBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 {
   GstOMXBuffer *buf;
   GstOMXComponent *comp;
-  GstOMXMessage *msg;
+  GstOMXMessage msg;
 
   buf = pBuffer->pAppPrivate;
   if (!buf) {
@@ -559,17 +1009,18 @@ EmptyBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 
   comp = buf->port->comp;
 
-  msg = g_slice_new (GstOMXMessage);
-  msg->type = GST_OMX_MESSAGE_BUFFER_DONE;
-  msg->content.buffer_done.component = hComponent;
-  msg->content.buffer_done.app_data = pAppData;
-  msg->content.buffer_done.buffer = pBuffer;
-  msg->content.buffer_done.empty = OMX_TRUE;
+  msg.type = GST_OMX_MESSAGE_BUFFER_DONE;
+  msg.content.buffer_done.component = hComponent;
+  msg.content.buffer_done.app_data = pAppData;
+  msg.content.buffer_done.buffer = pBuffer;
+  msg.content.buffer_done.empty = OMX_TRUE;
+  msg.content.buffer_done.time =
+      GST_OMX_STATS_ENABLED (comp) ? g_get_monotonic_time () : 0;
 
   GST_LOG_OBJECT (comp->parent, "%s port %u emptied buffer %p (%p)",
       comp->name, buf->port->index, buf, buf->omx_buf->pBuffer);
 
-  gst_omx_component_send_message (comp, msg);
+  gst_omx_component_send_message (comp, &msg);
 
   return OMX_ErrorNone;
 }
@@ -580,7 +1031,7 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 {
   GstOMXBuffer *buf;
   GstOMXComponent *comp;
-  GstOMXMessage *msg;
+  GstOMXMessage msg;
 
   buf = pBuffer->pAppPrivate;
   if (!buf) {
@@ -597,17 +1048,18 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 
   comp = buf->port->comp;
 
-  msg = g_slice_new (GstOMXMessage);
-  msg->type = GST_OMX_MESSAGE_BUFFER_DONE;
-  msg->content.buffer_done.component = hComponent;
-  msg->content.buffer_done.app_data = pAppData;
-  msg->content.buffer_done.buffer = pBuffer;
-  msg->content.buffer_done.empty = OMX_FALSE;
+  msg.type = GST_OMX_MESSAGE_BUFFER_DONE;
+  msg.content.buffer_done.component = hComponent;
+  msg.content.buffer_done.app_data = pAppData;
+  msg.content.buffer_done.buffer = pBuffer;
+  msg.content.buffer_done.empty = OMX_FALSE;
+  msg.content.buffer_done.time =
+      GST_OMX_STATS_ENABLED (comp) ? g_get_monotonic_time () : 0;
 
   GST_LOG_OBJECT (comp->parent, "%s port %u filled buffer %p (%p)", comp->name,
       buf->port->index, buf, buf->omx_buf->pBuffer);
 
-  gst_omx_component_send_message (comp, msg);
+  gst_omx_component_send_message (comp, &msg);
 
   return OMX_ErrorNone;
 }
@@ -615,6 +1067,15 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 static OMX_CALLBACKTYPE callbacks =
     { EventHandler, EmptyBufferDone, FillBufferDone };
 
+static gchar *
+gst_omx_component_make_cache_key (const gchar * core_name,
+    const gchar * component_name, const gchar * component_role,
+    guint64 hacks)
+{
+  return g_strdup_printf ("%s:%s:%s:%" G_GINT64_MODIFIER "x", core_name,
+      component_name, GST_STR_NULL (component_role), hacks);
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 GstOMXComponent *
 gst_omx_component_new (GstObject * parent, const gchar * core_name,
@@ -661,8 +1122,10 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
   g_mutex_init (&comp->lock);
   g_mutex_init (&comp->messages_lock);
   g_cond_init (&comp->messages_cond);
+  g_cond_init (&comp->recycle_cond);
+  g_cond_init (&comp->recycle_done_cond);
 
-  g_queue_init (&comp->messages);
+  gst_omx_component_init_messages (comp);
   comp->pending_state = OMX_StateInvalid;
   comp->last_error = OMX_ErrorNone;
 
@@ -700,12 +1163,23 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
 void
 gst_omx_component_free (GstOMXComponent * comp)
 {
+  GList *link;
   gint i, n;
 
   g_return_if_fail (comp != NULL);
 
   GST_INFO_OBJECT (comp->parent, "Unloading component %p %s", comp, comp->name);
 
+  if (comp->recycle_thread) {
+    g_mutex_lock (&comp->lock);
+    comp->recycle_stop = TRUE;
+    g_cond_signal (&comp->recycle_cond);
+    g_mutex_unlock (&comp->lock);
+
+    g_thread_join (comp->recycle_thread);
+    comp->recycle_thread = NULL;
+  }
+
   if (comp->ports) {
     n = comp->ports->len;
     for (i = 0; i < n; i++) {
@@ -714,7 +1188,9 @@ gst_omx_component_free (GstOMXComponent * comp)
       gst_omx_port_deallocate_buffers (port);
       g_assert (port->buffers == NULL);
       g_assert (g_queue_get_length (&port->pending_buffers) == 0);
+      g_assert (g_queue_get_length (&port->recycle_buffers) == 0);
 
+      g_cond_clear (&port->messages_cond);
       g_slice_free (GstOMXPort, port);
     }
     g_ptr_array_unref (comp->ports);
@@ -724,20 +1200,341 @@ gst_omx_component_free (GstOMXComponent * comp)
   comp->core->free_handle (comp->handle);
   gst_omx_core_release (comp->core);
 
+  GST_DEBUG_OBJECT (comp->parent, "%s handled %" G_GUINT64_FORMAT " messages "
+      "in %" G_GUINT64_FORMAT " batches (max %u), coalesced %" G_GUINT64_FORMAT
+      " port settings changes, %u overflow messages allocated", comp->name,
+      comp->messages_handled, comp->messages_drains, comp->messages_max_batch,
+      comp->messages_coalesced, comp->messages_allocated);
+
   gst_omx_component_flush_messages (comp);
+  g_free (comp->messages_ring);
+  comp->messages_ring = NULL;
+  while ((link = g_queue_pop_head_link (&comp->messages_free))) {
+    g_slice_free (GstOMXMessage, link->data);
+    g_list_free_1 (link);
+  }
 
+  g_cond_clear (&comp->recycle_cond);
+  g_cond_clear (&comp->recycle_done_cond);
   g_cond_clear (&comp->messages_cond);
   g_mutex_clear (&comp->messages_lock);
   g_mutex_clear (&comp->lock);
 
-  gst_object_unref (comp->parent);
+  if (comp->parent)
+    gst_object_unref (comp->parent);
 
   g_free (comp->name);
   comp->name = NULL;
+  g_free (comp->cache_key);
+  comp->cache_key = NULL;
+  g_list_free_full (comp->defaults, (GDestroyNotify) gst_omx_default_free);
+  comp->defaults = NULL;
 
   g_slice_free (GstOMXComponent, comp);
 }
 
+/* Removes the components that were not reused for too long or that
+ * exceed the cache size, and adds them to evicted.
+ *
+ * NOTE: Must be called with component_cache_lock */
+static void
+gst_omx_component_cache_evict_unlocked (GList ** evicted, gboolean all)
+{
+  gint64 now = g_get_monotonic_time ();
+  GstOMXComponent *comp;
+
+  while ((comp = g_queue_peek_tail (&component_cache))
+      && (all || g_queue_get_length (&component_cache) >
+          GST_OMX_COMPONENT_CACHE_SIZE
+          || now - comp->cache_time >= GST_OMX_COMPONENT_CACHE_TIMEOUT)) {
+    g_queue_pop_tail (&component_cache);
+    *evicted = g_list_prepend (*evicted, comp);
+  }
+}
+
+static void
+gst_omx_component_cache_free_evicted (GList * evicted)
+{
+  GList *l;
+
+  for (l = evicted; l; l = l->next) {
+    GstOMXComponent *comp = l->data;
+
+    GST_DEBUG ("Evicting cached component %p %s", comp, comp->name);
+    gst_omx_component_free (comp);
+  }
+  g_list_free (evicted);
+}
+
+/* Frees the cached components once they were not reused for
+ * GST_OMX_COMPONENT_CACHE_TIMEOUT, exits when the cache is empty */
+static gpointer
+gst_omx_component_cache_thread (gpointer data)
+{
+  GstOMXComponent *comp;
+  GList *evicted;
+
+  g_mutex_lock (&component_cache_lock);
+  while (!component_cache_stop
+      && (comp = g_queue_peek_tail (&component_cache))) {
+    if (g_cond_wait_until (&component_cache_cond, &component_cache_lock,
+            comp->cache_time + GST_OMX_COMPONENT_CACHE_TIMEOUT))
+      continue;
+
+    evicted = NULL;
+    gst_omx_component_cache_evict_unlocked (&evicted, FALSE);
+    if (evicted) {
+      g_mutex_unlock (&component_cache_lock);
+      gst_omx_component_cache_free_evicted (evicted);
+      g_mutex_lock (&component_cache_lock);
+    }
+  }
+  /* Nobody joins the thread unless gst_omx_component_cache_clear()
+   * took it already */
+  if (component_cache_thread == g_thread_self ()) {
+    component_cache_thread = NULL;
+    g_thread_unref (g_thread_self ());
+  }
+  g_mutex_unlock (&component_cache_lock);
+
+  return NULL;
+}
+
+/* Frees all cached components and stops the cache thread. Called
+ * when the plugin is finalized by gst_deinit(), while the OpenMAX
+ * cores are still loaded */
+static void
+gst_omx_component_cache_clear (gpointer data, GObject * plugin)
+{
+  GThread *thread;
+  GList *evicted = NULL;
+
+  g_mutex_lock (&component_cache_lock);
+  component_cache_stop = TRUE;
+  thread = component_cache_thread;
+  component_cache_thread = NULL;
+  g_cond_broadcast (&component_cache_cond);
+  gst_omx_component_cache_evict_unlocked (&evicted, TRUE);
+  g_mutex_unlock (&component_cache_lock);
+
+  if (thread)
+    g_thread_join (thread);
+  gst_omx_component_cache_free_evicted (evicted);
+}
+
+/* Like gst_omx_component_new(), but reuses a component with the same
+ * core, name, role and hacks that was released with
+ * gst_omx_component_release() if there is one. The parameters and
+ * configurations that were set are restored and all ports enabled
+ * on release, so the reused component is in the same state as a new
+ * one except that its ports have to be added again. Elements only
+ * use this if the reuse-component configuration key is set.
+ *
+ * NOTE: Uses comp->lock and comp->messages_lock */
+GstOMXComponent *
+gst_omx_component_acquire (GstObject * parent, const gchar * core_name,
+    const gchar * component_name, const gchar * component_role,
+    guint64 hacks)
+{
+  GstOMXComponent *comp = NULL;
+  GList *l, *evicted = NULL;
+  gchar *key;
+
+  key =
+      gst_omx_component_make_cache_key (core_name, component_name,
+      component_role, hacks);
+
+  g_mutex_lock (&component_cache_lock);
+  gst_omx_component_cache_evict_unlocked (&evicted, FALSE);
+  for (l = component_cache.head; l; l = l->next) {
+    GstOMXComponent *tmp = l->data;
+
+    if (g_str_equal (tmp->cache_key, key)) {
+      comp = tmp;
+      g_queue_delete_link (&component_cache, l);
+      break;
+    }
+  }
+  g_cond_broadcast (&component_cache_cond);
+  g_mutex_unlock (&component_cache_lock);
+
+  gst_omx_component_cache_free_evicted (evicted);
+
+  if (!comp) {
+    comp = gst_omx_component_new (parent, core_name, component_name,
+        component_role, hacks);
+    if (comp)
+      comp->cache_key = key;
+    else
+      g_free (key);
+    return comp;
+  }
+  g_free (key);
+
+  comp->parent = gst_object_ref (parent);
+  GST_DEBUG_OBJECT (parent, "Reusing cached component %p %s", comp,
+      comp->name);
+
+  return comp;
+}
+
+/* Restores the values saved by gst_omx_component_save_default() and
+ * enables all ports again, like they are in a new component. Returns
+ * FALSE if that's not possible.
+ *
+ * NOTE: Uses comp->lock and comp->messages_lock */
+static gboolean
+gst_omx_component_reset (GstOMXComponent * comp)
+{
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  GList *defaults, *l;
+  gint i, n;
+
+  g_mutex_lock (&comp->lock);
+  defaults = comp->defaults;
+  comp->defaults = NULL;
+  if (comp->defaults_unknown)
+    err = OMX_ErrorUndefined;
+  g_mutex_unlock (&comp->lock);
+
+  /* Not with the wrappers, which would save them again */
+  for (l = defaults; l && err == OMX_ErrorNone; l = l->next) {
+    GstOMXDefault *def = l->data;
+
+    if (def->config)
+      err = OMX_SetConfig (comp->handle, def->index, def->data);
+    else
+      err = OMX_SetParameter (comp->handle, def->index, def->data);
+    GST_DEBUG_OBJECT (comp->parent, "Restored %s %s at index 0x%08x: %s "
+        "(0x%08x)", comp->name, def->config ? "configuration" : "parameter",
+        def->index, gst_omx_error_to_string (err), err);
+  }
+  g_list_free_full (defaults, (GDestroyNotify) gst_omx_default_free);
+  if (err != OMX_ErrorNone)
+    return FALSE;
+
+  /* Ports are enabled in Loaded state without buffers */
+  n = comp->ports->len;
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    if (port->buffers
+        || gst_omx_port_set_enabled (port, TRUE) != OMX_ErrorNone
+        || gst_omx_port_wait_enabled (port, 1 * GST_SECOND) != OMX_ErrorNone)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+static gboolean
+gst_omx_component_is_reusable_unlocked (GstOMXComponent * comp)
+{
+  gint i, n;
+
+  gst_omx_component_handle_messages (comp);
+
+  if (!comp->cache_key
+      || comp->state != OMX_StateLoaded
+      || comp->pending_state != OMX_StateInvalid
+      || comp->last_error != OMX_ErrorNone)
+    return FALSE;
+
+  /* port_def is up to date after gst_omx_component_reset() */
+  n = comp->ports->len;
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    if (port->buffers || port->enabled_pending || port->disabled_pending
+        || !port->port_def.bEnabled)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Releases a component from gst_omx_component_new() or
+ * gst_omx_component_acquire(). A component from the latter is kept for
+ * reuse if it is in Loaded state without errors and its defaults
+ * could be restored, otherwise it is freed.
+ *
+ * NOTE: Uses comp->lock and comp->messages_lock */
+void
+gst_omx_component_release (GstOMXComponent * comp)
+{
+  GList *evicted = NULL;
+  gint i, n;
+
+  g_return_if_fail (comp != NULL);
+
+  if (!comp->cache_key || !gst_omx_component_reset (comp)) {
+    gst_omx_component_free (comp);
+    return;
+  }
+
+  /* Cached components don't keep a recycle thread around, it is
+   * started again on first use */
+  if (comp->recycle_thread) {
+    g_mutex_lock (&comp->lock);
+    comp->recycle_stop = TRUE;
+    g_cond_signal (&comp->recycle_cond);
+    g_mutex_unlock (&comp->lock);
+
+    g_thread_join (comp->recycle_thread);
+    comp->recycle_thread = NULL;
+    comp->recycle_stop = FALSE;
+  }
+
+  g_mutex_lock (&comp->lock);
+  if (!gst_omx_component_is_reusable_unlocked (comp)) {
+    g_mutex_unlock (&comp->lock);
+    gst_omx_component_free (comp);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (comp->parent, "Keeping component %p %s for reuse", comp,
+      comp->name);
+
+  /* The ports are added again by the next user. Producers
+   * iterate them with messages_lock */
+  g_mutex_lock (&comp->messages_lock);
+  n = comp->ports->len;
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    g_cond_clear (&port->messages_cond);
+    g_slice_free (GstOMXPort, port);
+  }
+  g_ptr_array_set_size (comp->ports, 0);
+  comp->n_in_ports = 0;
+  comp->n_out_ports = 0;
+  g_mutex_unlock (&comp->messages_lock);
+
+  g_list_free (comp->pending_reconfigure_outports);
+  comp->pending_reconfigure_outports = NULL;
+  g_atomic_int_set (&comp->stats_enabled, FALSE);
+  comp->stats_interval = 0;
+
+  gst_object_unref (comp->parent);
+  comp->parent = NULL;
+  g_mutex_unlock (&comp->lock);
+
+  g_mutex_lock (&component_cache_lock);
+  comp->cache_time = g_get_monotonic_time ();
+  g_queue_push_head (&component_cache, comp);
+  gst_omx_component_cache_evict_unlocked (&evicted, FALSE);
+  if (!component_cache_thread && !component_cache_stop) {
+    component_cache_thread =
+        g_thread_new ("omx-component-cache", gst_omx_component_cache_thread,
+        NULL);
+  }
+  g_cond_broadcast (&component_cache_cond);
+  g_mutex_unlock (&component_cache_lock);
+
+  gst_omx_component_cache_free_evicted (evicted);
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 OMX_ERRORTYPE
 gst_omx_component_set_state (GstOMXComponent * comp, OMX_STATETYPE state)
@@ -840,17 +1637,7 @@ gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout)
       && comp->pending_state != OMX_StateInvalid) {
     g_mutex_lock (&comp->messages_lock);
     g_mutex_unlock (&comp->lock);
-    if (!g_queue_is_empty (&comp->messages)) {
-      signalled = TRUE;
-    }
-    if (timeout == GST_CLOCK_TIME_NONE) {
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-      signalled = TRUE;
-    } else {
-      signalled =
-          g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-          wait_until);
-    }
+    signalled = gst_omx_component_wait_messages (comp, NULL, wait_until);
     g_mutex_unlock (&comp->messages_lock);
     g_mutex_lock (&comp->lock);
     if (signalled)
@@ -925,6 +1712,9 @@ gst_omx_component_add_port (GstOMXComponent * comp, guint32 index)
   port->port_def = port_def;
 
   g_queue_init (&port->pending_buffers);
+  g_queue_init (&port->recycle_buffers);
+  g_cond_init (&port->messages_cond);
+  port->messages_waiters = 0;
   port->flushing = TRUE;
   port->flushed = FALSE;
   port->enabled_pending = FALSE;
@@ -936,7 +1726,10 @@ gst_omx_component_add_port (GstOMXComponent * comp, guint32 index)
   else
     comp->n_out_ports++;
 
+  /* Producers wake up the waiters of all ports */
+  g_mutex_lock (&comp->messages_lock);
   g_ptr_array_add (comp->ports, port);
+  g_mutex_unlock (&comp->messages_lock);
 
   return port;
 }
@@ -969,18 +1762,147 @@ gst_omx_component_get_last_error (GstOMXComponent * comp)
   err = comp->last_error;
   g_mutex_unlock (&comp->lock);
 
-  GST_DEBUG_OBJECT (comp->parent, "Returning last %s error: %s (0x%08x)",
-      comp->name, gst_omx_error_to_string (err), err);
-
-  return err;
+  GST_DEBUG_OBJECT (comp->parent, "Returning last %s error: %s (0x%08x)",
+      comp->name, gst_omx_error_to_string (err), err);
+
+  return err;
+}
+
+const gchar *
+gst_omx_component_get_last_error_string (GstOMXComponent * comp)
+{
+  g_return_val_if_fail (comp != NULL, NULL);
+
+  return gst_omx_error_to_string (gst_omx_component_get_last_error (comp));
+}
+
+/* Enables collecting the port statistics and posting them as element
+ * messages every interval, or disables it if interval is 0. Enabling
+ * it resets the statistics.
+ *
+ * NOTE: Uses comp->lock */
+void
+gst_omx_component_set_stats_interval (GstOMXComponent * comp,
+    GstClockTime interval)
+{
+  gint i, n;
+
+  g_return_if_fail (comp != NULL);
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (interval));
+
+  g_mutex_lock (&comp->lock);
+  if (interval > 0 && !g_atomic_int_get (&comp->stats_enabled)) {
+    n = comp->ports->len;
+    for (i = 0; i < n; i++) {
+      GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+      memset (&port->stats, 0, sizeof (port->stats));
+    }
+    comp->stats_last_post = g_get_monotonic_time ();
+  }
+  comp->stats_interval = interval;
+  g_atomic_int_set (&comp->stats_enabled, interval > 0);
+  g_mutex_unlock (&comp->lock);
+}
+
+/* NOTE: Call with comp->lock */
+static GstStructure *
+gst_omx_port_get_stats_unlocked (GstOMXPort * port)
+{
+  GstOMXPortStats *stats = &port->stats;
+
+  return gst_structure_new ("GstOMXPortStats",
+      "index", G_TYPE_UINT, (guint) port->index,
+      "direction", G_TYPE_STRING,
+      port->port_def.eDir == OMX_DirInput ? "input" : "output",
+      "processed", G_TYPE_UINT64, stats->n_processed,
+      "processing-time-avg", G_TYPE_UINT64,
+      stats->n_processed ? stats->processing_time * GST_USECOND /
+      stats->n_processed : 0,
+      "processing-time-max", G_TYPE_UINT64,
+      stats->processing_time_max * GST_USECOND,
+      "pending-time-avg", G_TYPE_UINT64,
+      stats->n_pending ? stats->pending_time * GST_USECOND /
+      stats->n_pending : 0,
+      "pending-time-max", G_TYPE_UINT64,
+      stats->pending_time_max * GST_USECOND,
+      "acquired", G_TYPE_UINT64, stats->n_acquired,
+      "acquire-time-avg", G_TYPE_UINT64,
+      stats->n_acquired ? stats->acquire_time * GST_USECOND /
+      stats->n_acquired : 0,
+      "acquire-time-max", G_TYPE_UINT64,
+      stats->acquire_time_max * GST_USECOND,
+      "owned", G_TYPE_UINT, stats->owned,
+      "owned-min", G_TYPE_UINT, stats->owned_min,
+      "owned-avg", G_TYPE_DOUBLE,
+      stats->owned_samples ? (gdouble) stats->owned_sum /
+      stats->owned_samples : 0.0,
+      "owned-max", G_TYPE_UINT, stats->owned_max, NULL);
+}
+
+/* Returns the statistics of all ports, with one "port-N" field
+ * per port. Times are in nanoseconds.
+ *
+ * NOTE: Uses comp->lock */
+GstStructure *
+gst_omx_component_get_stats (GstOMXComponent * comp)
+{
+  GstStructure *s;
+  gint i, n;
+
+  g_return_val_if_fail (comp != NULL, NULL);
+
+  s = gst_structure_new ("GstOMXStats", "component", G_TYPE_STRING,
+      comp->name, "enabled", G_TYPE_BOOLEAN,
+      g_atomic_int_get (&comp->stats_enabled), NULL);
+
+  g_mutex_lock (&comp->lock);
+  n = comp->ports->len;
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+    GstStructure *port_s;
+    gchar *name;
+
+    port_s = gst_omx_port_get_stats_unlocked (port);
+    name = g_strdup_printf ("port-%u", (guint) port->index);
+    gst_structure_set (s, name, GST_TYPE_STRUCTURE, port_s, NULL);
+    g_free (name);
+    gst_structure_free (port_s);
+  }
+  g_mutex_unlock (&comp->lock);
+
+  return s;
 }
 
-const gchar *
-gst_omx_component_get_last_error_string (GstOMXComponent * comp)
+/* Posts the statistics as element message on the parent if
+ * the interval passed since the last time. Called from the
+ * streaming threads.
+ *
+ * NOTE: Uses comp->lock */
+void
+gst_omx_component_post_stats (GstOMXComponent * comp)
 {
-  g_return_val_if_fail (comp != NULL, NULL);
+  gint64 now;
 
-  return gst_omx_error_to_string (gst_omx_component_get_last_error (comp));
+  g_return_if_fail (comp != NULL);
+
+  if (!GST_OMX_STATS_ENABLED (comp))
+    return;
+
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&comp->lock);
+  if (now - comp->stats_last_post < comp->stats_interval / GST_USECOND) {
+    g_mutex_unlock (&comp->lock);
+    return;
+  }
+  comp->stats_last_post = now;
+  g_mutex_unlock (&comp->lock);
+
+  if (GST_IS_ELEMENT (comp->parent))
+    gst_element_post_message (GST_ELEMENT_CAST (comp->parent),
+        gst_message_new_element (comp->parent,
+            gst_omx_component_get_stats (comp)));
 }
 
 /* comp->lock must be unlocked while calling this */
@@ -1002,6 +1924,69 @@ gst_omx_component_get_parameter (GstOMXComponent * comp, OMX_INDEXTYPE index,
   return err;
 }
 
+/* Remembers the value at index before it is set for the first time,
+ * so that gst_omx_component_reset() can restore it. Values are kept
+ * per port for structures that have an nPortIndex after nSize and
+ * nVersion, the others use whatever is there as port index.
+ *
+ * NOTE: Uses comp->lock */
+static void
+gst_omx_component_save_default (GstOMXComponent * comp, gboolean config,
+    OMX_INDEXTYPE index, gpointer data)
+{
+  GstOMXDefault *def;
+  OMX_U32 size, port_index = 0;
+  OMX_ERRORTYPE err;
+  GList *l;
+
+  /* Only cached components are reset */
+  if (!comp->cache_key)
+    return;
+
+  size = *(OMX_U32 *) data;
+  if (size >= 3 * sizeof (OMX_U32))
+    port_index = ((OMX_U32 *) data)[2];
+
+  g_mutex_lock (&comp->lock);
+  for (l = comp->defaults; l; l = l->next) {
+    def = l->data;
+    if (def->config == config && def->index == index
+        && def->port_index == port_index) {
+      g_mutex_unlock (&comp->lock);
+      return;
+    }
+  }
+  g_mutex_unlock (&comp->lock);
+
+  def = g_slice_new (GstOMXDefault);
+  def->config = config;
+  def->index = index;
+  def->port_index = port_index;
+  def->data = g_malloc (MAX (size, sizeof (OMX_U32)));
+  memcpy (def->data, data, MAX (size, sizeof (OMX_U32)));
+
+  if (size < 2 * sizeof (OMX_U32))
+    err = OMX_ErrorBadParameter;
+  else if (config)
+    err = gst_omx_component_get_config (comp, index, def->data);
+  else
+    err = gst_omx_component_get_parameter (comp, index, def->data);
+
+  g_mutex_lock (&comp->lock);
+  if (err == OMX_ErrorNone) {
+    comp->defaults = g_list_prepend (comp->defaults, def);
+    def = NULL;
+  } else {
+    GST_DEBUG_OBJECT (comp->parent, "Can't restore %s index 0x%08x: %s "
+        "(0x%08x)", comp->name, index, gst_omx_error_to_string (err), err);
+    comp->defaults_unknown = TRUE;
+  }
+  g_mutex_unlock (&comp->lock);
+
+  if (def)
+    gst_omx_default_free (def);
+}
+
 /* comp->lock must be unlocked while calling this */
 OMX_ERRORTYPE
 gst_omx_component_set_parameter (GstOMXComponent * comp, OMX_INDEXTYPE index,
@@ -1014,6 +1999,7 @@ gst_omx_component_set_parameter (GstOMXComponent * comp, OMX_INDEXTYPE index,
 
   GST_DEBUG_OBJECT (comp->parent, "Setting %s parameter at index 0x%08x",
       comp->name, index);
+  gst_omx_component_save_default (comp, FALSE, index, param);
   err = OMX_SetParameter (comp->handle, index, param);
   GST_DEBUG_OBJECT (comp->parent, "Set %s parameter at index 0x%08x: %s "
       "(0x%08x)", comp->name, index, gst_omx_error_to_string (err), err);
@@ -1052,6 +2038,7 @@ gst_omx_component_set_config (GstOMXComponent * comp, OMX_INDEXTYPE index,
 
   GST_DEBUG_OBJECT (comp->parent, "Setting %s configuration at index 0x%08x",
       comp->name, index);
+  gst_omx_component_save_default (comp, TRUE, index, config);
   err = OMX_SetConfig (comp->handle, index, config);
   GST_DEBUG_OBJECT (comp->parent, "Set %s parameter at index 0x%08x: %s "
       "(0x%08x)", comp->name, index, gst_omx_error_to_string (err), err);
@@ -1059,6 +2046,26 @@ gst_omx_component_set_config (GstOMXComponent * comp, OMX_INDEXTYPE index,
   return err;
 }
 
+/* comp->lock must be unlocked while calling this */
+OMX_ERRORTYPE
+gst_omx_component_get_extension_index (GstOMXComponent * comp,
+    const gchar * name, OMX_INDEXTYPE * index)
+{
+  OMX_ERRORTYPE err;
+
+  g_return_val_if_fail (comp != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (name != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (index != NULL, OMX_ErrorUndefined);
+
+  GST_DEBUG_OBJECT (comp->parent, "Getting %s extension index for %s",
+      comp->name, name);
+  err = OMX_GetExtensionIndex (comp->handle, (OMX_STRING) name, index);
+  GST_DEBUG_OBJECT (comp->parent, "Got %s extension index for %s: %s "
+      "(0x%08x)", comp->name, name, gst_omx_error_to_string (err), err);
+
+  return err;
+}
+
 OMX_ERRORTYPE
 gst_omx_component_setup_tunnel (GstOMXComponent * comp1, GstOMXPort * port1,
     GstOMXComponent * comp2, GstOMXPort * port2)
@@ -1201,6 +2208,7 @@ gst_omx_port_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
   GstOMXComponent *comp;
   OMX_ERRORTYPE err;
   GstOMXBuffer *_buf = NULL;
+  gint64 start = 0;
 
   g_return_val_if_fail (port != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
   g_return_val_if_fail (!port->tunneled, GST_OMX_ACQUIRE_BUFFER_ERROR);
@@ -1210,6 +2218,9 @@ gst_omx_port_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
 
   comp = port->comp;
 
+  if (GST_OMX_STATS_ENABLED (comp))
+    start = g_get_monotonic_time ();
+
   g_mutex_lock (&comp->lock);
   GST_DEBUG_OBJECT (comp->parent, "Acquiring %s buffer from port %u",
       comp->name, port->index);
@@ -1245,8 +2256,7 @@ retry:
             "Waiting for %s output ports to reconfigure", comp->name);
         g_mutex_lock (&comp->messages_lock);
         g_mutex_unlock (&comp->lock);
-        if (g_queue_is_empty (&comp->messages))
-          g_cond_wait (&comp->messages_cond, &comp->messages_lock);
+        gst_omx_component_wait_messages (comp, NULL, -1);
         g_mutex_unlock (&comp->messages_lock);
         g_mutex_lock (&comp->lock);
         gst_omx_component_handle_messages (comp);
@@ -1313,8 +2323,7 @@ retry:
         comp->name, port->index);
     g_mutex_lock (&comp->messages_lock);
     g_mutex_unlock (&comp->lock);
-    if (g_queue_is_empty (&comp->messages))
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
+    gst_omx_component_wait_messages (comp, port, -1);
     g_mutex_unlock (&comp->messages_lock);
     g_mutex_lock (&comp->lock);
     gst_omx_component_handle_messages (comp);
@@ -1333,6 +2342,8 @@ retry:
   goto retry;
 
 done:
+  if (_buf && start)
+    gst_omx_port_stats_buffer_acquired (port, _buf, start);
   g_mutex_unlock (&comp->lock);
 
   if (_buf) {
@@ -1347,26 +2358,21 @@ done:
   return ret;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
-OMX_ERRORTYPE
-gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+/* Prepares buf for being passed to the component. Returns FALSE and
+ * sets err if it was put back into the pending buffers instead because
+ * the component is in error state or the port is flushing
+ *
+ * NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+static gboolean
+gst_omx_port_prepare_release_unlocked (GstOMXPort * port, GstOMXBuffer * buf,
+    OMX_ERRORTYPE * err)
 {
-  GstOMXComponent *comp;
-  OMX_ERRORTYPE err = OMX_ErrorNone;
-
-  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
-  g_return_val_if_fail (!port->tunneled, GST_OMX_ACQUIRE_BUFFER_ERROR);
-  g_return_val_if_fail (buf != NULL, OMX_ErrorUndefined);
-  g_return_val_if_fail (buf->port == port, OMX_ErrorUndefined);
-
-  comp = port->comp;
-
-  g_mutex_lock (&comp->lock);
+  GstOMXComponent *comp = port->comp;
 
   GST_DEBUG_OBJECT (comp->parent, "Releasing buffer %p (%p) to %s port %u",
       buf, buf->omx_buf->pBuffer, comp->name, port->index);
 
-  gst_omx_component_handle_messages (comp);
+  *err = OMX_ErrorNone;
 
   if (port->port_def.eDir == OMX_DirOutput) {
     /* Reset all flags, some implementations don't
@@ -1380,20 +2386,22 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
     buf->omx_buf->nFilledLen = 0;
   }
 
-  if ((err = comp->last_error) != OMX_ErrorNone) {
+  if ((*err = comp->last_error) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (comp->parent, "Component %s is in error state: %s "
-        "(0x%08x)", comp->name, gst_omx_error_to_string (err), err);
-    g_queue_push_tail (&port->pending_buffers, buf);
+        "(0x%08x)", comp->name, gst_omx_error_to_string (*err), *err);
+    if (!buf->held)
+      gst_omx_port_push_pending_buffer (port, buf);
     gst_omx_component_send_message (comp, NULL);
-    goto done;
+    return FALSE;
   }
 
   if (port->flushing) {
     GST_DEBUG_OBJECT (comp->parent, "%s port %u is flushing, not releasing "
         "buffer", comp->name, port->index);
-    g_queue_push_tail (&port->pending_buffers, buf);
-    gst_omx_component_send_message (comp, NULL);
-    goto done;
+    if (!buf->held)
+      gst_omx_port_push_pending_buffer (port, buf);
+    gst_omx_component_wake_waiters (comp, port);
+    return FALSE;
   }
 
   g_assert (buf == buf->omx_buf->pAppPrivate);
@@ -1401,6 +2409,18 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
   /* FIXME: What if the settings cookies don't match? */
 
   buf->used = TRUE;
+  gst_omx_port_stats_buffer_given (port, buf);
+
+  return TRUE;
+}
+
+/* Passes a prepared buffer to the component, can be called
+ * without comp->lock */
+static OMX_ERRORTYPE
+gst_omx_port_submit_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXComponent *comp = port->comp;
+  OMX_ERRORTYPE err;
 
   if (port->port_def.eDir == OMX_DirInput) {
     err = OMX_EmptyThisBuffer (comp->handle, buf->omx_buf);
@@ -1411,13 +2431,262 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
       "(0x%08x)", buf, comp->name, port->index, gst_omx_error_to_string (err),
       err);
 
-done:
+  return err;
+}
+
+/* NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+static OMX_ERRORTYPE
+gst_omx_port_release_buffer_unlocked (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  OMX_ERRORTYPE err;
+
+  if (!gst_omx_port_prepare_release_unlocked (port, buf, &err))
+    return err;
+
+  return gst_omx_port_submit_buffer (port, buf);
+}
+
+/* The component refused a buffer that was released asynchronously.
+ * Nobody waits for the result, so put the component into error state
+ * and wake up everybody. The elements then get the error from the
+ * next call on the port, instead of the port silently running out
+ * of buffers
+ *
+ * NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+static void
+gst_omx_port_release_failed_unlocked (GstOMXPort * port, GstOMXBuffer * buf,
+    OMX_ERRORTYPE err)
+{
+  GstOMXComponent *comp = port->comp;
+
+  GST_ERROR_OBJECT (comp->parent, "Failed to release buffer %p to %s port "
+      "%u: %s (0x%08x)", buf, comp->name, port->index,
+      gst_omx_error_to_string (err), err);
+
+  buf->used = FALSE;
+  if (!buf->held)
+    gst_omx_port_push_pending_buffer (port, buf);
+
+  if (comp->last_error == OMX_ErrorNone)
+    comp->last_error = err;
+  gst_omx_component_send_message (comp, NULL);
+}
+
+/* Releases all buffers that were queued with
+ * gst_omx_port_release_buffer_async(), in order. If the port
+ * is flushing they are put back into the pending buffers
+ *
+ * NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+static void
+gst_omx_port_recycle_buffers_unlocked (GstOMXPort * port)
+{
+  GstOMXComponent *comp = port->comp;
+  GstOMXBuffer *buf;
+  OMX_ERRORTYPE err;
+  guint n = 0;
+
+  /* The recycle thread might still be passing earlier buffers to
+   * the component, wait for it to keep the order and so that no
+   * buffer arrives after flushing or disabling the port */
+  while (comp->recycling)
+    g_cond_wait (&comp->recycle_done_cond, &comp->lock);
+
+  while ((buf = g_queue_pop_head (&port->recycle_buffers))) {
+    comp->recycle_pending--;
+    if (gst_omx_port_prepare_release_unlocked (port, buf, &err)) {
+      err = gst_omx_port_submit_buffer (port, buf);
+      if (err != OMX_ErrorNone)
+        gst_omx_port_release_failed_unlocked (port, buf, err);
+    }
+    n++;
+  }
+
+  if (n > 0)
+    GST_LOG_OBJECT (comp->parent, "Recycled %u buffers of %s port %u", n,
+        comp->name, port->index);
+}
+
+/* Returns the buffers queued by gst_omx_port_release_buffer_async()
+ * to the component in batches, so that the OpenMAX calls don't
+ * block the streaming threads. The batches are passed to the
+ * component without comp->lock, acquiring buffers is not blocked
+ * by them */
+static gpointer
+gst_omx_component_recycle_thread (GstOMXComponent * comp)
+{
+  GQueue batch = G_QUEUE_INIT, failed = G_QUEUE_INIT;
+  OMX_ERRORTYPE err, failed_err = OMX_ErrorNone;
+  GstOMXBuffer *buf;
+  gint i, n;
+
+  g_mutex_lock (&comp->lock);
+  while (!comp->recycle_stop) {
+    if (comp->recycle_pending == 0) {
+      g_cond_wait (&comp->recycle_cond, &comp->lock);
+      continue;
+    }
+
+    gst_omx_component_handle_messages (comp);
+    n = comp->ports->len;
+    for (i = 0; i < n; i++) {
+      GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+      while ((buf = g_queue_pop_head (&port->recycle_buffers))) {
+        comp->recycle_pending--;
+        if (gst_omx_port_prepare_release_unlocked (port, buf, &err))
+          g_queue_push_tail (&batch, buf);
+      }
+    }
+
+    comp->recycling = TRUE;
+    g_mutex_unlock (&comp->lock);
+
+    while ((buf = g_queue_pop_head (&batch))) {
+      err = gst_omx_port_submit_buffer (buf->port, buf);
+      if (err != OMX_ErrorNone) {
+        g_queue_push_tail (&failed, buf);
+        failed_err = err;
+      }
+    }
+
+    g_mutex_lock (&comp->lock);
+    comp->recycling = FALSE;
+    g_cond_broadcast (&comp->recycle_done_cond);
+
+    while ((buf = g_queue_pop_head (&failed)))
+      gst_omx_port_release_failed_unlocked (buf->port, buf, failed_err);
+
+    gst_omx_component_handle_messages (comp);
+  }
+  g_mutex_unlock (&comp->lock);
+
+  return NULL;
+}
+
+/* NOTE: Uses comp->lock and comp->messages_lock */
+OMX_ERRORTYPE
+gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXComponent *comp;
+  OMX_ERRORTYPE err;
+
+  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (!port->tunneled, GST_OMX_ACQUIRE_BUFFER_ERROR);
+  g_return_val_if_fail (buf != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (buf->port == port, OMX_ErrorUndefined);
+
+  comp = port->comp;
+
+  g_mutex_lock (&comp->lock);
+
   gst_omx_component_handle_messages (comp);
+
+  /* Keep the order in which buffers were released */
+  gst_omx_port_recycle_buffers_unlocked (port);
+  err = gst_omx_port_release_buffer_unlocked (port, buf);
+
+  gst_omx_component_handle_messages (comp);
+  g_mutex_unlock (&comp->lock);
+
+  return err;
+}
+
+/* Like gst_omx_port_release_buffer() but only queues the buffer,
+ * it is passed to the component later from another thread. Buffers
+ * are released in the order they were queued, and are put back into
+ * the pending buffers instead if the port is flushing or disabled
+ * meanwhile.
+ *
+ * Returns the last error of the component, the result of
+ * releasing the buffer itself is not known yet.
+ *
+ * NOTE: Uses comp->lock */
+OMX_ERRORTYPE
+gst_omx_port_release_buffer_async (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXComponent *comp;
+  OMX_ERRORTYPE err;
+
+  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (!port->tunneled, GST_OMX_ACQUIRE_BUFFER_ERROR);
+  g_return_val_if_fail (buf != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (buf->port == port, OMX_ErrorUndefined);
+
+  comp = port->comp;
+
+  g_mutex_lock (&comp->lock);
+
+  GST_DEBUG_OBJECT (comp->parent, "Queueing buffer %p (%p) for %s port %u",
+      buf, buf->omx_buf->pBuffer, comp->name, port->index);
+
+  if (!comp->recycle_thread)
+    comp->recycle_thread =
+        g_thread_new ("omx-recycle",
+        (GThreadFunc) gst_omx_component_recycle_thread, comp);
+
+  g_queue_push_tail (&port->recycle_buffers, buf);
+  /* The thread only needs to be woken up for the first buffer
+   * of a batch */
+  if (comp->recycle_pending++ == 0)
+    g_cond_signal (&comp->recycle_cond);
+
+  err = comp->last_error;
   g_mutex_unlock (&comp->lock);
 
   return err;
 }
 
+/* Marks a buffer acquired from the port as referenced from outside,
+ * e.g. by a GstBuffer that was given to upstream. It is not put back
+ * into the port's pending buffers after it was used by the component
+ * until gst_omx_port_unhold_buffer() is called.
+ *
+ * NOTE: Uses comp->lock */
+void
+gst_omx_port_hold_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXComponent *comp;
+
+  g_return_if_fail (port != NULL);
+  g_return_if_fail (buf != NULL);
+  g_return_if_fail (buf->port == port);
+
+  comp = port->comp;
+
+  g_mutex_lock (&comp->lock);
+  g_assert (!buf->used && !buf->held);
+  buf->held = TRUE;
+  g_mutex_unlock (&comp->lock);
+}
+
+/* NOTE: Uses comp->lock and comp->messages_lock */
+void
+gst_omx_port_unhold_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXComponent *comp;
+
+  g_return_if_fail (port != NULL);
+  g_return_if_fail (buf != NULL);
+  g_return_if_fail (buf->port == port);
+
+  comp = port->comp;
+
+  g_mutex_lock (&comp->lock);
+  gst_omx_component_handle_messages (comp);
+
+  g_assert (buf->held);
+  buf->held = FALSE;
+
+  /* Otherwise it is put back once the component is done with it */
+  if (!buf->used) {
+    GST_DEBUG_OBJECT (comp->parent, "Putting back held buffer %p (%p) of %s "
+        "port %u", buf, buf->omx_buf->pBuffer, comp->name, port->index);
+    gst_omx_port_push_pending_buffer (port, buf);
+    gst_omx_component_wake_waiters (comp, port);
+  }
+  g_mutex_unlock (&comp->lock);
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 OMX_ERRORTYPE
 gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
@@ -1455,6 +2724,8 @@ gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
     gboolean signalled;
     OMX_ERRORTYPE last_error;
 
+    /* Queued buffers go back to the pending buffers now */
+    gst_omx_port_recycle_buffers_unlocked (port);
     gst_omx_component_send_message (comp, NULL);
 
     /* Now flush the port */
@@ -1511,19 +2782,7 @@ gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
         && port->buffers->len > g_queue_get_length (&port->pending_buffers)) {
       g_mutex_lock (&comp->messages_lock);
       g_mutex_unlock (&comp->lock);
-
-      if (!g_queue_is_empty (&comp->messages)) {
-        signalled = TRUE;
-      }
-      if (timeout == GST_CLOCK_TIME_NONE) {
-        g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-        signalled = TRUE;
-      } else {
-        signalled =
-            g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-            wait_until);
-      }
-
+      signalled = gst_omx_component_wait_messages (comp, port, wait_until);
       g_mutex_unlock (&comp->messages_lock);
       g_mutex_lock (&comp->lock);
 
@@ -1630,7 +2889,8 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
 
   GST_INFO_OBJECT (comp->parent,
       "Allocating %d buffers of size %" G_GSIZE_FORMAT " for %s port %u", n,
-      (size_t) port->port_def.nBufferSize, comp->name, (guint) port->index);
+      (size_t) MAX (port->port_def.nBufferSize, port->min_buffer_size),
+      comp->name, (guint) port->index);
 
   if (!port->buffers)
     port->buffers = g_ptr_array_sized_new (n);
@@ -1658,7 +2918,7 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
     } else {
       err =
           OMX_AllocateBuffer (comp->handle, &buf->omx_buf, port->index, buf,
-          port->port_def.nBufferSize);
+          MAX (port->port_def.nBufferSize, port->min_buffer_size));
       buf->eglimage = FALSE;
     }
 
@@ -1676,11 +2936,26 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
     g_assert (buf->omx_buf->pAppPrivate == buf);
 
     /* In the beginning all buffers are not owned by the component */
-    g_queue_push_tail (&port->pending_buffers, buf);
+    gst_omx_port_push_pending_buffer (port, buf);
     if (buffers || images)
       l = l->next;
   }
 
+  /* Every buffer can be done at most once before we handle the
+   * messages, make sure that never needs an allocation */
+  {
+    guint j, n_buffers = 0;
+
+    for (j = 0; j < comp->ports->len; j++) {
+      GstOMXPort *tmp = g_ptr_array_index (comp->ports, j);
+
+      if (tmp->buffers)
+        n_buffers += tmp->buffers->len;
+    }
+    gst_omx_component_reserve_messages (comp,
+        n_buffers + GST_OMX_MESSAGE_RESERVE);
+  }
+
   gst_omx_component_handle_messages (comp);
 
 done:
@@ -1784,6 +3059,12 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
           "port %u", buf, comp->name, port->index);
     }
 
+    /* Held buffers use memory that is not freed with them */
+    if (buf->held) {
+      GST_DEBUG_OBJECT (comp->parent, "Freeing held buffer %p of %s "
+          "port %u", buf, comp->name, port->index);
+    }
+
     /* omx_buf can be NULL if allocation failed earlier
      * and we're just shutting down
      *
@@ -1809,6 +3090,8 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
     g_slice_free (GstOMXBuffer, buf);
   }
   g_queue_clear (&port->pending_buffers);
+  comp->recycle_pending -= g_queue_get_length (&port->recycle_buffers);
+  g_queue_clear (&port->recycle_buffers);
   g_ptr_array_unref (port->buffers);
   port->buffers = NULL;
 
@@ -1880,6 +3163,7 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
      * by the component and no new buffers should be passed to
      * the component anymore */
     port->flushing = TRUE;
+    gst_omx_port_recycle_buffers_unlocked (port);
   }
 
   if (enabled)
@@ -1916,6 +3200,26 @@ done:
   return err;
 }
 
+/* Number of buffers the component released, held buffers are
+ * waited for by whoever holds them before they are freed
+ *
+ * NOTE: Must be called while holding comp->lock */
+static guint
+gst_omx_port_n_released_buffers_unlocked (GstOMXPort * port)
+{
+  guint i, n;
+
+  n = g_queue_get_length (&port->pending_buffers);
+  for (i = 0; i < port->buffers->len; i++) {
+    GstOMXBuffer *buf = g_ptr_array_index (port->buffers, i);
+
+    if (buf->held && !buf->used)
+      n++;
+  }
+
+  return n;
+}
+
 static OMX_ERRORTYPE
 gst_omx_port_wait_buffers_released_unlocked (GstOMXPort * port,
     GstClockTime timeout)
@@ -1939,12 +3243,16 @@ gst_omx_port_wait_buffers_released_unlocked (GstOMXPort * port,
   GST_INFO_OBJECT (comp->parent, "Waiting for %s port %u to release all "
       "buffers", comp->name, port->index);
 
+  /* Don't wait for the recycle thread */
+  gst_omx_port_recycle_buffers_unlocked (port);
+
   if (timeout != GST_CLOCK_TIME_NONE) {
     gint64 add = timeout / (GST_SECOND / G_TIME_SPAN_SECOND);
 
     if (add == 0) {
       if (port->buffers
-          && port->buffers->len > g_queue_get_length (&port->pending_buffers))
+          && port->buffers->len >
+          gst_omx_port_n_released_buffers_unlocked (port))
         err = OMX_ErrorTimeout;
       goto done;
     }
@@ -1962,19 +3270,10 @@ gst_omx_port_wait_buffers_released_unlocked (GstOMXPort * port,
   gst_omx_component_handle_messages (comp);
   while (signalled && last_error == OMX_ErrorNone && (port->buffers
           && port->buffers->len >
-          g_queue_get_length (&port->pending_buffers))) {
+          gst_omx_port_n_released_buffers_unlocked (port))) {
     g_mutex_lock (&comp->messages_lock);
     g_mutex_unlock (&comp->lock);
-    if (!g_queue_is_empty (&comp->messages)) {
-      signalled = TRUE;
-    } else if (timeout != GST_CLOCK_TIME_NONE) {
-      signalled =
-          g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-          wait_until);
-    } else {
-      signalled = TRUE;
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-    }
+    signalled = gst_omx_component_wait_messages (comp, port, wait_until);
     g_mutex_unlock (&comp->messages_lock);
     g_mutex_lock (&comp->lock);
     if (signalled)
@@ -2081,6 +3380,7 @@ gst_omx_port_populate_unlocked (GstOMXPort * port)
        */
       buf->omx_buf->nFlags = 0;
 
+      gst_omx_port_stats_buffer_given (port, buf);
       err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
 
       if (err != OMX_ErrorNone) {
@@ -2180,16 +3480,7 @@ gst_omx_port_wait_enabled_unlocked (GstOMXPort * port, GstClockTime timeout)
           || port->disabled_pending)) {
     g_mutex_lock (&comp->messages_lock);
     g_mutex_unlock (&comp->lock);
-    if (!g_queue_is_empty (&comp->messages)) {
-      signalled = TRUE;
-    } else if (timeout != GST_CLOCK_TIME_NONE) {
-      signalled =
-          g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-          wait_until);
-    } else {
-      signalled = TRUE;
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-    }
+    signalled = gst_omx_component_wait_messages (comp, port, wait_until);
     g_mutex_unlock (&comp->messages_lock);
     g_mutex_lock (&comp->lock);
     if (signalled)
@@ -2682,6 +3973,21 @@ _class_init (gpointer g_class, gpointer data)
 
     class_data->hacks = gst_omx_parse_hacks (hacks);
   }
+
+  /* Keeping released components around is opt-in, not every
+   * component comes back from Loaded state in its initial state */
+  class_data->reuse_component =
+      g_key_file_get_boolean (config, element_name, "reuse-component", NULL);
+  if (class_data->reuse_component)
+    GST_DEBUG ("Reusing components for element '%s'", element_name);
+
+  /* QP maps have no standard index, components that support them
+   * name their vendor extension here */
+  if ((class_data->qp_map_extension =
+          g_key_file_get_string (config, element_name, "qp-map-extension",
+              NULL)))
+    GST_DEBUG ("Using QP map extension '%s' for element '%s'",
+        class_data->qp_map_extension, element_name);
 }
 
 static gboolean
@@ -2701,6 +4007,9 @@ plugin_init (GstPlugin * plugin)
 
   GST_DEBUG_CATEGORY_INIT (gstomx_debug, "omx", 0, "gst-omx");
 
+  /* Cached components have to be freed before the cores are unloaded */
+  g_object_weak_ref (G_OBJECT (plugin), gst_omx_component_cache_clear, NULL);
+
   /* Read configuration file gstomx.conf from the preferred
    * configuration directories */
   env_config_dir = g_strdup (g_getenv (*env_config_name));
@@ -109,11 +109,13 @@ G_BEGIN_DECLS
 
 typedef struct _GstOMXCore GstOMXCore;
 typedef struct _GstOMXPort GstOMXPort;
+typedef struct _GstOMXPortStats GstOMXPortStats;
 typedef enum _GstOMXPortDirection GstOMXPortDirection;
 typedef struct _GstOMXComponent GstOMXComponent;
 typedef struct _GstOMXBuffer GstOMXBuffer;
 typedef struct _GstOMXClassData GstOMXClassData;
 typedef struct _GstOMXMessage GstOMXMessage;
+typedef struct _GstOMXMessageSlot GstOMXMessageSlot;
 
 typedef enum {
   /* Everything good and the buffer is valid */
@@ -181,6 +183,7 @@ struct _GstOMXMessage {
     } port_enable;
     struct {
       OMX_U32 port;
+      OMX_U32 index; /* Changed parameter or configuration, 0 if unknown */
     } port_settings_changed;
     struct {
       OMX_U32 port;
@@ -191,10 +194,40 @@ struct _GstOMXMessage {
       OMX_PTR app_data;
       OMX_BUFFERHEADERTYPE *buffer;
       OMX_BOOL empty;
+      gint64 time; /* Only set if statistics are enabled */
     } buffer_done;
   } content;
 };
 
+/* Slot of the message ring. The sequence number hands the
+ * slot over between the producers and the consumer */
+struct _GstOMXMessageSlot {
+  volatile gint sequence;
+  GstOMXMessage msg;
+};
+
+/* Statistics of a port, only collected if enabled with
+ * gst_omx_component_set_stats_interval(). Times are in
+ * microseconds */
+struct _GstOMXPortStats {
+  /* From {Empty,Fill}ThisBuffer until the buffer is done */
+  guint64 n_processed;
+  guint64 processing_time, processing_time_max;
+
+  /* Time buffers spend in pending_buffers */
+  guint64 n_pending;
+  guint64 pending_time, pending_time_max;
+
+  /* Time spent in gst_omx_port_acquire_buffer() */
+  guint64 n_acquired;
+  guint64 acquire_time, acquire_time_max;
+
+  /* Number of buffers owned by the component, sampled
+   * whenever it changes */
+  guint owned, owned_min, owned_max;
+  guint64 owned_sum, owned_samples;
+};
+
 struct _GstOMXPort {
   GstOMXComponent *comp;
   guint32 index;
@@ -204,6 +237,12 @@ struct _GstOMXPort {
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
   GPtrArray *buffers; /* Contains GstOMXBuffer* */
   GQueue pending_buffers; /* Contains GstOMXBuffer* */
+  /* Buffers are allocated with at least this size, if
+   * larger than the port definition's nBufferSize */
+  guint32 min_buffer_size;
+  /* Buffers queued by gst_omx_port_release_buffer_async(),
+   * protected by comp->lock */
+  GQueue recycle_buffers; /* Contains GstOMXBuffer* */
   gboolean flushing;
   gboolean flushed; /* TRUE after OMX_CommandFlush was done */
   gboolean enabled_pending;  /* TRUE after OMX_Command{En,Dis}able */
@@ -216,6 +255,23 @@ struct _GstOMXPort {
    */
   gint settings_cookie;
   gint configured_settings_cookie;
+
+  /* Increased atomically whenever the component changes the
+   * OMX_IndexConfigCommonOutputCrop rectangle of this port, which
+   * needs no reconfiguration */
+  gint crop_cookie;
+
+  /* Signalled with comp->messages_lock when buffers of this port
+   * are done and for messages that concern the whole component */
+  GCond messages_cond;
+  volatile gint messages_waiters;
+
+  /* TRUE if port_def has to be updated after the settings
+   * changed, done once per batch of messages */
+  gboolean settings_changed;
+
+  /* Protected by comp->lock */
+  GstOMXPortStats stats;
 };
 
 struct _GstOMXComponent {
@@ -235,13 +291,46 @@ struct _GstOMXComponent {
   /* Locking order: lock -> messages_lock
    *
    * Never hold lock while waiting for messages_cond
-   * Always check that messages is empty before waiting */
+   * Always check that there are no messages before waiting */
   GMutex lock;
 
-  GQueue messages; /* Queue of GstOMXMessages */
+  /* Bounded multi-producer/single-consumer ring of messages.
+   * Producers are the OpenMAX callbacks and don't take any lock,
+   * the consumer is whoever holds lock */
+  GstOMXMessageSlot *messages_ring;
+  guint messages_ring_mask;
+  volatile gint messages_head; /* Next slot to write */
+  volatile gint messages_tail; /* Next slot to read, written with lock */
+
+  /* Number of threads waiting for messages_cond or any port's
+   * messages_cond, producers only take messages_lock to wake them
+   * up if this is not 0 */
+  volatile gint messages_waiters;
+
+  /* Overflow queue of GstOMXMessages for when the ring is full.
+   * Protected by messages_lock, messages_overflow is TRUE as long
+   * as it is not empty */
+  GQueue messages;
+  /* Preallocated links and messages for the overflow queue,
+   * protected by messages_lock */
+  GQueue messages_free;
+  guint messages_allocated;
+  volatile gint messages_overflow;
   GMutex messages_lock;
   GCond messages_cond;
 
+  /* Message statistics, protected by lock */
+  guint64 messages_handled;
+  guint64 messages_drains; /* Calls that handled at least one message */
+  guint messages_max_batch;
+  guint64 messages_coalesced; /* Port definition updates saved */
+
+  /* Port statistics are collected if stats_enabled is TRUE, read
+   * atomically by the callbacks. The others are protected by lock */
+  volatile gint stats_enabled;
+  GstClockTime stats_interval;
+  gint64 stats_last_post;
+
   OMX_STATETYPE state;
   /* OMX_StateInvalid if no pending state */
   OMX_STATETYPE pending_state;
@@ -249,6 +338,31 @@ struct _GstOMXComponent {
   OMX_ERRORTYPE last_error;
 
   GList *pending_reconfigure_outports;
+
+  /* Thread that releases the ports' recycle_buffers, started on
+   * first use. recycle_pending is the number of queued buffers of
+   * all ports, recycle_cond is signalled with lock. recycling is
+   * TRUE while the thread passes a batch to the component without
+   * lock, recycle_done_cond is signalled with lock afterwards */
+  GThread *recycle_thread;
+  GCond recycle_cond;
+  guint recycle_pending;
+  gboolean recycle_stop;
+  gboolean recycling;
+  GCond recycle_done_cond;
+
+  /* Identifies components from gst_omx_component_acquire() that can
+   * be reused, NULL for components that are not cached. cache_time is
+   * the monotonic time when the component was released, protected by
+   * the cache lock */
+  gchar *cache_key;
+  gint64 cache_time;
+  /* Values of the parameters and configurations before they were set
+   * for the first time, restored when a cached component is released.
+   * defaults_unknown is TRUE if one of them could not be read.
+   * Protected by lock */
+  GList *defaults;
+  gboolean defaults_unknown;
 };
 
 struct _GstOMXBuffer {
@@ -265,6 +379,16 @@ struct _GstOMXBuffer {
 
   /* TRUE if this is an EGLImage */
   gboolean eglimage;
+
+  /* TRUE if the buffer is referenced from outside the
+   * port, see gst_omx_port_hold_buffer()
+   */
+  gboolean held;
+
+  /* Monotonic times when the buffer was passed to the component
+   * and put into pending_buffers, 0 if unknown. For the statistics */
+  gint64 process_start;
+  gint64 pending_start;
 };
 
 struct _GstOMXClassData {
@@ -279,6 +403,15 @@ struct _GstOMXClassData {
 
   guint64 hacks;
 
+  /* Use gst_omx_component_acquire() and gst_omx_component_release(),
+   * set with the reuse-component configuration key */
+  gboolean reuse_component;
+
+  /* Name of the vendor extension for QP delta maps, set with the
+   * qp-map-extension configuration key. The extension has to take a
+   * GstOMXVideoQpMapConfig, NULL if the component has none */
+  const gchar *qp_map_extension;
+
   GstOmxComponentType type;
 };
 
@@ -296,6 +429,8 @@ void              gst_omx_core_release (GstOMXCore * core);
 
 GstOMXComponent * gst_omx_component_new (GstObject * parent, const gchar *core_name, const gchar *component_name, const gchar * component_role, guint64 hacks);
 void              gst_omx_component_free (GstOMXComponent * comp);
+GstOMXComponent * gst_omx_component_acquire (GstObject * parent, const gchar *core_name, const gchar *component_name, const gchar * component_role, guint64 hacks);
+void              gst_omx_component_release (GstOMXComponent * comp);
 
 OMX_ERRORTYPE     gst_omx_component_set_state (GstOMXComponent * comp, OMX_STATETYPE state);
 OMX_STATETYPE     gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout);
@@ -303,6 +438,10 @@ OMX_STATETYPE     gst_omx_component_get_state (GstOMXComponent * comp, GstClockT
 OMX_ERRORTYPE     gst_omx_component_get_last_error (GstOMXComponent * comp);
 const gchar *     gst_omx_component_get_last_error_string (GstOMXComponent * comp);
 
+void              gst_omx_component_set_stats_interval (GstOMXComponent * comp, GstClockTime interval);
+GstStructure *    gst_omx_component_get_stats (GstOMXComponent * comp);
+void              gst_omx_component_post_stats (GstOMXComponent * comp);
+
 GstOMXPort *      gst_omx_component_add_port (GstOMXComponent * comp, guint32 index);
 GstOMXPort *      gst_omx_component_get_port (GstOMXComponent * comp, guint32 index);
 
@@ -311,6 +450,7 @@ OMX_ERRORTYPE     gst_omx_component_set_parameter (GstOMXComponent * comp, OMX_I
 
 OMX_ERRORTYPE     gst_omx_component_get_config (GstOMXComponent * comp, OMX_INDEXTYPE index, gpointer config);
 OMX_ERRORTYPE     gst_omx_component_set_config (GstOMXComponent * comp, OMX_INDEXTYPE index, gpointer config);
+OMX_ERRORTYPE     gst_omx_component_get_extension_index (GstOMXComponent * comp, const gchar * name, OMX_INDEXTYPE * index);
 OMX_ERRORTYPE     gst_omx_component_setup_tunnel (GstOMXComponent * comp1, GstOMXPort * port1, GstOMXComponent * comp2, GstOMXPort * port2);
 OMX_ERRORTYPE     gst_omx_component_close_tunnel (GstOMXComponent * comp1, GstOMXPort * port1, GstOMXComponent * comp2, GstOMXPort * port2);
 
@@ -320,6 +460,9 @@ OMX_ERRORTYPE     gst_omx_port_update_port_definition (GstOMXPort *port, OMX_PAR
 
 GstOMXAcquireBufferReturn gst_omx_port_acquire_buffer (GstOMXPort *port, GstOMXBuffer **buf);
 OMX_ERRORTYPE     gst_omx_port_release_buffer (GstOMXPort *port, GstOMXBuffer *buf);
+OMX_ERRORTYPE     gst_omx_port_release_buffer_async (GstOMXPort *port, GstOMXBuffer *buf);
+void              gst_omx_port_hold_buffer (GstOMXPort *port, GstOMXBuffer *buf);
+void              gst_omx_port_unhold_buffer (GstOMXPort *port, GstOMXBuffer *buf);
 
 OMX_ERRORTYPE     gst_omx_port_set_flushing (GstOMXPort *port, GstClockTime timeout, gboolean flush);
 gboolean          gst_omx_port_is_flushing (GstOMXPort *port);
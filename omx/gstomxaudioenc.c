@@ -32,6 +32,10 @@ GST_DEBUG_CATEGORY_STATIC (gst_omx_audio_enc_debug_category);
 
 /* prototypes */
 static void gst_omx_audio_enc_finalize (GObject * object);
+static void gst_omx_audio_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_omx_audio_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn
 gst_omx_audio_enc_change_state (GstElement * element,
@@ -51,9 +55,13 @@ static GstFlowReturn gst_omx_audio_enc_drain (GstOMXAudioEnc * self);
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_STATS,
+  PROP_STATS_INTERVAL
 };
 
+#define GST_OMX_AUDIO_ENC_STATS_INTERVAL_DEFAULT (0)
+
 /* class initialization */
 
 #define DEBUG_INIT \
@@ -71,6 +79,20 @@ gst_omx_audio_enc_class_init (GstOMXAudioEncClass * klass)
   GstAudioEncoderClass *audio_encoder_class = GST_AUDIO_ENCODER_CLASS (klass);
 
   gobject_class->finalize = gst_omx_audio_enc_finalize;
+  gobject_class->set_property = gst_omx_audio_enc_set_property;
+  gobject_class->get_property = gst_omx_audio_enc_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Latency and occupancy statistics of the OpenMAX ports",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics Interval",
+          "Interval in milliseconds for collecting the port statistics and "
+          "posting them as element messages (0=disabled)",
+          0, G_MAXUINT, GST_OMX_AUDIO_ENC_STATS_INTERVAL_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_audio_enc_change_state);
@@ -96,6 +118,8 @@ gst_omx_audio_enc_class_init (GstOMXAudioEncClass * klass)
 static void
 gst_omx_audio_enc_init (GstOMXAudioEnc * self)
 {
+  self->stats_interval = GST_OMX_AUDIO_ENC_STATS_INTERVAL_DEFAULT;
+
   g_mutex_init (&self->drain_lock);
   g_cond_init (&self->drain_cond);
 }
@@ -106,15 +130,24 @@ gst_omx_audio_enc_open (GstOMXAudioEnc * self)
   GstOMXAudioEncClass *klass = GST_OMX_AUDIO_ENC_GET_CLASS (self);
   gint in_port_index, out_port_index;
 
-  self->enc =
-      gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
-      klass->cdata.component_name, klass->cdata.component_role,
-      klass->cdata.hacks);
+  if (klass->cdata.reuse_component)
+    self->enc =
+        gst_omx_component_acquire (GST_OBJECT_CAST (self),
+        klass->cdata.core_name, klass->cdata.component_name,
+        klass->cdata.component_role, klass->cdata.hacks);
+  else
+    self->enc =
+        gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
+        klass->cdata.component_name, klass->cdata.component_role,
+        klass->cdata.hacks);
   self->started = FALSE;
 
   if (!self->enc)
     return FALSE;
 
+  gst_omx_component_set_stats_interval (self->enc,
+      self->stats_interval * GST_MSECOND);
+
   if (gst_omx_component_get_state (self->enc,
           GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
     return FALSE;
@@ -189,7 +222,7 @@ gst_omx_audio_enc_close (GstOMXAudioEnc * self)
   self->enc_in_port = NULL;
   self->enc_out_port = NULL;
   if (self->enc)
-    gst_omx_component_free (self->enc);
+    gst_omx_component_release (self->enc);
   self->enc = NULL;
 
   return TRUE;
@@ -206,6 +239,45 @@ gst_omx_audio_enc_finalize (GObject * object)
   G_OBJECT_CLASS (gst_omx_audio_enc_parent_class)->finalize (object);
 }
 
+static void
+gst_omx_audio_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXAudioEnc *self = GST_OMX_AUDIO_ENC (object);
+
+  switch (prop_id) {
+    case PROP_STATS_INTERVAL:
+      self->stats_interval = g_value_get_uint (value);
+      if (self->enc)
+        gst_omx_component_set_stats_interval (self->enc,
+            self->stats_interval * GST_MSECOND);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_audio_enc_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstOMXAudioEnc *self = GST_OMX_AUDIO_ENC (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      g_value_take_boxed (value,
+          self->enc ? gst_omx_component_get_stats (self->enc) : NULL);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, self->stats_interval);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static GstStateChangeReturn
 gst_omx_audio_enc_change_state (GstElement * element, GstStateChange transition)
 {
@@ -288,6 +360,7 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
   klass = GST_OMX_AUDIO_ENC_GET_CLASS (self);
 
   acq_return = gst_omx_port_acquire_buffer (port, &buf);
+  gst_omx_component_post_stats (self->enc);
   if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
     goto component_error;
   } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
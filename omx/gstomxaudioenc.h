@@ -70,6 +70,9 @@ struct _GstOMXAudioEnc
   gboolean draining;
 
   GstFlowReturn downstream_flow_ret;
+
+  /* properties */
+  guint stats_interval;
 };
 
 struct _GstOMXAudioEncClass
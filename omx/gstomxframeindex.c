@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2011, Hewlett-Packard Development Company, L.P.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>, Collabora Ltd.
+ * Copyright (C) 2013, Collabora Ltd.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstomxframeindex.h"
+
+/* Set as user data of the frame, the entry is removed
+ * from the index when the frame is freed */
+struct _GstOMXFrameIndexEntry
+{
+  GstOMXFrameIndex *index;
+  GstVideoCodecFrame *frame;    /* Not reffed */
+  guint64 timestamp;
+
+  /* Next unused entry while in the free list */
+  GstOMXFrameIndexEntry *next;
+};
+
+#define ENTRY(index, i) \
+    g_array_index ((index)->entries, GstOMXFrameIndexEntry *, (i))
+
+/* Returns the position of the first entry with a timestamp
+ * not lower than timestamp, or after it if upper is TRUE
+ *
+ * NOTE: Call with index->lock */
+static guint
+gst_omx_frame_index_search (GstOMXFrameIndex * index, guint64 timestamp,
+    gboolean upper)
+{
+  guint low = 0, high = index->entries->len;
+
+  while (low < high) {
+    guint mid = low + (high - low) / 2;
+    guint64 mid_timestamp = ENTRY (index, mid)->timestamp;
+
+    if (mid_timestamp < timestamp || (upper && mid_timestamp == timestamp))
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+/* Puts the entry of a freed frame back into the free list, entries
+ * that were detached by gst_omx_frame_index_clear() are freed
+ *
+ * NOTE: Uses index->lock */
+static void
+gst_omx_frame_index_entry_free (GstOMXFrameIndexEntry * entry)
+{
+  GstOMXFrameIndex *index = entry->index;
+  guint i;
+
+  if (!index) {
+    g_slice_free (GstOMXFrameIndexEntry, entry);
+    return;
+  }
+
+  g_mutex_lock (&index->lock);
+  for (i = gst_omx_frame_index_search (index, entry->timestamp, FALSE);
+      i < index->entries->len; i++) {
+    if (ENTRY (index, i) == entry) {
+      g_array_remove_index (index->entries, i);
+      break;
+    }
+  }
+
+  entry->frame = NULL;
+  entry->next = index->free_entries;
+  index->free_entries = entry;
+  index->n_free_entries++;
+  g_mutex_unlock (&index->lock);
+}
+
+void
+gst_omx_frame_index_init (GstOMXFrameIndex * index)
+{
+  g_mutex_init (&index->lock);
+  index->entries = g_array_sized_new (FALSE, FALSE,
+      sizeof (GstOMXFrameIndexEntry *), 32);
+  index->free_entries = NULL;
+  index->n_free_entries = 0;
+}
+
+/* Frames that are still alive are detached from the index */
+void
+gst_omx_frame_index_clear (GstOMXFrameIndex * index)
+{
+  GstOMXFrameIndexEntry *entry;
+  guint i;
+
+  for (i = 0; i < index->entries->len; i++)
+    ENTRY (index, i)->index = NULL;
+
+  while ((entry = index->free_entries)) {
+    index->free_entries = entry->next;
+    g_slice_free (GstOMXFrameIndexEntry, entry);
+  }
+  index->n_free_entries = 0;
+
+  g_array_free (index->entries, TRUE);
+  index->entries = NULL;
+  g_mutex_clear (&index->lock);
+}
+
+/* Makes sure that n frames can be in the index at the same time
+ * without allocating, usually the number of buffers of the ports
+ *
+ * NOTE: Uses index->lock */
+void
+gst_omx_frame_index_reserve (GstOMXFrameIndex * index, guint n)
+{
+  guint len;
+
+  g_mutex_lock (&index->lock);
+  /* Grow the array once instead of while inserting */
+  len = index->entries->len;
+  if (len < n) {
+    g_array_set_size (index->entries, n);
+    g_array_set_size (index->entries, len);
+  }
+
+  while (index->entries->len + index->n_free_entries < n) {
+    GstOMXFrameIndexEntry *entry = g_slice_new0 (GstOMXFrameIndexEntry);
+
+    entry->next = index->free_entries;
+    index->free_entries = entry;
+    index->n_free_entries++;
+  }
+  g_mutex_unlock (&index->lock);
+}
+
+/* Adds the frame with the OpenMAX timestamp it was passed to
+ * the component with. Replaces any previous user data of the
+ * frame.
+ *
+ * NOTE: Uses index->lock */
+void
+gst_omx_frame_index_add (GstOMXFrameIndex * index, GstVideoCodecFrame * frame,
+    guint64 timestamp)
+{
+  GstOMXFrameIndexEntry *entry;
+  guint i;
+
+  /* Removes the previous entry of the frame, if any */
+  gst_video_codec_frame_set_user_data (frame, NULL, NULL);
+
+  g_mutex_lock (&index->lock);
+  entry = index->free_entries;
+  if (entry) {
+    index->free_entries = entry->next;
+    index->n_free_entries--;
+  } else {
+    entry = g_slice_new (GstOMXFrameIndexEntry);
+  }
+  entry->index = index;
+  entry->frame = frame;
+  entry->timestamp = timestamp;
+  entry->next = NULL;
+
+  /* Usually appended, only reordered streams insert in the middle */
+  i = index->entries->len;
+  if (i > 0 && ENTRY (index, i - 1)->timestamp > timestamp)
+    i = gst_omx_frame_index_search (index, timestamp, TRUE);
+  g_array_insert_val (index->entries, i, entry);
+  g_mutex_unlock (&index->lock);
+
+  gst_video_codec_frame_set_user_data (frame, entry,
+      (GDestroyNotify) gst_omx_frame_index_entry_free);
+}
+
+/* Returns a reference to the frame with the timestamp nearest to
+ * timestamp. If there are multiple, the one submitted first. Frames
+ * that were submitted before it and are too far away from it are
+ * returned with a reference in old_frames, they were lost by the
+ * component.
+ *
+ * NOTE: Uses index->lock */
+GstVideoCodecFrame *
+gst_omx_frame_index_find_nearest (GstOMXFrameIndex * index, guint64 timestamp,
+    GList ** old_frames)
+{
+  GstOMXFrameIndexEntry *best = NULL;
+  guint i, n, best_i = 0;
+
+  *old_frames = NULL;
+
+  g_mutex_lock (&index->lock);
+  n = index->entries->len;
+  if (n == 0)
+    goto done;
+
+  i = gst_omx_frame_index_search (index, timestamp, FALSE);
+  if (i < n) {
+    best = ENTRY (index, i);
+    best_i = i;
+  }
+  if (i > 0) {
+    GstOMXFrameIndexEntry *prev;
+    guint prev_i;
+
+    /* First frame with the next lower timestamp */
+    prev_i =
+        gst_omx_frame_index_search (index, ENTRY (index, i - 1)->timestamp,
+        FALSE);
+    prev = ENTRY (index, prev_i);
+
+    if (!best || timestamp - prev->timestamp < best->timestamp - timestamp
+        || (timestamp - prev->timestamp == best->timestamp - timestamp
+            && prev->frame->system_frame_number <
+            best->frame->system_frame_number)) {
+      best = prev;
+      best_i = prev_i;
+    }
+  }
+
+  /* Output is usually in timestamp order, so there are no entries
+   * before the best one unless the component lost frames */
+  for (i = 0; i < best_i; i++) {
+    GstOMXFrameIndexEntry *entry = ENTRY (index, i);
+    guint64 diff_ticks;
+    guint32 diff_frames;
+
+    if (entry->frame->system_frame_number > best->frame->system_frame_number)
+      continue;
+
+    if (entry->timestamp == 0 || best->timestamp == 0)
+      diff_ticks = 0;
+    else
+      diff_ticks = best->timestamp - entry->timestamp;
+    diff_frames =
+        best->frame->system_frame_number - entry->frame->system_frame_number;
+
+    if (diff_ticks > GST_OMX_FRAME_INDEX_MAX_DIST_TICKS
+        || diff_frames > GST_OMX_FRAME_INDEX_MAX_DIST_FRAMES) {
+      *old_frames =
+          g_list_prepend (*old_frames,
+          gst_video_codec_frame_ref (entry->frame));
+    }
+  }
+
+  gst_video_codec_frame_ref (best->frame);
+
+done:
+  g_mutex_unlock (&index->lock);
+
+  return best ? best->frame : NULL;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2011, Hewlett-Packard Development Company, L.P.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>, Collabora Ltd.
+ * Copyright (C) 2013, Collabora Ltd.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_FRAME_INDEX_H__
+#define __GST_OMX_FRAME_INDEX_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "gstomx.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstOMXFrameIndex GstOMXFrameIndex;
+typedef struct _GstOMXFrameIndexEntry GstOMXFrameIndexEntry;
+
+/* Frames that were passed to the component, to find the frame that
+ * belongs to an output buffer by its OpenMAX timestamp. Frames are
+ * removed once they are freed */
+struct _GstOMXFrameIndex
+{
+  GMutex lock;
+
+  /* Contains GstOMXFrameIndexEntry*, sorted by timestamp and
+   * then by system frame number */
+  GArray *entries;
+
+  /* Unused entries, linked by their next pointer. Entries of freed
+   * frames are put back here so that adding a frame does not need
+   * to allocate once enough entries were reserved */
+  GstOMXFrameIndexEntry *free_entries;
+  guint n_free_entries;
+};
+
+/* Too old frames that are reclaimed by gst_omx_frame_index_find_nearest() */
+#define GST_OMX_FRAME_INDEX_MAX_DIST_TICKS  (5 * OMX_TICKS_PER_SECOND)
+#define GST_OMX_FRAME_INDEX_MAX_DIST_FRAMES (100)
+
+void gst_omx_frame_index_init (GstOMXFrameIndex * index);
+void gst_omx_frame_index_clear (GstOMXFrameIndex * index);
+void gst_omx_frame_index_reserve (GstOMXFrameIndex * index, guint n);
+
+void gst_omx_frame_index_add (GstOMXFrameIndex * index, GstVideoCodecFrame * frame, guint64 timestamp);
+GstVideoCodecFrame * gst_omx_frame_index_find_nearest (GstOMXFrameIndex * index, guint64 timestamp, GList ** old_frames);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_FRAME_INDEX_H__ */
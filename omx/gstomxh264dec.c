@@ -23,6 +23,7 @@
 #endif
 
 #include <gst/gst.h>
+#include <gst/base/gstbytereader.h>
 
 #include "gstomxh264dec.h"
 
@@ -34,6 +35,8 @@ static gboolean gst_omx_h264_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
 static gboolean gst_omx_h264_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
+static gboolean gst_omx_h264_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame);
 
 enum
 {
@@ -58,6 +61,8 @@ gst_omx_h264_dec_class_init (GstOMXH264DecClass * klass)
   videodec_class->is_format_change =
       GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_format_change);
   videodec_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h264_dec_set_format);
+  videodec_class->is_droppable =
+      GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_droppable);
 
   videodec_class->cdata.default_sink_template_caps = "video/x-h264, "
       "parsed=(boolean) true, "
@@ -97,5 +102,65 @@ gst_omx_h264_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
   port_def.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
   ret = gst_omx_port_update_port_definition (port, &port_def) == OMX_ErrorNone;
 
+  if (ret && dec->low_latency) {
+    OMX_VIDEO_PARAM_AVCTYPE param;
+    OMX_ERRORTYPE err;
+
+    /* Without B-frames the component doesn't need to hold back
+     * frames for reordering. Optional, not all components allow
+     * setting this on the input port */
+    GST_OMX_INIT_STRUCT (&param);
+    param.nPortIndex = port->index;
+    err =
+        gst_omx_component_get_parameter (dec->dec, OMX_IndexParamVideoAvc,
+        &param);
+    if (err == OMX_ErrorNone) {
+      param.nBFrames = 0;
+      err =
+          gst_omx_component_set_parameter (dec->dec, OMX_IndexParamVideoAvc,
+          &param);
+    }
+    if (err != OMX_ErrorNone)
+      GST_DEBUG_OBJECT (dec, "Can't disable B-frames: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+  }
+
   return ret;
 }
+
+/* Droppable if all slices have nal_ref_idc == 0 */
+static gboolean
+gst_omx_h264_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame)
+{
+  GstByteReader reader;
+  GstMapInfo map;
+  gboolean droppable = FALSE;
+  guint offset = 0;
+  gint pos;
+
+  if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  gst_byte_reader_init (&reader, map.data, map.size);
+  while (offset + 4 <= map.size
+      && (pos = gst_byte_reader_masked_scan_uint32 (&reader, 0xffffff00,
+              0x00000100, offset, map.size - offset)) >= 0) {
+    guint8 nal_header = map.data[pos + 3];
+    guint nal_type = nal_header & 0x1f;
+
+    /* Coded slice of a non-IDR or IDR picture */
+    if (nal_type == 1 || nal_type == 5) {
+      if ((nal_header >> 5) & 0x3) {
+        droppable = FALSE;
+        break;
+      }
+      droppable = TRUE;
+    }
+    offset = pos + 4;
+  }
+
+  gst_buffer_unmap (frame->input_buffer, &map);
+
+  return droppable;
+}
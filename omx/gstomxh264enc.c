@@ -29,19 +29,121 @@
 GST_DEBUG_CATEGORY_STATIC (gst_omx_h264_enc_debug_category);
 #define GST_CAT_DEFAULT gst_omx_h264_enc_debug_category
 
+#define GST_TYPE_OMX_H264_ENC_ENTROPY_MODE (gst_omx_h264_enc_entropy_mode_get_type ())
+static GType
+gst_omx_h264_enc_entropy_mode_get_type (void)
+{
+  static GType qtype = 0;
+
+  if (qtype == 0) {
+    static const GEnumValue values[] = {
+      {FALSE, "CAVLC entropy mode", "CAVLC"},
+      {TRUE, "CABAC entropy mode", "CABAC"},
+      {0xffffffff, "Component Default", "default"},
+      {0, NULL, NULL}
+    };
+
+    qtype = g_enum_register_static ("GstOMXH264EncEntropyMode", values);
+  }
+  return qtype;
+}
+
+#define GST_TYPE_OMX_H264_ENC_LOOP_FILTER_MODE (gst_omx_h264_enc_loop_filter_mode_get_type ())
+static GType
+gst_omx_h264_enc_loop_filter_mode_get_type (void)
+{
+  static GType qtype = 0;
+
+  if (qtype == 0) {
+    static const GEnumValue values[] = {
+      {OMX_VIDEO_AVCLoopFilterEnable, "Enable deblocking filter", "enable"},
+      {OMX_VIDEO_AVCLoopFilterDisable, "Disable deblocking filter", "disable"},
+      {OMX_VIDEO_AVCLoopFilterDisableSliceBoundary,
+          "Disable deblocking filter on slice boundary",
+          "disable-slice-boundary"},
+      {0xffffffff, "Component Default", "default"},
+      {0, NULL, NULL}
+    };
+
+    qtype = g_enum_register_static ("GstOMXH264EncLoopFilter", values);
+  }
+  return qtype;
+}
+
+#define GST_TYPE_OMX_H264_ENC_SLICE_MODE (gst_omx_h264_enc_slice_mode_get_type ())
+static GType
+gst_omx_h264_enc_slice_mode_get_type (void)
+{
+  static GType qtype = 0;
+
+  if (qtype == 0) {
+    static const GEnumValue values[] = {
+      {OMX_VIDEO_SLICEMODE_AVCDefault, "One slice per frame", "single"},
+      {OMX_VIDEO_SLICEMODE_AVCMBSlice, "Slices of slice-size macroblocks",
+          "macroblocks"},
+      {OMX_VIDEO_SLICEMODE_AVCByteSlice, "Slices of slice-size bytes",
+          "bytes"},
+      {0xffffffff, "Component Default", "default"},
+      {0, NULL, NULL}
+    };
+
+    qtype = g_enum_register_static ("GstOMXH264EncSliceMode", values);
+  }
+  return qtype;
+}
+
 /* prototypes */
+static void gst_omx_h264_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_omx_h264_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 static gboolean gst_omx_h264_enc_set_format (GstOMXVideoEnc * enc,
     GstOMXPort * port, GstVideoCodecState * state);
 static GstCaps *gst_omx_h264_enc_get_caps (GstOMXVideoEnc * enc,
     GstOMXPort * port, GstVideoCodecState * state);
 static GstFlowReturn gst_omx_h264_enc_handle_output_frame (GstOMXVideoEnc *
     self, GstOMXPort * port, GstOMXBuffer * buf, GstVideoCodecFrame * frame);
+static gboolean gst_omx_h264_enc_set_qp_map (GstOMXVideoEnc * enc,
+    const gint8 * map, guint mb_width, guint mb_height);
+static gboolean gst_omx_h264_enc_reset_gop (GstOMXVideoEnc * enc);
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_PERIODICITY_IDR,
+  PROP_INTERVAL_INTRAFRAMES,
+  PROP_B_FRAMES,
+  PROP_ENTROPY_MODE,
+  PROP_LOOP_FILTER_MODE,
+  PROP_SLICE_MODE,
+  PROP_SLICE_SIZE,
+  PROP_INTRA_REFRESH_MBS
 };
 
+#define GST_OMX_H264_ENC_PERIODICITY_IDR_DEFAULT (0xffffffff)
+#define GST_OMX_H264_ENC_INTERVAL_INTRAFRAMES_DEFAULT (0xffffffff)
+#define GST_OMX_H264_ENC_B_FRAMES_DEFAULT (0xffffffff)
+#define GST_OMX_H264_ENC_ENTROPY_MODE_DEFAULT (0xffffffff)
+#define GST_OMX_H264_ENC_LOOP_FILTER_MODE_DEFAULT (0xffffffff)
+#define GST_OMX_H264_ENC_SLICE_MODE_DEFAULT (0xffffffff)
+#define GST_OMX_H264_ENC_SLICE_SIZE_DEFAULT (0)
+#define GST_OMX_H264_ENC_INTRA_REFRESH_MBS_DEFAULT (0)
+
+/* Layout of the vendor extension for a QP delta per macroblock of
+ * the next input frame, named by the qp-map-extension configuration
+ * key. Components with a different layout are not supported */
+typedef struct
+{
+  OMX_U32 nSize;
+  OMX_VERSIONTYPE nVersion;
+  OMX_U32 nPortIndex;
+  OMX_U32 nMbWidth;
+  OMX_U32 nMbHeight;
+  /* nMbWidth * nMbHeight deltas in raster order, only read
+   * during the OMX_SetConfig() call */
+  OMX_S8 *pQpDelta;
+} GstOMXVideoQpMapConfig;
+
 /* class initialization */
 
 #define DEBUG_INIT \
@@ -54,9 +156,76 @@ G_DEFINE_TYPE_WITH_CODE (GstOMXH264Enc, gst_omx_h264_enc,
 static void
 gst_omx_h264_enc_class_init (GstOMXH264EncClass * klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
   GstOMXVideoEncClass *videoenc_class = GST_OMX_VIDEO_ENC_CLASS (klass);
 
+  gobject_class->set_property = gst_omx_h264_enc_set_property;
+  gobject_class->get_property = gst_omx_h264_enc_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PERIODICITY_IDR,
+      g_param_spec_uint ("periodicity-idr", "IDR periodicity",
+          "Periodicity of IDR frames (0xffffffff=component default)",
+          0, G_MAXUINT, GST_OMX_H264_ENC_PERIODICITY_IDR_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_INTERVAL_INTRAFRAMES,
+      g_param_spec_uint ("interval-intraframes",
+          "Interval of coding Intra frames",
+          "Interval of coding Intra frames (0xffffffff=component default)",
+          0, G_MAXUINT, GST_OMX_H264_ENC_INTERVAL_INTRAFRAMES_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_B_FRAMES,
+      g_param_spec_uint ("b-frames", "B Frames",
+          "Number of B-frames between two consecutive I-frames "
+          "(0xffffffff=component default)",
+          0, G_MAXUINT, GST_OMX_H264_ENC_B_FRAMES_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_ENTROPY_MODE,
+      g_param_spec_enum ("entropy-mode", "Entropy Mode",
+          "Entropy mode for encoding process",
+          GST_TYPE_OMX_H264_ENC_ENTROPY_MODE,
+          GST_OMX_H264_ENC_ENTROPY_MODE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_LOOP_FILTER_MODE,
+      g_param_spec_enum ("loop-filter-mode", "Loop Filter mode",
+          "Enable or disable the deblocking filter",
+          GST_TYPE_OMX_H264_ENC_LOOP_FILTER_MODE,
+          GST_OMX_H264_ENC_LOOP_FILTER_MODE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SLICE_MODE,
+      g_param_spec_enum ("slice-mode", "Slice Mode",
+          "How a frame is split into slices",
+          GST_TYPE_OMX_H264_ENC_SLICE_MODE,
+          GST_OMX_H264_ENC_SLICE_MODE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SLICE_SIZE,
+      g_param_spec_uint ("slice-size", "Slice Size",
+          "Size of a slice in macroblocks or bytes, depending on slice-mode "
+          "(0=component default)",
+          0, G_MAXUINT, GST_OMX_H264_ENC_SLICE_SIZE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_INTRA_REFRESH_MBS,
+      g_param_spec_uint ("intra-refresh-mbs", "Intra Refresh Macroblocks",
+          "Number of macroblocks per frame coded as intra for cyclic intra "
+          "refresh (0=disabled)",
+          0, G_MAXUINT, GST_OMX_H264_ENC_INTRA_REFRESH_MBS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
   videoenc_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h264_enc_set_format);
   videoenc_class->get_caps = GST_DEBUG_FUNCPTR (gst_omx_h264_enc_get_caps);
 
@@ -64,6 +233,8 @@ gst_omx_h264_enc_class_init (GstOMXH264EncClass * klass)
       "width=(int) [ 16, 4096 ], " "height=(int) [ 16, 4096 ]";
   videoenc_class->handle_output_frame =
       GST_DEBUG_FUNCPTR (gst_omx_h264_enc_handle_output_frame);
+  videoenc_class->set_qp_map = GST_DEBUG_FUNCPTR (gst_omx_h264_enc_set_qp_map);
+  videoenc_class->reset_gop = GST_DEBUG_FUNCPTR (gst_omx_h264_enc_reset_gop);
 
   gst_element_class_set_static_metadata (element_class,
       "OpenMAX H.264 Video Encoder",
@@ -74,9 +245,250 @@ gst_omx_h264_enc_class_init (GstOMXH264EncClass * klass)
   gst_omx_set_default_role (&videoenc_class->cdata, "video_encoder.avc");
 }
 
+static void
+gst_omx_h264_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXH264Enc *self = GST_OMX_H264_ENC (object);
+
+  switch (prop_id) {
+    case PROP_PERIODICITY_IDR:
+      self->periodicity_idr = g_value_get_uint (value);
+      break;
+    case PROP_INTERVAL_INTRAFRAMES:
+      self->interval_intraframes = g_value_get_uint (value);
+      break;
+    case PROP_B_FRAMES:
+      self->b_frames = g_value_get_uint (value);
+      break;
+    case PROP_ENTROPY_MODE:
+      self->entropy_mode = g_value_get_enum (value);
+      break;
+    case PROP_LOOP_FILTER_MODE:
+      self->loop_filter_mode = g_value_get_enum (value);
+      break;
+    case PROP_SLICE_MODE:
+      self->slice_mode = g_value_get_enum (value);
+      break;
+    case PROP_SLICE_SIZE:
+      self->slice_size = g_value_get_uint (value);
+      break;
+    case PROP_INTRA_REFRESH_MBS:
+      self->intra_refresh_mbs = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_h264_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXH264Enc *self = GST_OMX_H264_ENC (object);
+
+  switch (prop_id) {
+    case PROP_PERIODICITY_IDR:
+      g_value_set_uint (value, self->periodicity_idr);
+      break;
+    case PROP_INTERVAL_INTRAFRAMES:
+      g_value_set_uint (value, self->interval_intraframes);
+      break;
+    case PROP_B_FRAMES:
+      g_value_set_uint (value, self->b_frames);
+      break;
+    case PROP_ENTROPY_MODE:
+      g_value_set_enum (value, self->entropy_mode);
+      break;
+    case PROP_LOOP_FILTER_MODE:
+      g_value_set_enum (value, self->loop_filter_mode);
+      break;
+    case PROP_SLICE_MODE:
+      g_value_set_enum (value, self->slice_mode);
+      break;
+    case PROP_SLICE_SIZE:
+      g_value_set_uint (value, self->slice_size);
+      break;
+    case PROP_INTRA_REFRESH_MBS:
+      g_value_set_uint (value, self->intra_refresh_mbs);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static void
 gst_omx_h264_enc_init (GstOMXH264Enc * self)
 {
+  self->periodicity_idr = GST_OMX_H264_ENC_PERIODICITY_IDR_DEFAULT;
+  self->interval_intraframes = GST_OMX_H264_ENC_INTERVAL_INTRAFRAMES_DEFAULT;
+  self->b_frames = GST_OMX_H264_ENC_B_FRAMES_DEFAULT;
+  self->entropy_mode = GST_OMX_H264_ENC_ENTROPY_MODE_DEFAULT;
+  self->loop_filter_mode = GST_OMX_H264_ENC_LOOP_FILTER_MODE_DEFAULT;
+  self->slice_mode = GST_OMX_H264_ENC_SLICE_MODE_DEFAULT;
+  self->slice_size = GST_OMX_H264_ENC_SLICE_SIZE_DEFAULT;
+  self->intra_refresh_mbs = GST_OMX_H264_ENC_INTRA_REFRESH_MBS_DEFAULT;
+}
+
+/* Sets the GOP structure and coding tools from the properties,
+ * everything left at the default is not touched */
+static gboolean
+gst_omx_h264_enc_set_avc_params (GstOMXH264Enc * self)
+{
+  GstOMXVideoEnc *enc = GST_OMX_VIDEO_ENC (self);
+  OMX_VIDEO_PARAM_AVCTYPE avc_param;
+  guint32 slice_mode = self->slice_mode;
+  OMX_ERRORTYPE err;
+
+  /* Components only output slices separately in one of the NAL modes */
+  if (enc->slice_output && (slice_mode == 0xffffffff
+          || slice_mode == OMX_VIDEO_SLICEMODE_AVCDefault))
+    slice_mode = OMX_VIDEO_SLICEMODE_AVCMBSlice;
+
+  if (self->interval_intraframes != 0xffffffff ||
+      self->b_frames != 0xffffffff ||
+      self->entropy_mode != 0xffffffff ||
+      self->loop_filter_mode != 0xffffffff ||
+      (slice_mode != 0xffffffff && self->slice_size != 0)) {
+    GST_OMX_INIT_STRUCT (&avc_param);
+    avc_param.nPortIndex = enc->enc_out_port->index;
+
+    err =
+        gst_omx_component_get_parameter (enc->enc, OMX_IndexParamVideoAvc,
+        &avc_param);
+    if (err != OMX_ErrorNone) {
+      GST_WARNING_OBJECT (self,
+          "Getting AVC parameters not supported by the component: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+      goto intra_period;
+    }
+
+    if (self->interval_intraframes != 0xffffffff)
+      avc_param.nPFrames = self->interval_intraframes;
+    if (self->b_frames != 0xffffffff) {
+      avc_param.nBFrames = self->b_frames;
+      if (self->b_frames > 0)
+        avc_param.nAllowedPictureTypes |= OMX_VIDEO_PictureTypeB;
+      else
+        avc_param.nAllowedPictureTypes &= ~OMX_VIDEO_PictureTypeB;
+    }
+    if (self->entropy_mode != 0xffffffff)
+      avc_param.bEntropyCodingCABAC = self->entropy_mode ? OMX_TRUE : OMX_FALSE;
+    if (self->loop_filter_mode != 0xffffffff)
+      avc_param.eLoopFilterMode = self->loop_filter_mode;
+    if (slice_mode != 0xffffffff && self->slice_size != 0)
+      avc_param.nSliceHeaderSpacing = self->slice_size;
+
+    err =
+        gst_omx_component_set_parameter (enc->enc, OMX_IndexParamVideoAvc,
+        &avc_param);
+    if (err == OMX_ErrorUnsupportedIndex) {
+      GST_WARNING_OBJECT (self,
+          "Setting AVC parameters not supported by the component");
+    } else if (err == OMX_ErrorUnsupportedSetting) {
+      GST_WARNING_OBJECT (self,
+          "Setting AVC parameters %u %u %u %u %u not supported by the component",
+          self->interval_intraframes, self->b_frames, self->entropy_mode,
+          self->loop_filter_mode, self->slice_size);
+    } else if (err != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (self, "Failed to set AVC parameters: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+      return FALSE;
+    }
+  }
+
+intra_period:
+  if (self->periodicity_idr != 0xffffffff) {
+    OMX_VIDEO_CONFIG_AVCINTRAPERIOD config;
+
+    GST_OMX_INIT_STRUCT (&config);
+    config.nPortIndex = enc->enc_out_port->index;
+
+    err =
+        gst_omx_component_get_config (enc->enc,
+        OMX_IndexConfigVideoAVCIntraPeriod, &config);
+    if (err == OMX_ErrorNone) {
+      config.nIDRPeriod = self->periodicity_idr;
+      if (self->interval_intraframes != 0xffffffff)
+        config.nPFrames = self->interval_intraframes;
+
+      err =
+          gst_omx_component_set_config (enc->enc,
+          OMX_IndexConfigVideoAVCIntraPeriod, &config);
+    }
+    if (err == OMX_ErrorUnsupportedIndex) {
+      GST_WARNING_OBJECT (self,
+          "Setting IDR period not supported by the component");
+    } else if (err != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (self, "Failed to set IDR period: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+      return FALSE;
+    }
+  }
+
+  if (slice_mode != 0xffffffff) {
+    OMX_VIDEO_PARAM_AVCSLICEFMO slice_param;
+
+    GST_OMX_INIT_STRUCT (&slice_param);
+    slice_param.nPortIndex = enc->enc_out_port->index;
+
+    err =
+        gst_omx_component_get_parameter (enc->enc,
+        OMX_IndexParamVideoSliceFMO, &slice_param);
+    if (err == OMX_ErrorNone) {
+      slice_param.eSliceMode = slice_mode;
+
+      err =
+          gst_omx_component_set_parameter (enc->enc,
+          OMX_IndexParamVideoSliceFMO, &slice_param);
+    }
+    if (err == OMX_ErrorUnsupportedIndex) {
+      GST_WARNING_OBJECT (self,
+          "Setting slice mode not supported by the component");
+    } else if (err == OMX_ErrorUnsupportedSetting) {
+      GST_WARNING_OBJECT (self,
+          "Setting slice mode %u not supported by the component", slice_mode);
+    } else if (err != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (self, "Failed to set slice mode: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+      return FALSE;
+    }
+  }
+
+  if (self->intra_refresh_mbs != 0) {
+    OMX_VIDEO_PARAM_INTRAREFRESHTYPE refresh_param;
+
+    GST_OMX_INIT_STRUCT (&refresh_param);
+    refresh_param.nPortIndex = enc->enc_out_port->index;
+
+    err =
+        gst_omx_component_get_parameter (enc->enc,
+        OMX_IndexParamVideoIntraRefresh, &refresh_param);
+    if (err == OMX_ErrorNone) {
+      refresh_param.eRefreshMode = OMX_VIDEO_IntraRefreshCyclic;
+      refresh_param.nCirMBs = self->intra_refresh_mbs;
+
+      err =
+          gst_omx_component_set_parameter (enc->enc,
+          OMX_IndexParamVideoIntraRefresh, &refresh_param);
+    }
+    if (err == OMX_ErrorUnsupportedIndex) {
+      GST_WARNING_OBJECT (self,
+          "Setting intra refresh not supported by the component");
+    } else if (err == OMX_ErrorUnsupportedSetting) {
+      GST_WARNING_OBJECT (self,
+          "Setting intra refresh of %u macroblocks not supported by the "
+          "component", self->intra_refresh_mbs);
+    } else if (err != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (self, "Failed to set intra refresh: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
 }
 
 static gboolean
@@ -84,6 +496,7 @@ gst_omx_h264_enc_set_format (GstOMXVideoEnc * enc, GstOMXPort * port,
     GstVideoCodecState * state)
 {
   GstOMXH264Enc *self = GST_OMX_H264_ENC (enc);
+  GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (enc);
   GstCaps *peercaps;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
   OMX_VIDEO_PARAM_PROFILELEVELTYPE param;
@@ -99,6 +512,18 @@ gst_omx_h264_enc_set_format (GstOMXVideoEnc * enc, GstOMXPort * port,
   if (err != OMX_ErrorNone)
     return FALSE;
 
+  if (!gst_omx_h264_enc_set_avc_params (self))
+    return FALSE;
+
+  self->qp_map_index = 0;
+  if (klass->cdata.qp_map_extension
+      && gst_omx_component_get_extension_index (enc->enc,
+          klass->cdata.qp_map_extension, &self->qp_map_index) != OMX_ErrorNone)
+    self->qp_map_index = 0;
+  enc->qp_map_supported = self->qp_map_index != 0;
+  GST_DEBUG_OBJECT (self, "QP maps %ssupported",
+      enc->qp_map_supported ? "" : "not ");
+
   GST_OMX_INIT_STRUCT (&param);
   param.nPortIndex = GST_OMX_VIDEO_ENC (self)->enc_out_port->index;
 
@@ -358,3 +783,58 @@ gst_omx_h264_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
       (gst_omx_h264_enc_parent_class)->handle_output_frame (self, port, buf,
       frame);
 }
+
+static gboolean
+gst_omx_h264_enc_set_qp_map (GstOMXVideoEnc * enc, const gint8 * map,
+    guint mb_width, guint mb_height)
+{
+  GstOMXH264Enc *self = GST_OMX_H264_ENC (enc);
+  GstOMXVideoQpMapConfig config;
+  OMX_ERRORTYPE err;
+
+  if (self->qp_map_index == 0)
+    return FALSE;
+
+  GST_OMX_INIT_STRUCT (&config);
+  config.nPortIndex = enc->enc_in_port->index;
+  config.nMbWidth = mb_width;
+  config.nMbHeight = mb_height;
+  config.pQpDelta = (OMX_S8 *) map;
+
+  err =
+      gst_omx_component_set_config (enc->enc, self->qp_map_index, &config);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (self, "Failed to set QP map: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Most components restart their IDR and intra frame counters when
+ * the intra period is set, setting the current one again is enough */
+static gboolean
+gst_omx_h264_enc_reset_gop (GstOMXVideoEnc * enc)
+{
+  OMX_VIDEO_CONFIG_AVCINTRAPERIOD config;
+  OMX_ERRORTYPE err;
+
+  GST_OMX_INIT_STRUCT (&config);
+  config.nPortIndex = enc->enc_out_port->index;
+  err =
+      gst_omx_component_get_config (enc->enc,
+      OMX_IndexConfigVideoAVCIntraPeriod, &config);
+  if (err == OMX_ErrorNone)
+    err =
+        gst_omx_component_set_config (enc->enc,
+        OMX_IndexConfigVideoAVCIntraPeriod, &config);
+
+  if (err != OMX_ErrorNone) {
+    GST_DEBUG_OBJECT (enc, "Failed to set the intra period: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return FALSE;
+  }
+
+  return TRUE;
+}
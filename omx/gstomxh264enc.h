@@ -45,6 +45,19 @@ typedef struct _GstOMXH264EncClass GstOMXH264EncClass;
 struct _GstOMXH264Enc
 {
   GstOMXVideoEnc parent;
+
+  /* properties */
+  guint32 periodicity_idr;
+  guint32 interval_intraframes;
+  guint32 b_frames;
+  guint32 entropy_mode;
+  guint32 loop_filter_mode;
+  guint32 slice_mode;
+  guint32 slice_size;
+  guint32 intra_refresh_mbs;
+
+  /* Extension index for QP maps, 0 if not supported */
+  OMX_INDEXTYPE qp_map_index;
 };
 
 struct _GstOMXH264EncClass
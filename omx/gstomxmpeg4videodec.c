@@ -23,6 +23,7 @@
 #endif
 
 #include <gst/gst.h>
+#include <gst/base/gstbytereader.h>
 
 #include "gstomxmpeg4videodec.h"
 
@@ -34,6 +35,8 @@ static gboolean gst_omx_mpeg4_video_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
 static gboolean gst_omx_mpeg4_video_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
+static gboolean gst_omx_mpeg4_video_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame);
 
 enum
 {
@@ -60,6 +63,8 @@ gst_omx_mpeg4_video_dec_class_init (GstOMXMPEG4VideoDecClass * klass)
       GST_DEBUG_FUNCPTR (gst_omx_mpeg4_video_dec_is_format_change);
   videodec_class->set_format =
       GST_DEBUG_FUNCPTR (gst_omx_mpeg4_video_dec_set_format);
+  videodec_class->is_droppable =
+      GST_DEBUG_FUNCPTR (gst_omx_mpeg4_video_dec_is_droppable);
 
   videodec_class->cdata.default_sink_template_caps = "video/mpeg, "
       "mpegversion=(int) 4, "
@@ -100,3 +105,29 @@ gst_omx_mpeg4_video_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
 
   return ret;
 }
+
+/* Droppable if the first VOP is a B-VOP */
+static gboolean
+gst_omx_mpeg4_video_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame)
+{
+  GstByteReader reader;
+  GstMapInfo map;
+  gboolean droppable = FALSE;
+  gint pos;
+
+  if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  gst_byte_reader_init (&reader, map.data, map.size);
+  pos =
+      gst_byte_reader_masked_scan_uint32 (&reader, 0xffffffff, 0x000001b6, 0,
+      map.size);
+  /* vop_coding_type, 2 is B */
+  if (pos >= 0 && pos + 4 < map.size)
+    droppable = (map.data[pos + 4] >> 6) == 2;
+
+  gst_buffer_unmap (frame->input_buffer, &map);
+
+  return droppable;
+}
@@ -0,0 +1,554 @@
+/*
+ * Copyright (C) 2011, Hewlett-Packard Development Company, L.P.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>, Collabora Ltd.
+ * Copyright (C) 2013, Collabora Ltd.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstomxvideo.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || \
+    (defined (__i386__) && defined (__SSE2__)))
+#define GST_OMX_VIDEO_COPY_X86 1
+#include <immintrin.h>
+#if defined (__clang__) || __GNUC__ > 4 || \
+    (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define GST_OMX_VIDEO_COPY_AVX2 1
+#endif
+#endif
+
+/* The 16 and 32 bit RGB formats are described as one word per pixel
+ * in the OpenMAX IL specification, with the first component in the
+ * most significant bits. Follow the description and not the names
+ * for them, the 24 bit formats are in memory order */
+GstVideoFormat
+gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat)
+{
+  GstVideoFormat format;
+
+  switch (omx_colorformat) {
+    case OMX_COLOR_FormatYUV420Planar:
+    case OMX_COLOR_FormatYUV420PackedPlanar:
+      format = GST_VIDEO_FORMAT_I420;
+      break;
+    case OMX_COLOR_FormatYUV420SemiPlanar:
+    case OMX_COLOR_FormatYUV420PackedSemiPlanar:
+      format = GST_VIDEO_FORMAT_NV12;
+      break;
+    case OMX_COLOR_FormatYCbYCr:
+      format = GST_VIDEO_FORMAT_YUY2;
+      break;
+    case OMX_COLOR_FormatYCrYCb:
+      format = GST_VIDEO_FORMAT_YVYU;
+      break;
+    case OMX_COLOR_FormatCbYCrY:
+      format = GST_VIDEO_FORMAT_UYVY;
+      break;
+    case OMX_COLOR_Format16bitRGB565:
+      format = GST_VIDEO_FORMAT_RGB16;
+      break;
+    case OMX_COLOR_Format16bitBGR565:
+      format = GST_VIDEO_FORMAT_BGR16;
+      break;
+    case OMX_COLOR_Format24bitRGB888:
+      format = GST_VIDEO_FORMAT_RGB;
+      break;
+    case OMX_COLOR_Format24bitBGR888:
+      format = GST_VIDEO_FORMAT_BGR;
+      break;
+    case OMX_COLOR_Format32bitARGB8888:
+      format = GST_VIDEO_FORMAT_BGRA;
+      break;
+    case OMX_COLOR_Format32bitBGRA8888:
+      format = GST_VIDEO_FORMAT_ARGB;
+      break;
+    default:
+      format = GST_VIDEO_FORMAT_UNKNOWN;
+      break;
+  }
+
+  return format;
+}
+
+OMX_COLOR_FORMATTYPE
+gst_omx_video_get_omx_from_format (GstVideoFormat format)
+{
+  OMX_COLOR_FORMATTYPE omx_colorformat;
+
+  switch (format) {
+    case GST_VIDEO_FORMAT_I420:
+      omx_colorformat = OMX_COLOR_FormatYUV420Planar;
+      break;
+    case GST_VIDEO_FORMAT_NV12:
+      omx_colorformat = OMX_COLOR_FormatYUV420SemiPlanar;
+      break;
+    case GST_VIDEO_FORMAT_YUY2:
+      omx_colorformat = OMX_COLOR_FormatYCbYCr;
+      break;
+    case GST_VIDEO_FORMAT_YVYU:
+      omx_colorformat = OMX_COLOR_FormatYCrYCb;
+      break;
+    case GST_VIDEO_FORMAT_UYVY:
+      omx_colorformat = OMX_COLOR_FormatCbYCrY;
+      break;
+    case GST_VIDEO_FORMAT_RGB16:
+      omx_colorformat = OMX_COLOR_Format16bitRGB565;
+      break;
+    case GST_VIDEO_FORMAT_BGR16:
+      omx_colorformat = OMX_COLOR_Format16bitBGR565;
+      break;
+    case GST_VIDEO_FORMAT_RGB:
+      omx_colorformat = OMX_COLOR_Format24bitRGB888;
+      break;
+    case GST_VIDEO_FORMAT_BGR:
+      omx_colorformat = OMX_COLOR_Format24bitBGR888;
+      break;
+    case GST_VIDEO_FORMAT_BGRA:
+      omx_colorformat = OMX_COLOR_Format32bitARGB8888;
+      break;
+    case GST_VIDEO_FORMAT_ARGB:
+      omx_colorformat = OMX_COLOR_Format32bitBGRA8888;
+      break;
+    default:
+      omx_colorformat = OMX_COLOR_FormatUnused;
+      break;
+  }
+
+  return omx_colorformat;
+}
+
+/* Calculates where the planes of a frame in vinfo's format are in
+ * the buffers of a port with port_def, and the minimum size of the
+ * buffers. All planes are stored one after another with the port's
+ * stride and slice height, scaled for the subsampled planes. Only
+ * the formats gst_omx_video_get_format_from_omx() returns are
+ * supported */
+gboolean
+gst_omx_video_get_plane_layout (const OMX_PARAM_PORTDEFINITIONTYPE * port_def,
+    const GstVideoInfo * vinfo, gsize offset[GST_VIDEO_MAX_PLANES],
+    gint stride[GST_VIDEO_MAX_PLANES], gsize * size)
+{
+  const GstVideoFormatInfo *finfo = vinfo->finfo;
+  gint port_stride = port_def->format.video.nStride;
+  guint slice_height = port_def->format.video.nSliceHeight;
+  guint rows = 0;
+  guint i, c;
+
+  switch (GST_VIDEO_INFO_FORMAT (vinfo)) {
+    case GST_VIDEO_FORMAT_I420:
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_YUY2:
+    case GST_VIDEO_FORMAT_YVYU:
+    case GST_VIDEO_FORMAT_UYVY:
+    case GST_VIDEO_FORMAT_RGB16:
+    case GST_VIDEO_FORMAT_BGR16:
+    case GST_VIDEO_FORMAT_RGB:
+    case GST_VIDEO_FORMAT_BGR:
+    case GST_VIDEO_FORMAT_BGRA:
+    case GST_VIDEO_FORMAT_ARGB:
+      break;
+    default:
+      return FALSE;
+  }
+
+  /* Some components don't set these, assume the default layout then */
+  if (port_stride == 0)
+    port_stride = GST_VIDEO_INFO_PLANE_STRIDE (vinfo, 0);
+  if (slice_height == 0)
+    slice_height = GST_VIDEO_INFO_HEIGHT (vinfo);
+
+  memset (offset, 0, sizeof (gsize) * GST_VIDEO_MAX_PLANES);
+  memset (stride, 0, sizeof (gint) * GST_VIDEO_MAX_PLANES);
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vinfo); i++) {
+    /* First component in this plane */
+    for (c = 0; c < GST_VIDEO_INFO_N_COMPONENTS (vinfo); c++) {
+      if (GST_VIDEO_FORMAT_INFO_PLANE (finfo, c) == i)
+        break;
+    }
+
+    if (i > 0)
+      offset[i] = offset[i - 1] + stride[i - 1] * rows;
+    stride[i] = (port_stride >> GST_VIDEO_FORMAT_INFO_W_SUB (finfo, c)) *
+        GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, c) /
+        GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, 0);
+    rows = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, c, slice_height);
+  }
+
+  if (size)
+    *size = offset[i - 1] + stride[i - 1] * rows;
+
+  return TRUE;
+}
+
+/* Copies height rows of row_size bytes between different strides */
+typedef void (*GstOMXVideoCopyRowsFunc) (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gsize row_size, guint height);
+
+static void
+gst_omx_video_copy_rows_memcpy (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gsize row_size, guint height)
+{
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    memcpy (dest, src, row_size);
+    src += src_stride;
+    dest += dest_stride;
+  }
+}
+
+#ifdef GST_OMX_VIDEO_COPY_X86
+/* The non-temporal kernels write around the caches, the copied frame
+ * is only read again by the component or by the next element after
+ * the rest of the frame evicted it anyway. memcpy() only does that
+ * above a threshold of a large part of the last level cache, which
+ * single rows never reach */
+static void
+gst_omx_video_copy_rows_sse2_nt (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gsize row_size, guint height)
+{
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dest;
+    const guint8 *s = src;
+    gsize n = row_size, head;
+
+    /* Streaming stores need aligned destinations */
+    head = MIN ((16 - GPOINTER_TO_SIZE (d)) & 15, n);
+    memcpy (d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) s);
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (s + 16));
+      __m128i c = _mm_loadu_si128 ((const __m128i *) (s + 32));
+      __m128i e = _mm_loadu_si128 ((const __m128i *) (s + 48));
+
+      _mm_stream_si128 ((__m128i *) d, a);
+      _mm_stream_si128 ((__m128i *) (d + 16), b);
+      _mm_stream_si128 ((__m128i *) (d + 32), c);
+      _mm_stream_si128 ((__m128i *) (d + 48), e);
+    }
+    for (; n >= 16; n -= 16, d += 16, s += 16)
+      _mm_stream_si128 ((__m128i *) d, _mm_loadu_si128 ((const __m128i *) s));
+    memcpy (d, s, n);
+
+    src += src_stride;
+    dest += dest_stride;
+  }
+
+  /* Make the stores visible before another thread uses the frame */
+  _mm_sfence ();
+}
+
+#ifdef GST_OMX_VIDEO_COPY_AVX2
+__attribute__ ((target ("avx2")))
+static void
+gst_omx_video_copy_rows_avx2_nt (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gsize row_size, guint height)
+{
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dest;
+    const guint8 *s = src;
+    gsize n = row_size, head;
+
+    head = MIN ((32 - GPOINTER_TO_SIZE (d)) & 31, n);
+    memcpy (d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+      __m256i a = _mm256_loadu_si256 ((const __m256i *) s);
+      __m256i b = _mm256_loadu_si256 ((const __m256i *) (s + 32));
+      __m256i c = _mm256_loadu_si256 ((const __m256i *) (s + 64));
+      __m256i e = _mm256_loadu_si256 ((const __m256i *) (s + 96));
+
+      _mm256_stream_si256 ((__m256i *) d, a);
+      _mm256_stream_si256 ((__m256i *) (d + 32), b);
+      _mm256_stream_si256 ((__m256i *) (d + 64), c);
+      _mm256_stream_si256 ((__m256i *) (d + 96), e);
+    }
+    for (; n >= 32; n -= 32, d += 32, s += 32)
+      _mm256_stream_si256 ((__m256i *) d,
+          _mm256_loadu_si256 ((const __m256i *) s));
+    memcpy (d, s, n);
+
+    src += src_stride;
+    dest += dest_stride;
+  }
+
+  _mm_sfence ();
+}
+#endif
+#endif
+
+/* Picks the kernel for large frames once, from the CPU features.
+ * The GST_OMX_VIDEO_COPY environment variable selects one of
+ * "memcpy", "sse2" or "avx2" instead, e.g. for benchmarking */
+static GstOMXVideoCopyRowsFunc
+gst_omx_video_get_copy_rows_func (void)
+{
+  static volatile gsize func = 0;
+
+  if (g_once_init_enter (&func)) {
+    GstOMXVideoCopyRowsFunc tmp = gst_omx_video_copy_rows_memcpy;
+    const gchar *name = g_getenv ("GST_OMX_VIDEO_COPY");
+
+#ifdef GST_OMX_VIDEO_COPY_X86
+    if (!name || g_strcmp0 (name, "sse2") == 0)
+      tmp = gst_omx_video_copy_rows_sse2_nt;
+#ifdef GST_OMX_VIDEO_COPY_AVX2
+    if ((!name || g_strcmp0 (name, "avx2") == 0)
+        && __builtin_cpu_supports ("avx2"))
+      tmp = gst_omx_video_copy_rows_avx2_nt;
+#endif
+#endif
+
+    g_once_init_leave (&func, (gsize) tmp);
+  }
+
+  return (GstOMXVideoCopyRowsFunc) func;
+}
+
+/* Frames from this size on are copied with the non-temporal kernels,
+ * smaller ones still fit into the caches of the next reader */
+#define GST_OMX_VIDEO_COPY_STREAMING_SIZE (1024 * 1024)
+
+/* Copies a plane of height rows. Contiguous rows are copied at once
+ * by memcpy(), which has its own threshold for non-temporal stores,
+ * the others with copy_rows */
+static inline void
+gst_omx_video_copy_plane (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gsize row_size, guint height,
+    GstOMXVideoCopyRowsFunc copy_rows)
+{
+  if (height == 0)
+    return;
+
+  if (dest_stride == src_stride) {
+    memcpy (dest, src, dest_stride * (height - 1) + row_size);
+    return;
+  }
+
+  copy_rows (dest, dest_stride, src, src_stride, row_size, height);
+}
+
+/* Frames are split into parts of at least this size for the
+ * copy threads if their number is chosen automatically */
+#define GST_OMX_VIDEO_COPY_BYTES_PER_THREAD (2 * 1024 * 1024)
+
+typedef struct _GstOMXVideoCopyJob GstOMXVideoCopyJob;
+typedef struct _GstOMXVideoCopyChunk GstOMXVideoCopyChunk;
+
+struct _GstOMXVideoCopyJob
+{
+  GMutex lock;
+  GCond cond;
+  guint pending;
+};
+
+struct _GstOMXVideoCopyChunk
+{
+  GstOMXVideoCopyJob *job;
+
+  guint8 *dest;
+  gint dest_stride;
+  const guint8 *src;
+  gint src_stride;
+  gsize row_size;
+  guint height;
+
+  GstOMXVideoCopyRowsFunc copy_rows;
+};
+
+static void
+gst_omx_video_copy_chunk (GstOMXVideoCopyChunk * chunk, gpointer user_data)
+{
+  GstOMXVideoCopyJob *job = chunk->job;
+
+  gst_omx_video_copy_plane (chunk->dest, chunk->dest_stride, chunk->src,
+      chunk->src_stride, chunk->row_size, chunk->height, chunk->copy_rows);
+
+  g_mutex_lock (&job->lock);
+  if (--job->pending == 0)
+    g_cond_signal (&job->cond);
+  g_mutex_unlock (&job->lock);
+}
+
+/* Shared by all elements, the threads are only started on
+ * first use and never more than there are processors */
+static GThreadPool *
+gst_omx_video_get_copy_pool (void)
+{
+  static volatile gsize pool = 0;
+
+  if (g_once_init_enter (&pool)) {
+    GThreadPool *tmp;
+
+    tmp = g_thread_pool_new ((GFunc) gst_omx_video_copy_chunk, NULL,
+        MIN (g_get_num_processors (), GST_OMX_VIDEO_COPY_MAX_THREADS), FALSE,
+        NULL);
+    g_once_init_leave (&pool, (gsize) tmp);
+  }
+
+  return (GThreadPool *) pool;
+}
+
+/* Copies between frame and the data of a port buffer of size bytes
+ * in the port's layout, to the port buffer if to_port is TRUE. filled
+ * is set to the amount of data in the port buffer.
+ *
+ * The rows of every plane are split between n_threads threads, the
+ * calling one included. If n_threads is 0 it is chosen from the frame
+ * size and the number of processors.
+ *
+ * Returns FALSE if the format is unsupported or the port buffer is
+ * too small */
+gboolean
+gst_omx_video_copy_frame (const OMX_PARAM_PORTDEFINITIONTYPE * port_def,
+    GstVideoFrame * frame, guint8 * data, gsize size, gboolean to_port,
+    guint n_threads, gsize * filled)
+{
+  GstOMXVideoCopyChunk chunks[GST_VIDEO_MAX_PLANES *
+      GST_OMX_VIDEO_COPY_MAX_THREADS];
+  GstOMXVideoCopyChunk planes[GST_VIDEO_MAX_PLANES];
+  GstOMXVideoCopyJob job;
+  GstOMXVideoCopyRowsFunc copy_rows = gst_omx_video_copy_rows_memcpy;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  gsize end = 0;
+  guint i, c, n_planes = 0, n_chunks = 0;
+
+  if (!gst_omx_video_get_plane_layout (port_def, &frame->info, offset, stride,
+          NULL))
+    return FALSE;
+
+  if (GST_VIDEO_FRAME_SIZE (frame) >= GST_OMX_VIDEO_COPY_STREAMING_SIZE)
+    copy_rows = gst_omx_video_get_copy_rows_func ();
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (frame); i++) {
+    GstOMXVideoCopyChunk *plane = &planes[n_planes];
+    gsize row_size = 0;
+    guint height = 0;
+
+    /* Packed formats have multiple components per plane with
+     * different subsampling, take the largest */
+    for (c = 0; c < GST_VIDEO_FRAME_N_COMPONENTS (frame); c++) {
+      if (GST_VIDEO_FRAME_COMP_PLANE (frame, c) != i)
+        continue;
+
+      row_size = MAX (row_size, (gsize) GST_VIDEO_FRAME_COMP_WIDTH (frame, c)
+          * GST_VIDEO_FRAME_COMP_PSTRIDE (frame, c));
+      height = MAX (height, GST_VIDEO_FRAME_COMP_HEIGHT (frame, c));
+    }
+
+    if (height == 0)
+      continue;
+
+    if (row_size > (gsize) stride[i]
+        || offset[i] + (gsize) stride[i] * (height - 1) + row_size > size)
+      return FALSE;
+
+    if (to_port) {
+      plane->dest = data + offset[i];
+      plane->dest_stride = stride[i];
+      plane->src = GST_VIDEO_FRAME_PLANE_DATA (frame, i);
+      plane->src_stride = GST_VIDEO_FRAME_PLANE_STRIDE (frame, i);
+    } else {
+      plane->dest = GST_VIDEO_FRAME_PLANE_DATA (frame, i);
+      plane->dest_stride = GST_VIDEO_FRAME_PLANE_STRIDE (frame, i);
+      plane->src = data + offset[i];
+      plane->src_stride = stride[i];
+    }
+    plane->row_size = row_size;
+    plane->height = height;
+    plane->copy_rows = copy_rows;
+    n_planes++;
+
+    end = MAX (end, MIN (offset[i] + (gsize) stride[i] * height, size));
+  }
+
+  if (filled)
+    *filled = end;
+
+  if (n_threads == 0)
+    n_threads = MIN (GST_VIDEO_FRAME_SIZE (frame) /
+        GST_OMX_VIDEO_COPY_BYTES_PER_THREAD, g_get_num_processors ());
+  n_threads = CLAMP (n_threads, 1, GST_OMX_VIDEO_COPY_MAX_THREADS);
+
+  if (n_threads == 1) {
+    for (i = 0; i < n_planes; i++)
+      gst_omx_video_copy_plane (planes[i].dest, planes[i].dest_stride,
+          planes[i].src, planes[i].src_stride, planes[i].row_size,
+          planes[i].height, copy_rows);
+    return TRUE;
+  }
+
+  /* Split every plane into n_threads parts of whole rows */
+  for (i = 0; i < n_planes; i++) {
+    guint rows_done = 0, t;
+
+    for (t = 0; t < n_threads && rows_done < planes[i].height; t++) {
+      GstOMXVideoCopyChunk *chunk = &chunks[n_chunks++];
+      guint rows = (planes[i].height - rows_done) / (n_threads - t);
+
+      if (rows == 0)
+        rows = 1;
+
+      *chunk = planes[i];
+      chunk->job = &job;
+      chunk->dest += (gsize) rows_done * planes[i].dest_stride;
+      chunk->src += (gsize) rows_done * planes[i].src_stride;
+      chunk->height = rows;
+      rows_done += rows;
+    }
+  }
+
+  g_mutex_init (&job.lock);
+  g_cond_init (&job.cond);
+  job.pending = n_chunks;
+
+  /* The first part is done by this thread, while the others are
+   * done by the pool */
+  for (i = 1; i < n_chunks; i++)
+    g_thread_pool_push (gst_omx_video_get_copy_pool (), &chunks[i], NULL);
+  gst_omx_video_copy_chunk (&chunks[0], NULL);
+
+  g_mutex_lock (&job.lock);
+  while (job.pending > 0)
+    g_cond_wait (&job.cond, &job.lock);
+  g_mutex_unlock (&job.lock);
+
+  g_mutex_clear (&job.lock);
+  g_cond_clear (&job.cond);
+
+  return TRUE;
+}
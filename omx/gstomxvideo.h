@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2011, Hewlett-Packard Development Company, L.P.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>, Collabora Ltd.
+ * Copyright (C) 2013, Collabora Ltd.
+ *   Author: Sebastian Dröge <sebastian.droege@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_VIDEO_H__
+#define __GST_OMX_VIDEO_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "gstomx.h"
+
+G_BEGIN_DECLS
+
+GstVideoFormat gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat);
+OMX_COLOR_FORMATTYPE gst_omx_video_get_omx_from_format (GstVideoFormat format);
+
+gboolean gst_omx_video_get_plane_layout (const OMX_PARAM_PORTDEFINITIONTYPE * port_def, const GstVideoInfo * vinfo, gsize offset[GST_VIDEO_MAX_PLANES], gint stride[GST_VIDEO_MAX_PLANES], gsize * size);
+
+/* Maximum number of threads for copying a frame */
+#define GST_OMX_VIDEO_COPY_MAX_THREADS (16)
+
+gboolean gst_omx_video_copy_frame (const OMX_PARAM_PORTDEFINITIONTYPE * port_def, GstVideoFrame * frame, guint8 * data, gsize size, gboolean to_port, guint n_threads, gsize * filled);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_VIDEO_H__ */
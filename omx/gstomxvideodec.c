@@ -49,617 +49,19 @@
 
 #include <string.h>
 
+#include "gstomxbufferpool.h"
+#include "gstomxvideo.h"
 #include "gstomxvideodec.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_video_dec_debug_category);
 #define GST_CAT_DEFAULT gst_omx_video_dec_debug_category
 
-typedef struct _GstOMXMemory GstOMXMemory;
-typedef struct _GstOMXMemoryAllocator GstOMXMemoryAllocator;
-typedef struct _GstOMXMemoryAllocatorClass GstOMXMemoryAllocatorClass;
-
-struct _GstOMXMemory
-{
-  GstMemory mem;
-
-  GstOMXBuffer *buf;
-};
-
-struct _GstOMXMemoryAllocator
-{
-  GstAllocator parent;
-};
-
-struct _GstOMXMemoryAllocatorClass
-{
-  GstAllocatorClass parent_class;
-};
-
-#define GST_OMX_MEMORY_TYPE "openmax"
-
-static GstMemory *
-gst_omx_memory_allocator_alloc_dummy (GstAllocator * allocator, gsize size,
-    GstAllocationParams * params)
-{
-  g_assert_not_reached ();
-  return NULL;
-}
-
-static void
-gst_omx_memory_allocator_free (GstAllocator * allocator, GstMemory * mem)
-{
-  GstOMXMemory *omem = (GstOMXMemory *) mem;
-
-  /* TODO: We need to remember which memories are still used
-   * so we can wait until everything is released before allocating
-   * new memory
-   */
-
-  g_slice_free (GstOMXMemory, omem);
-}
-
-static gpointer
-gst_omx_memory_map (GstMemory * mem, gsize maxsize, GstMapFlags flags)
-{
-  GstOMXMemory *omem = (GstOMXMemory *) mem;
-
-  return omem->buf->omx_buf->pBuffer + omem->mem.offset;
-}
-
-static void
-gst_omx_memory_unmap (GstMemory * mem)
-{
-}
-
-static GstMemory *
-gst_omx_memory_share (GstMemory * mem, gssize offset, gssize size)
-{
-  g_assert_not_reached ();
-  return NULL;
-}
-
-GType gst_omx_memory_allocator_get_type (void);
-G_DEFINE_TYPE (GstOMXMemoryAllocator, gst_omx_memory_allocator,
-    GST_TYPE_ALLOCATOR);
-
-#define GST_TYPE_OMX_MEMORY_ALLOCATOR   (gst_omx_memory_allocator_get_type())
-#define GST_IS_OMX_MEMORY_ALLOCATOR(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_OMX_MEMORY_ALLOCATOR))
-
-static void
-gst_omx_memory_allocator_class_init (GstOMXMemoryAllocatorClass * klass)
-{
-  GstAllocatorClass *allocator_class;
-
-  allocator_class = (GstAllocatorClass *) klass;
-
-  allocator_class->alloc = gst_omx_memory_allocator_alloc_dummy;
-  allocator_class->free = gst_omx_memory_allocator_free;
-}
-
-static void
-gst_omx_memory_allocator_init (GstOMXMemoryAllocator * allocator)
-{
-  GstAllocator *alloc = GST_ALLOCATOR_CAST (allocator);
-
-  alloc->mem_type = GST_OMX_MEMORY_TYPE;
-  alloc->mem_map = gst_omx_memory_map;
-  alloc->mem_unmap = gst_omx_memory_unmap;
-  alloc->mem_share = gst_omx_memory_share;
-
-  /* default copy & is_span */
-
-  GST_OBJECT_FLAG_SET (allocator, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
-}
-
-static GstMemory *
-gst_omx_memory_allocator_alloc (GstAllocator * allocator, GstMemoryFlags flags,
-    GstOMXBuffer * buf)
-{
-  GstOMXMemory *mem;
-
-  /* FIXME: We don't allow sharing because we need to know
-   * when the memory becomes unused and can only then put
-   * it back to the pool. Which is done in the pool's release
-   * function
-   */
-  flags |= GST_MEMORY_FLAG_NO_SHARE;
-
-  mem = g_slice_new (GstOMXMemory);
-  /* the shared memory is always readonly */
-  gst_memory_init (GST_MEMORY_CAST (mem), flags, allocator, NULL,
-      buf->omx_buf->nAllocLen, buf->port->port_def.nBufferAlignment,
-      0, buf->omx_buf->nAllocLen);
-
-  mem->buf = buf;
-
-  return GST_MEMORY_CAST (mem);
-}
-
-/* Buffer pool for the buffers of an OpenMAX port.
- *
- * This pool is only used if we either passed buffers from another
- * pool to the OMX port or provide the OMX buffers directly to other
- * elements.
- *
- *
- * A buffer is in the pool if it is currently owned by the port,
- * i.e. after OMX_{Fill,Empty}ThisBuffer(). A buffer is outside
- * the pool after it was taken from the port after it was handled
- * by the port, i.e. {Empty,Fill}BufferDone.
- *
- * Buffers can be allocated by us (OMX_AllocateBuffer()) or allocated
- * by someone else and (temporarily) passed to this pool
- * (OMX_UseBuffer(), OMX_UseEGLImage()). In the latter case the pool of
- * the buffer will be overriden, and restored in free_buffer(). Other
- * buffers are just freed there.
- *
- * The pool always has a fixed number of minimum and maximum buffers
- * and these are allocated while starting the pool and released afterwards.
- * They correspond 1:1 to the OMX buffers of the port, which are allocated
- * before the pool is started.
- *
- * Acquiring a buffer from this pool happens after the OMX buffer has
- * been acquired from the port. gst_buffer_pool_acquire_buffer() is
- * supposed to return the buffer that corresponds to the OMX buffer.
- *
- * For buffers provided to upstream, the buffer will be passed to
- * the component manually when it arrives and then unreffed. If the
- * buffer is released before reaching the component it will be just put
- * back into the pool as if EmptyBufferDone has happened. If it was
- * passed to the component, it will be back into the pool when it was
- * released and EmptyBufferDone has happened.
- *
- * For buffers provided to downstream, the buffer will be returned
- * back to the component (OMX_FillThisBuffer()) when it is released.
- */
-
-static GQuark gst_omx_buffer_data_quark = 0;
-
-#define GST_OMX_BUFFER_POOL(pool) ((GstOMXBufferPool *) pool)
-typedef struct _GstOMXBufferPool GstOMXBufferPool;
-typedef struct _GstOMXBufferPoolClass GstOMXBufferPoolClass;
-
-struct _GstOMXBufferPool
-{
-  GstVideoBufferPool parent;
-
-  GstElement *element;
-
-  GstCaps *caps;
-  gboolean add_videometa;
-  GstVideoInfo video_info;
-
-  /* Owned by element, element has to stop this pool before
-   * it destroys component or port */
-  GstOMXComponent *component;
-  GstOMXPort *port;
-
-  /* For handling OpenMAX allocated memory */
-  GstAllocator *allocator;
-
-  /* Set from outside this pool */
-  /* TRUE if we're currently allocating all our buffers */
-  gboolean allocating;
-
-  /* TRUE if the pool is not used anymore */
-  gboolean deactivated;
-
-  /* For populating the pool from another one */
-  GstBufferPool *other_pool;
-  GPtrArray *buffers;
-
-  /* Used during acquire for output ports to
-   * specify which buffer has to be retrieved
-   * and during alloc, which buffer has to be
-   * wrapped
-   */
-  gint current_buffer_index;
-};
-
-struct _GstOMXBufferPoolClass
-{
-  GstVideoBufferPoolClass parent_class;
-};
-
-GType gst_omx_buffer_pool_get_type (void);
-
-G_DEFINE_TYPE (GstOMXBufferPool, gst_omx_buffer_pool, GST_TYPE_BUFFER_POOL);
-
-static gboolean
-gst_omx_buffer_pool_start (GstBufferPool * bpool)
-{
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-
-  /* Only allow to start the pool if we still are attached
-   * to a component and port */
-  GST_OBJECT_LOCK (pool);
-  if (!pool->component || !pool->port) {
-    GST_OBJECT_UNLOCK (pool);
-    return FALSE;
-  }
-  GST_OBJECT_UNLOCK (pool);
-
-  return
-      GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->start (bpool);
-}
-
-static gboolean
-gst_omx_buffer_pool_stop (GstBufferPool * bpool)
-{
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-
-  /* Remove any buffers that are there */
-  g_ptr_array_set_size (pool->buffers, 0);
-
-  if (pool->caps)
-    gst_caps_unref (pool->caps);
-  pool->caps = NULL;
-
-  pool->add_videometa = FALSE;
-
-  return GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->stop (bpool);
-}
-
-static const gchar **
-gst_omx_buffer_pool_get_options (GstBufferPool * bpool)
-{
-  static const gchar *raw_video_options[] =
-      { GST_BUFFER_POOL_OPTION_VIDEO_META, NULL };
-  static const gchar *options[] = { NULL };
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-
-  GST_OBJECT_LOCK (pool);
-  if (pool->port && pool->port->port_def.eDomain == OMX_PortDomainVideo
-      && pool->port->port_def.format.video.eCompressionFormat ==
-      OMX_VIDEO_CodingUnused) {
-    GST_OBJECT_UNLOCK (pool);
-    return raw_video_options;
-  }
-  GST_OBJECT_UNLOCK (pool);
-
-  return options;
-}
-
-static gboolean
-gst_omx_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
-{
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-  GstCaps *caps;
-
-  GST_OBJECT_LOCK (pool);
-
-  if (!gst_buffer_pool_config_get_params (config, &caps, NULL, NULL, NULL))
-    goto wrong_config;
-
-  if (caps == NULL)
-    goto no_caps;
-
-  if (pool->port && pool->port->port_def.eDomain == OMX_PortDomainVideo
-      && pool->port->port_def.format.video.eCompressionFormat ==
-      OMX_VIDEO_CodingUnused) {
-    GstVideoInfo info;
-
-    /* now parse the caps from the config */
-    if (!gst_video_info_from_caps (&info, caps))
-      goto wrong_video_caps;
-
-    /* enable metadata based on config of the pool */
-    pool->add_videometa =
-        gst_buffer_pool_config_has_option (config,
-        GST_BUFFER_POOL_OPTION_VIDEO_META);
-
-    pool->video_info = info;
-  }
-
-  if (pool->caps)
-    gst_caps_unref (pool->caps);
-  pool->caps = gst_caps_ref (caps);
-
-  GST_OBJECT_UNLOCK (pool);
-
-  return GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->set_config
-      (bpool, config);
-
-  /* ERRORS */
-wrong_config:
-  {
-    GST_OBJECT_UNLOCK (pool);
-    GST_WARNING_OBJECT (pool, "invalid config");
-    return FALSE;
-  }
-no_caps:
-  {
-    GST_OBJECT_UNLOCK (pool);
-    GST_WARNING_OBJECT (pool, "no caps in config");
-    return FALSE;
-  }
-wrong_video_caps:
-  {
-    GST_OBJECT_UNLOCK (pool);
-    GST_WARNING_OBJECT (pool,
-        "failed getting geometry from caps %" GST_PTR_FORMAT, caps);
-    return FALSE;
-  }
-}
-
-static GstFlowReturn
-gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
-    GstBuffer ** buffer, GstBufferPoolAcquireParams * params)
-{
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-  GstBuffer *buf;
-  GstOMXBuffer *omx_buf;
-
-  g_return_val_if_fail (pool->allocating, GST_FLOW_ERROR);
-
-  omx_buf = g_ptr_array_index (pool->port->buffers, pool->current_buffer_index);
-  g_return_val_if_fail (omx_buf != NULL, GST_FLOW_ERROR);
-
-  if (pool->other_pool) {
-    guint i, n;
-
-    buf = g_ptr_array_index (pool->buffers, pool->current_buffer_index);
-    g_assert (pool->other_pool == buf->pool);
-    gst_object_replace ((GstObject **) & buf->pool, NULL);
-
-    n = gst_buffer_n_memory (buf);
-    for (i = 0; i < n; i++) {
-      GstMemory *mem = gst_buffer_peek_memory (buf, i);
-
-      /* FIXME: We don't allow sharing because we need to know
-       * when the memory becomes unused and can only then put
-       * it back to the pool. Which is done in the pool's release
-       * function
-       */
-      GST_MINI_OBJECT_FLAG_SET (mem, GST_MEMORY_FLAG_NO_SHARE);
-    }
-
-    if (pool->add_videometa) {
-      GstVideoMeta *meta;
-
-      meta = gst_buffer_get_video_meta (buf);
-      if (!meta) {
-        gst_buffer_add_video_meta (buf, GST_VIDEO_FRAME_FLAG_NONE,
-            GST_VIDEO_INFO_FORMAT (&pool->video_info),
-            GST_VIDEO_INFO_WIDTH (&pool->video_info),
-            GST_VIDEO_INFO_HEIGHT (&pool->video_info));
-      }
-    }
-  } else {
-    GstMemory *mem;
-
-    mem = gst_omx_memory_allocator_alloc (pool->allocator, 0, omx_buf);
-    buf = gst_buffer_new ();
-    gst_buffer_append_memory (buf, mem);
-    g_ptr_array_add (pool->buffers, buf);
-
-    if (pool->add_videometa) {
-      gsize offset[4] = { 0, };
-      gint stride[4] = { 0, };
-
-      switch (pool->video_info.finfo->format) {
-        case GST_VIDEO_FORMAT_I420:
-          offset[0] = 0;
-          stride[0] = pool->port->port_def.format.video.nStride;
-          offset[1] =
-              stride[0] * pool->port->port_def.format.video.nSliceHeight;
-          stride[1] = pool->port->port_def.format.video.nStride / 2;
-          offset[2] =
-              offset[1] +
-              stride[1] * (pool->port->port_def.format.video.nSliceHeight / 2);
-          stride[2] = pool->port->port_def.format.video.nStride / 2;
-          break;
-        case GST_VIDEO_FORMAT_NV12:
-          offset[0] = 0;
-          stride[0] = pool->port->port_def.format.video.nStride;
-          offset[1] =
-              stride[0] * pool->port->port_def.format.video.nSliceHeight;
-          stride[1] = pool->port->port_def.format.video.nStride;
-          break;
-        default:
-          g_assert_not_reached ();
-          break;
-      }
-
-      gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
-          GST_VIDEO_INFO_FORMAT (&pool->video_info),
-          GST_VIDEO_INFO_WIDTH (&pool->video_info),
-          GST_VIDEO_INFO_HEIGHT (&pool->video_info),
-          GST_VIDEO_INFO_N_PLANES (&pool->video_info), offset, stride);
-    }
-  }
-
-  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buf),
-      gst_omx_buffer_data_quark, omx_buf, NULL);
-
-  *buffer = buf;
-
-  pool->current_buffer_index++;
-
-  return GST_FLOW_OK;
-}
-
-static void
-gst_omx_buffer_pool_free_buffer (GstBufferPool * bpool, GstBuffer * buffer)
-{
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-
-  /* If the buffers belong to another pool, restore them now */
-  GST_OBJECT_LOCK (pool);
-  if (pool->other_pool) {
-    gst_object_replace ((GstObject **) & buffer->pool,
-        (GstObject *) pool->other_pool);
-  }
-  GST_OBJECT_UNLOCK (pool);
-
-  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buffer),
-      gst_omx_buffer_data_quark, NULL, NULL);
-
-  GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->free_buffer (bpool,
-      buffer);
-}
-
-static GstFlowReturn
-gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
-    GstBuffer ** buffer, GstBufferPoolAcquireParams * params)
-{
-  GstFlowReturn ret;
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-
-  if (pool->port->port_def.eDir == OMX_DirOutput) {
-    GstBuffer *buf;
-
-    g_return_val_if_fail (pool->current_buffer_index != -1, GST_FLOW_ERROR);
-
-    buf = g_ptr_array_index (pool->buffers, pool->current_buffer_index);
-    g_return_val_if_fail (buf != NULL, GST_FLOW_ERROR);
-    *buffer = buf;
-    ret = GST_FLOW_OK;
-
-    /* If it's our own memory we have to set the sizes */
-    if (!pool->other_pool) {
-      GstMemory *mem = gst_buffer_peek_memory (*buffer, 0);
-
-      g_assert (mem
-          && g_strcmp0 (mem->allocator->mem_type, GST_OMX_MEMORY_TYPE) == 0);
-      mem->size = ((GstOMXMemory *) mem)->buf->omx_buf->nFilledLen;
-      mem->offset = ((GstOMXMemory *) mem)->buf->omx_buf->nOffset;
-    }
-  } else {
-    /* Acquire any buffer that is available to be filled by upstream */
-    ret =
-        GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->acquire_buffer
-        (bpool, buffer, params);
-  }
-
-  return ret;
-}
-
-static void
-gst_omx_buffer_pool_release_buffer (GstBufferPool * bpool, GstBuffer * buffer)
-{
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
-  OMX_ERRORTYPE err;
-  GstOMXBuffer *omx_buf;
-
-  g_assert (pool->component && pool->port);
-
-  if (!pool->allocating && !pool->deactivated) {
-    omx_buf =
-        gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
-        gst_omx_buffer_data_quark);
-    if (pool->port->port_def.eDir == OMX_DirOutput && !omx_buf->used) {
-      /* Release back to the port, can be filled again */
-      err = gst_omx_port_release_buffer (pool->port, omx_buf);
-      if (err != OMX_ErrorNone) {
-        GST_ELEMENT_ERROR (pool->element, LIBRARY, SETTINGS, (NULL),
-            ("Failed to relase output buffer to component: %s (0x%08x)",
-                gst_omx_error_to_string (err), err));
-      }
-    } else if (!omx_buf->used) {
-      /* TODO: Implement.
-       *
-       * If not used (i.e. was not passed to the component) this should do
-       * the same as EmptyBufferDone.
-       * If it is used (i.e. was passed to the component) this should do
-       * nothing until EmptyBufferDone.
-       *
-       * EmptyBufferDone should release the buffer to the pool so it can
-       * be allocated again
-       *
-       * Needs something to call back here in EmptyBufferDone, like keeping
-       * a ref on the buffer in GstOMXBuffer until EmptyBufferDone... which
-       * would ensure that the buffer is always unused when this is called.
-       */
-      g_assert_not_reached ();
-      GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->release_buffer
-          (bpool, buffer);
-    }
-  }
-}
-
-static void
-gst_omx_buffer_pool_finalize (GObject * object)
-{
-  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (object);
-
-  if (pool->element)
-    gst_object_unref (pool->element);
-  pool->element = NULL;
-
-  if (pool->buffers)
-    g_ptr_array_unref (pool->buffers);
-  pool->buffers = NULL;
-
-  if (pool->other_pool)
-    gst_object_unref (pool->other_pool);
-  pool->other_pool = NULL;
-
-  if (pool->allocator)
-    gst_object_unref (pool->allocator);
-  pool->allocator = NULL;
-
-  if (pool->caps)
-    gst_caps_unref (pool->caps);
-  pool->caps = NULL;
-
-  G_OBJECT_CLASS (gst_omx_buffer_pool_parent_class)->finalize (object);
-}
-
-static void
-gst_omx_buffer_pool_class_init (GstOMXBufferPoolClass * klass)
-{
-  GObjectClass *gobject_class = (GObjectClass *) klass;
-  GstBufferPoolClass *gstbufferpool_class = (GstBufferPoolClass *) klass;
-
-  gst_omx_buffer_data_quark = g_quark_from_static_string ("GstOMXBufferData");
-
-  gobject_class->finalize = gst_omx_buffer_pool_finalize;
-  gstbufferpool_class->start = gst_omx_buffer_pool_start;
-  gstbufferpool_class->stop = gst_omx_buffer_pool_stop;
-  gstbufferpool_class->get_options = gst_omx_buffer_pool_get_options;
-  gstbufferpool_class->set_config = gst_omx_buffer_pool_set_config;
-  gstbufferpool_class->alloc_buffer = gst_omx_buffer_pool_alloc_buffer;
-  gstbufferpool_class->free_buffer = gst_omx_buffer_pool_free_buffer;
-  gstbufferpool_class->acquire_buffer = gst_omx_buffer_pool_acquire_buffer;
-  gstbufferpool_class->release_buffer = gst_omx_buffer_pool_release_buffer;
-}
-
-static void
-gst_omx_buffer_pool_init (GstOMXBufferPool * pool)
-{
-  pool->buffers = g_ptr_array_new ();
-  pool->allocator = g_object_new (gst_omx_memory_allocator_get_type (), NULL);
-}
-
-static GstBufferPool *
-gst_omx_buffer_pool_new (GstElement * element, GstOMXComponent * component,
-    GstOMXPort * port)
-{
-  GstOMXBufferPool *pool;
-
-  pool = g_object_new (gst_omx_buffer_pool_get_type (), NULL);
-  pool->element = gst_object_ref (element);
-  pool->component = component;
-  pool->port = port;
-
-  return GST_BUFFER_POOL (pool);
-}
-
-typedef struct _BufferIdentification BufferIdentification;
-struct _BufferIdentification
-{
-  guint64 timestamp;
-};
-
-static void
-buffer_identification_free (BufferIdentification * id)
-{
-  g_slice_free (BufferIdentification, id);
-}
-
 /* prototypes */
 static void gst_omx_video_dec_finalize (GObject * object);
+static void gst_omx_video_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_omx_video_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn
 gst_omx_video_dec_change_state (GstElement * element,
@@ -678,10 +80,14 @@ static GstFlowReturn gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
 static GstFlowReturn gst_omx_video_dec_finish (GstVideoDecoder * decoder);
 static gboolean gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec,
     GstQuery * query);
+static gboolean gst_omx_video_dec_propose_allocation (GstVideoDecoder * bdec,
+    GstQuery * query);
 
 static GstFlowReturn gst_omx_video_dec_drain (GstOMXVideoDec * self,
     gboolean is_eos);
 
+static OMX_ERRORTYPE gst_omx_video_dec_deallocate_input_buffers (GstOMXVideoDec
+    * self);
 static OMX_ERRORTYPE gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec *
     self);
 static OMX_ERRORTYPE gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec
@@ -689,9 +95,28 @@ static OMX_ERRORTYPE gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_ZERO_COPY,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_COPY_THREADS,
+  PROP_INPUT_QOS,
+  PROP_LOW_LATENCY,
+  PROP_MAX_WIDTH,
+  PROP_MAX_HEIGHT
 };
 
+#define GST_OMX_VIDEO_DEC_ZERO_COPY_DEFAULT (FALSE)
+#define GST_OMX_VIDEO_DEC_STATS_INTERVAL_DEFAULT (0)
+#define GST_OMX_VIDEO_DEC_COPY_THREADS_DEFAULT (1)
+#define GST_OMX_VIDEO_DEC_INPUT_QOS_DEFAULT (FALSE)
+#define GST_OMX_VIDEO_DEC_LOW_LATENCY_DEFAULT (FALSE)
+#define GST_OMX_VIDEO_DEC_MAX_WIDTH_DEFAULT (0)
+#define GST_OMX_VIDEO_DEC_MAX_HEIGHT_DEFAULT (0)
+
+/* Frames later than this are dropped until the next keyframe */
+#define GST_OMX_VIDEO_DEC_QOS_SKIP_GOP_LATENESS (500 * GST_MSECOND)
+
 /* class initialization */
 
 #define DEBUG_INIT \
@@ -710,6 +135,72 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
   GstVideoDecoderClass *video_decoder_class = GST_VIDEO_DECODER_CLASS (klass);
 
   gobject_class->finalize = gst_omx_video_dec_finalize;
+  gobject_class->set_property = gst_omx_video_dec_set_property;
+  gobject_class->get_property = gst_omx_video_dec_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_ZERO_COPY,
+      g_param_spec_boolean ("zero-copy", "Zero Copy",
+          "Always push the OpenMAX output buffers downstream, with video meta "
+          "for the component's strides. Frames are only copied if downstream "
+          "holds too many buffers",
+          GST_OMX_VIDEO_DEC_ZERO_COPY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Latency and occupancy statistics of the OpenMAX ports",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics Interval",
+          "Interval in milliseconds for collecting the port statistics and "
+          "posting them as element messages (0=disabled)",
+          0, G_MAXUINT, GST_OMX_VIDEO_DEC_STATS_INTERVAL_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COPY_THREADS,
+      g_param_spec_uint ("copy-threads", "Copy Threads",
+          "Number of threads for copying frames that have a different layout "
+          "than the OpenMAX buffers (0=automatic, depending on frame size)",
+          0, GST_OMX_VIDEO_COPY_MAX_THREADS,
+          GST_OMX_VIDEO_DEC_COPY_THREADS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_INPUT_QOS,
+      g_param_spec_boolean ("input-qos", "Input QoS",
+          "Drop late frames that no other frames depend on before decoding "
+          "them, and all frames until the next keyframe if very late",
+          GST_OMX_VIDEO_DEC_INPUT_QOS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low Latency",
+          "Only use as many output buffers as the component requires and "
+          "ask it not to reorder frames, for streams without B-frames",
+          GST_OMX_VIDEO_DEC_LOW_LATENCY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_WIDTH,
+      g_param_spec_uint ("max-width", "Maximum Width",
+          "Maximum width of the stream for adaptive playback, only used "
+          "if the component supports the adaptive playback extension "
+          "(0=disabled)",
+          0, G_MAXUINT, GST_OMX_VIDEO_DEC_MAX_WIDTH_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_HEIGHT,
+      g_param_spec_uint ("max-height", "Maximum Height",
+          "Maximum height of the stream for adaptive playback, only used "
+          "if the component supports the adaptive playback extension "
+          "(0=disabled)",
+          0, G_MAXUINT, GST_OMX_VIDEO_DEC_MAX_HEIGHT_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_change_state);
@@ -726,6 +217,8 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
   video_decoder_class->finish = GST_DEBUG_FUNCPTR (gst_omx_video_dec_finish);
   video_decoder_class->decide_allocation =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_decide_allocation);
+  video_decoder_class->propose_allocation =
+      GST_DEBUG_FUNCPTR (gst_omx_video_dec_propose_allocation);
 
   klass->cdata.type = GST_OMX_COMPONENT_TYPE_FILTER;
   klass->cdata.default_src_template_caps = "video/x-raw, "
@@ -738,6 +231,16 @@ gst_omx_video_dec_init (GstOMXVideoDec * self)
 {
   gst_video_decoder_set_packetized (GST_VIDEO_DECODER (self), TRUE);
 
+  self->zero_copy = GST_OMX_VIDEO_DEC_ZERO_COPY_DEFAULT;
+  self->stats_interval = GST_OMX_VIDEO_DEC_STATS_INTERVAL_DEFAULT;
+  self->copy_threads = GST_OMX_VIDEO_DEC_COPY_THREADS_DEFAULT;
+  self->input_qos = GST_OMX_VIDEO_DEC_INPUT_QOS_DEFAULT;
+  self->low_latency = GST_OMX_VIDEO_DEC_LOW_LATENCY_DEFAULT;
+  self->max_width = GST_OMX_VIDEO_DEC_MAX_WIDTH_DEFAULT;
+  self->max_height = GST_OMX_VIDEO_DEC_MAX_HEIGHT_DEFAULT;
+
+  gst_omx_frame_index_init (&self->frame_index);
+
   g_mutex_init (&self->drain_lock);
   g_cond_init (&self->drain_cond);
 }
@@ -751,15 +254,29 @@ gst_omx_video_dec_open (GstVideoDecoder * decoder)
 
   GST_DEBUG_OBJECT (self, "Opening decoder");
 
-  self->dec =
-      gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
-      klass->cdata.component_name, klass->cdata.component_role,
-      klass->cdata.hacks);
+  if (klass->cdata.reuse_component)
+    self->dec =
+        gst_omx_component_acquire (GST_OBJECT_CAST (self),
+        klass->cdata.core_name, klass->cdata.component_name,
+        klass->cdata.component_role, klass->cdata.hacks);
+  else
+    self->dec =
+        gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
+        klass->cdata.component_name, klass->cdata.component_role,
+        klass->cdata.hacks);
   self->started = FALSE;
+  self->adaptive_playback = FALSE;
+  self->has_crop = FALSE;
+  self->crop_cookie = 0;
+  self->crop_meta_supported = FALSE;
+  self->crop_in_caps = FALSE;
 
   if (!self->dec)
     return FALSE;
 
+  gst_omx_component_set_stats_interval (self->dec,
+      self->stats_interval * GST_MSECOND);
+
   if (gst_omx_component_get_state (self->dec,
           GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
     return FALSE;
@@ -866,7 +383,7 @@ gst_omx_video_dec_shutdown (GstOMXVideoDec * self)
     gst_omx_component_set_state (self->egl_render, OMX_StateLoaded);
     gst_omx_component_set_state (self->dec, OMX_StateLoaded);
 
-    gst_omx_port_deallocate_buffers (self->dec_in_port);
+    gst_omx_video_dec_deallocate_input_buffers (self);
     gst_omx_video_dec_deallocate_output_buffers (self);
     gst_omx_component_close_tunnel (self->dec, self->dec_out_port,
         self->egl_render, self->egl_in_port);
@@ -887,7 +404,7 @@ gst_omx_video_dec_shutdown (GstOMXVideoDec * self)
       gst_omx_component_get_state (self->dec, 5 * GST_SECOND);
     }
     gst_omx_component_set_state (self->dec, OMX_StateLoaded);
-    gst_omx_port_deallocate_buffers (self->dec_in_port);
+    gst_omx_video_dec_deallocate_input_buffers (self);
     gst_omx_video_dec_deallocate_output_buffers (self);
     if (state > OMX_StateLoaded)
       gst_omx_component_get_state (self->dec, 5 * GST_SECOND);
@@ -909,7 +426,7 @@ gst_omx_video_dec_close (GstVideoDecoder * decoder)
   self->dec_in_port = NULL;
   self->dec_out_port = NULL;
   if (self->dec)
-    gst_omx_component_free (self->dec);
+    gst_omx_component_release (self->dec);
   self->dec = NULL;
 
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_EGL)
@@ -932,12 +449,98 @@ gst_omx_video_dec_finalize (GObject * object)
 {
   GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (object);
 
+  gst_omx_frame_index_clear (&self->frame_index);
+  gst_omx_video_dec_clear_decode_only_frames (self);
+
   g_mutex_clear (&self->drain_lock);
   g_cond_clear (&self->drain_cond);
 
   G_OBJECT_CLASS (gst_omx_video_dec_parent_class)->finalize (object);
 }
 
+static void
+gst_omx_video_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (object);
+
+  switch (prop_id) {
+    case PROP_ZERO_COPY:
+      self->zero_copy = g_value_get_boolean (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      self->stats_interval = g_value_get_uint (value);
+      if (self->dec)
+        gst_omx_component_set_stats_interval (self->dec,
+            self->stats_interval * GST_MSECOND);
+      break;
+    case PROP_COPY_THREADS:
+      self->copy_threads = g_value_get_uint (value);
+      break;
+    case PROP_INPUT_QOS:
+      self->input_qos = g_value_get_boolean (value);
+      break;
+    case PROP_LOW_LATENCY:
+      self->low_latency = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_WIDTH:
+      self->max_width = g_value_get_uint (value);
+      break;
+    case PROP_MAX_HEIGHT:
+      self->max_height = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_video_dec_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (object);
+
+  switch (prop_id) {
+    case PROP_ZERO_COPY:
+      g_value_set_boolean (value, self->zero_copy);
+      break;
+    case PROP_STATS:{
+      GstStructure *stats = NULL;
+
+      if (self->dec) {
+        stats = gst_omx_component_get_stats (self->dec);
+        gst_structure_set (stats, "qos-dropped", G_TYPE_UINT64,
+            self->qos_dropped, "qos-dropped-gop", G_TYPE_UINT64,
+            self->qos_dropped_gop, NULL);
+      }
+      g_value_take_boxed (value, stats);
+      break;
+    }
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, self->stats_interval);
+      break;
+    case PROP_COPY_THREADS:
+      g_value_set_uint (value, self->copy_threads);
+      break;
+    case PROP_INPUT_QOS:
+      g_value_set_boolean (value, self->input_qos);
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, self->low_latency);
+      break;
+    case PROP_MAX_WIDTH:
+      g_value_set_uint (value, self->max_width);
+      break;
+    case PROP_MAX_HEIGHT:
+      g_value_set_uint (value, self->max_height);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static GstStateChangeReturn
 gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
 {
@@ -1008,98 +611,163 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
-#define MAX_FRAME_DIST_TICKS  (5 * OMX_TICKS_PER_SECOND)
-#define MAX_FRAME_DIST_FRAMES (100)
+/* Components usually don't output anything for decode-only frames,
+ * finish those that were passed to the component before frame. The
+ * base class doesn't push decode-only frames
+ *
+ * NOTE: Must be called with the stream lock */
+static void
+gst_omx_video_dec_finish_decode_only_frames (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GstVideoCodecFrame *tmp;
 
-static GstVideoCodecFrame *
-_find_nearest_frame (GstOMXVideoDec * self, GstOMXBuffer * buf)
+  while ((tmp = g_queue_peek_head (&self->decode_only_frames))
+      && tmp->system_frame_number < frame->system_frame_number) {
+    g_queue_pop_head (&self->decode_only_frames);
+    GST_LOG_OBJECT (self, "Finishing decode-only frame %u",
+        tmp->system_frame_number);
+    gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), tmp);
+  }
+}
+
+/* Must be called before finishing or dropping a decode-only frame
+ * anywhere else
+ *
+ * NOTE: Must be called with the stream lock */
+static void
+gst_omx_video_dec_forget_decode_only_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
 {
-  GList *l, *best_l = NULL;
-  GList *finish_frames = NULL;
-  GstVideoCodecFrame *best = NULL;
-  guint64 best_timestamp = 0;
-  guint64 best_diff = G_MAXUINT64;
-  BufferIdentification *best_id = NULL;
-  GList *frames;
-
-  frames = gst_video_decoder_get_frames (GST_VIDEO_DECODER (self));
-
-  for (l = frames; l; l = l->next) {
-    GstVideoCodecFrame *tmp = l->data;
-    BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-    guint64 timestamp, diff;
-
-    /* This happens for frames that were just added but
-     * which were not passed to the component yet. Ignore
-     * them here!
-     */
-    if (!id)
-      continue;
+  if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame)
+      && g_queue_remove (&self->decode_only_frames, frame))
+    gst_video_codec_frame_unref (frame);
+}
 
-    timestamp = id->timestamp;
+static void
+gst_omx_video_dec_clear_decode_only_frames (GstOMXVideoDec * self)
+{
+  GstVideoCodecFrame *frame;
 
-    if (timestamp > buf->omx_buf->nTimeStamp)
-      diff = timestamp - buf->omx_buf->nTimeStamp;
-    else
-      diff = buf->omx_buf->nTimeStamp - timestamp;
-
-    if (best == NULL || diff < best_diff) {
-      best = tmp;
-      best_timestamp = timestamp;
-      best_diff = diff;
-      best_l = l;
-      best_id = id;
-
-      /* For frames without timestamp we simply take the first frame */
-      if ((buf->omx_buf->nTimeStamp == 0 && timestamp == 0) || diff == 0)
-        break;
+  while ((frame = g_queue_pop_head (&self->decode_only_frames)))
+    gst_video_codec_frame_unref (frame);
+}
+
+static GstVideoCodecFrame *
+_find_nearest_frame (GstOMXVideoDec * self, GstOMXBuffer * buf)
+{
+  GstVideoCodecFrame *best;
+  GList *old_frames, *l;
+
+  /* Without reordering the output belongs to the oldest frame */
+  if (self->low_latency) {
+    best = gst_video_decoder_get_oldest_frame (GST_VIDEO_DECODER (self));
+    if (best && !GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (best)
+        && GST_CLOCK_TIME_IS_VALID (best->pts)
+        && gst_util_uint64_scale (best->pts, OMX_TICKS_PER_SECOND,
+            GST_SECOND) == buf->omx_buf->nTimeStamp)
+      return best;
+    if (best)
+      gst_video_codec_frame_unref (best);
+  }
+
+  best =
+      gst_omx_frame_index_find_nearest (&self->frame_index,
+      buf->omx_buf->nTimeStamp, &old_frames);
+
+  if (old_frames) {
+    for (l = old_frames; l; l = l->next) {
+      GstVideoCodecFrame *frame = l->data;
+
+      /* Expected if the component didn't output them */
+      gst_omx_video_dec_forget_decode_only_frame (self, frame);
+      if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame)) {
+        gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+      } else {
+        g_warning ("Too old frames, bug in decoder -- please file a bug");
+        gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
+      }
     }
+    g_list_free (old_frames);
   }
 
-  if (FALSE && best_id) {
-    for (l = frames; l && l != best_l; l = l->next) {
-      GstVideoCodecFrame *tmp = l->data;
-      BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-      guint64 diff_ticks, diff_frames;
+  if (best)
+    gst_omx_video_dec_finish_decode_only_frames (self, best);
 
-      /* This happens for frames that were just added but
-       * which were not passed to the component yet. Ignore
-       * them here!
-       */
-      if (!id)
-        continue;
+  return best;
+}
 
-      if (id->timestamp > best_timestamp)
-        break;
+/* Decides from the QoS information of the base class if frame is
+ * dropped before passing it to the component.
+ *
+ * NOTE: Must be called with the stream lock */
+static gboolean
+gst_omx_video_dec_qos_drop (GstOMXVideoDec * self, GstVideoCodecFrame * frame)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  GstClockTimeDiff deadline;
 
-      if (id->timestamp == 0 || best_timestamp == 0)
-        diff_ticks = 0;
-      else
-        diff_ticks = best_timestamp - id->timestamp;
-      diff_frames = best->system_frame_number - tmp->system_frame_number;
+  if (!self->input_qos || GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame))
+    return FALSE;
 
-      if (diff_ticks > MAX_FRAME_DIST_TICKS
-          || diff_frames > MAX_FRAME_DIST_FRAMES) {
-        finish_frames =
-            g_list_prepend (finish_frames, gst_video_codec_frame_ref (tmp));
-      }
-    }
+  /* Keyframes are never dropped, decoding can continue from them */
+  if (GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+    if (self->qos_skip_gop)
+      GST_DEBUG_OBJECT (self, "Keyframe, stopping to drop frames");
+    self->qos_skip_gop = FALSE;
+    return FALSE;
   }
 
-  if (FALSE && finish_frames) {
-    g_warning ("Too old frames, bug in decoder -- please file a bug");
-    for (l = finish_frames; l; l = l->next) {
-      gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), l->data);
-    }
+  if (self->qos_skip_gop) {
+    self->qos_dropped_gop++;
+    return TRUE;
   }
 
-  if (best)
-    gst_video_codec_frame_ref (best);
+  deadline =
+      gst_video_decoder_get_max_decode_time (GST_VIDEO_DECODER (self), frame);
+  if (deadline >= 0)
+    return FALSE;
+
+  if (-deadline > GST_OMX_VIDEO_DEC_QOS_SKIP_GOP_LATENESS) {
+    GST_DEBUG_OBJECT (self, "Frame is %" GST_TIME_FORMAT " late, dropping "
+        "until the next keyframe", GST_TIME_ARGS (-deadline));
+    self->qos_skip_gop = TRUE;
+    self->qos_dropped_gop++;
+    return TRUE;
+  }
 
-  g_list_foreach (frames, (GFunc) gst_video_codec_frame_unref, NULL);
-  g_list_free (frames);
+  if (klass->is_droppable && klass->is_droppable (self, frame)) {
+    GST_DEBUG_OBJECT (self, "Frame is %" GST_TIME_FORMAT " late, dropping",
+        GST_TIME_ARGS (-deadline));
+    self->qos_dropped++;
+    return TRUE;
+  }
 
-  return best;
+  return FALSE;
+}
+
+/* Frames completely before the start of the segment, or after
+ * its stop when playing backwards, are only needed as reference
+ * for the following frames */
+static gboolean
+gst_omx_video_dec_is_decode_only (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GstSegment *segment = &GST_VIDEO_DECODER (self)->input_segment;
+
+  if (segment->format != GST_FORMAT_TIME
+      || !GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return FALSE;
+
+  if (segment->rate > 0.0) {
+    if (GST_CLOCK_TIME_IS_VALID (frame->duration))
+      return frame->pts + frame->duration <= segment->start;
+    else
+      return frame->pts < segment->start;
+  } else {
+    return GST_CLOCK_TIME_IS_VALID (segment->stop)
+        && frame->pts >= segment->stop;
+  }
 }
 
 static gboolean
@@ -1110,9 +778,29 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
       gst_video_decoder_get_output_state (GST_VIDEO_DECODER (self));
   GstVideoInfo *vinfo = &state->info;
   OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->dec_out_port->port_def;
+  OMX_PARAM_PORTDEFINITIONTYPE cropped;
   gboolean ret = FALSE;
   GstVideoFrame frame;
 
+  /* Only the visible rectangle at the top left of the port buffers
+   * is copied, with the layout of the whole frames */
+  if (self->crop_in_caps) {
+    GstVideoInfo full;
+
+    gst_video_info_set_format (&full, GST_VIDEO_INFO_FORMAT (vinfo),
+        port_def->format.video.nFrameWidth,
+        port_def->format.video.nFrameHeight);
+
+    cropped = *port_def;
+    if (cropped.format.video.nStride == 0)
+      cropped.format.video.nStride = GST_VIDEO_INFO_PLANE_STRIDE (&full, 0);
+    if (cropped.format.video.nSliceHeight == 0)
+      cropped.format.video.nSliceHeight = cropped.format.video.nFrameHeight;
+    cropped.format.video.nFrameWidth = self->crop.nWidth;
+    cropped.format.video.nFrameHeight = self->crop.nHeight;
+    port_def = &cropped;
+  }
+
   if (vinfo->width != port_def->format.video.nFrameWidth ||
       vinfo->height != port_def->format.video.nFrameHeight) {
     GST_ERROR_OBJECT (self, "Resolution do not match: port=%ux%u vinfo=%dx%d",
@@ -1122,133 +810,377 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
     goto done;
   }
 
-  /* Same strides and everything */
-  if (gst_buffer_get_size (outbuf) == inbuf->omx_buf->nFilledLen) {
-    GstMapInfo map = GST_MAP_INFO_INIT;
+  /* Planes with the same strides are copied at once, and all of
+   * them are split between the copy threads */
+  if (!gst_video_frame_map (&frame, vinfo, outbuf, GST_MAP_WRITE)) {
+    GST_ERROR_OBJECT (self, "Invalid output buffer");
+    goto done;
+  }
+
+  ret = gst_omx_video_copy_frame (port_def, &frame,
+      inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset,
+      inbuf->omx_buf->nAllocLen - inbuf->omx_buf->nOffset, FALSE,
+      self->copy_threads, NULL);
+  gst_video_frame_unmap (&frame);
+
+  if (!ret)
+    GST_ERROR_OBJECT (self, "Unsupported format %s or port buffer too small",
+        gst_video_format_to_string (vinfo->finfo->format));
+
+done:
+  if (ret) {
+    GST_BUFFER_PTS (outbuf) =
+        gst_util_uint64_scale (inbuf->omx_buf->nTimeStamp, GST_SECOND,
+        OMX_TICKS_PER_SECOND);
+    if (inbuf->omx_buf->nTickCount != 0)
+      GST_BUFFER_DURATION (outbuf) =
+          gst_util_uint64_scale (inbuf->omx_buf->nTickCount, GST_SECOND,
+          OMX_TICKS_PER_SECOND);
+  }
+
+  gst_video_codec_state_unref (state);
+
+  return ret;
+}
+
+/* Checks if the buffers of port have the layout downstream
+ * expects if there is no video meta on them */
+static gboolean
+gst_omx_video_dec_port_has_default_layout (GstOMXVideoDec * self,
+    GstOMXPort * port, GstVideoInfo * vinfo)
+{
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  guint i;
+
+  if (!gst_omx_video_get_plane_layout (&port->port_def, vinfo, offset, stride,
+          NULL))
+    return FALSE;
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vinfo); i++) {
+    if (offset[i] != GST_VIDEO_INFO_PLANE_OFFSET (vinfo, i)
+        || stride[i] != GST_VIDEO_INFO_PLANE_STRIDE (vinfo, i))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* The OpenMAX output buffers are pushed downstream and only return
+ * to the component once downstream released them. If downstream
+ * keeps so many of them that the component would be left with less
+ * than it needs, copy into a downstream buffer instead to not stall
+ * decoding. Only used in zero-copy mode, otherwise the pool has the
+ * size downstream asked for */
+static gboolean
+gst_omx_video_dec_out_port_pool_is_dry (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (self->out_port_pool);
+  gint n_left;
+
+  if (!self->zero_copy)
+    return FALSE;
+
+  n_left =
+      port->port_def.nBufferCountActual -
+      g_atomic_int_get (&pool->n_outstanding) - 1;
+
+  return n_left < (gint) port->port_def.nBufferCountMin;
+}
+
+/* NOTE: Must be called instead of gst_omx_port_allocate_buffers()
+ * for the input port */
+static OMX_ERRORTYPE
+gst_omx_video_dec_allocate_input_buffers (GstOMXVideoDec * self)
+{
+  GstOMXPort *port = self->dec_in_port;
+  GstBufferPool *pool;
+  OMX_ERRORTYPE err;
+
+  g_assert (self->in_port_pool == NULL);
+
+  /* The port uses the memory of the pool that is proposed to
+   * upstream, see gst_omx_video_dec_propose_allocation() */
+  pool = gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self), self->dec, port);
+  err = gst_omx_buffer_pool_use_port_buffers (pool);
+  if (err == OMX_ErrorNone) {
+    self->in_port_pool = pool;
+    return OMX_ErrorNone;
+  }
+  gst_object_unref (pool);
+
+  GST_INFO_OBJECT (self, "Component can't use our memory for the input "
+      "port: %s (0x%08x), copying all input", gst_omx_error_to_string (err),
+      err);
+
+  return gst_omx_port_allocate_buffers (port);
+}
+
+static OMX_ERRORTYPE
+gst_omx_video_dec_deallocate_input_buffers (GstOMXVideoDec * self)
+{
+  OMX_ERRORTYPE err;
+
+  if (self->in_port_pool) {
+    /* Upstream might still use the pool, it gives out normal
+     * buffers from now on. Let upstream ask for a new one */
+    gst_pad_push_event (GST_VIDEO_DECODER_SINK_PAD (self),
+        gst_event_new_reconfigure ());
+
+    /* Port buffers that upstream still holds don't need to be
+     * waited for, their memory is freed together with the pool */
+    gst_omx_buffer_pool_deactivate (self->in_port_pool);
+  }
+
+  err = gst_omx_port_deallocate_buffers (self->dec_in_port);
+
+  if (self->in_port_pool) {
+    gst_object_unref (self->in_port_pool);
+    self->in_port_pool = NULL;
+  }
+
+  return err;
+}
+
+#define IS_ADAPTIVE(self) ((self)->max_width > 0 && (self)->max_height > 0)
+
+/* Vendor extension that tells the component to handle resolution
+ * changes up to the maximum without port reconfiguration */
+#define ADAPTIVE_PLAYBACK_EXTENSION \
+  "OMX.google.android.index.prepareForAdaptivePlayback"
+
+typedef struct
+{
+  OMX_U32 nSize;
+  OMX_VERSIONTYPE nVersion;
+  OMX_U32 nPortIndex;
+  OMX_BOOL bEnable;
+  OMX_U32 nMaxFrameWidth;
+  OMX_U32 nMaxFrameHeight;
+} GstOMXAdaptivePlaybackParams;
+
+/* Must be called while the output port is disabled or the component
+ * is in Loaded state. Returns TRUE if the component will change the
+ * resolution without requiring the output port to be reconfigured */
+static gboolean
+gst_omx_video_dec_enable_adaptive_playback (GstOMXVideoDec * self)
+{
+  GstOMXAdaptivePlaybackParams params;
+  OMX_INDEXTYPE index;
+  OMX_ERRORTYPE err;
+
+  err = gst_omx_component_get_extension_index (self->dec,
+      ADAPTIVE_PLAYBACK_EXTENSION, &index);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (self, "Component doesn't support adaptive playback, "
+        "every resolution change reconfigures the output port");
+    return FALSE;
+  }
+
+  GST_OMX_INIT_STRUCT (&params);
+  params.nPortIndex = self->dec_out_port->index;
+  params.bEnable = OMX_TRUE;
+  params.nMaxFrameWidth = self->max_width;
+  params.nMaxFrameHeight = self->max_height;
+
+  err = gst_omx_component_set_parameter (self->dec, index, &params);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (self, "Failed to enable adaptive playback: %s "
+        "(0x%08x)", gst_omx_error_to_string (err), err);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Enabled adaptive playback up to %ux%u",
+      self->max_width, self->max_height);
+
+  return TRUE;
+}
+
+/* Remembers the visible rectangle of the output frames, which the
+ * component can change together with the resolution */
+static void
+gst_omx_video_dec_update_crop (GstOMXVideoDec * self, GstOMXPort * port,
+    const OMX_PARAM_PORTDEFINITIONTYPE * port_def)
+{
+  OMX_ERRORTYPE err;
+
+  self->has_crop = FALSE;
+  self->crop_cookie = g_atomic_int_get (&port->crop_cookie);
+
+  GST_OMX_INIT_STRUCT (&self->crop);
+  self->crop.nPortIndex = port->index;
+  err = gst_omx_component_get_config (port->comp,
+      OMX_IndexConfigCommonOutputCrop, &self->crop);
+  if (err != OMX_ErrorNone) {
+    GST_DEBUG_OBJECT (self, "No crop rectangle: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return;
+  }
+
+  if (self->crop.nWidth == 0 || self->crop.nHeight == 0
+      || self->crop.nLeft < 0 || self->crop.nTop < 0
+      || self->crop.nLeft + self->crop.nWidth >
+      port_def->format.video.nFrameWidth
+      || self->crop.nTop + self->crop.nHeight >
+      port_def->format.video.nFrameHeight)
+    return;
+
+  self->has_crop = self->crop.nWidth < port_def->format.video.nFrameWidth
+      || self->crop.nHeight < port_def->format.video.nFrameHeight;
+  if (self->has_crop)
+    GST_DEBUG_OBJECT (self, "Visible rectangle %ux%u at %d,%d",
+        (guint) self->crop.nWidth, (guint) self->crop.nHeight,
+        (gint) self->crop.nLeft, (gint) self->crop.nTop);
+}
+
+/* Sets the output state to the visible rectangle and negotiates again
+ * if downstream can't crop. The port buffers are copied then, which
+ * only works for rectangles at the top left corner of the frames.
+ *
+ * NOTE: Must be called with the stream lock after negotiating the
+ * frame size of the port */
+static gboolean
+gst_omx_video_dec_negotiate_crop (GstOMXVideoDec * self,
+    GstVideoFormat format)
+{
+  GstVideoCodecState *state;
+
+  self->crop_in_caps = FALSE;
+  if (!self->has_crop || self->crop_meta_supported)
+    return TRUE;
 
-    gst_buffer_map (outbuf, &map, GST_MAP_WRITE);
-    memcpy (map.data,
-        inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset,
-        inbuf->omx_buf->nFilledLen);
-    gst_buffer_unmap (outbuf, &map);
-    ret = TRUE;
-    goto done;
+  if (self->crop.nLeft != 0 || self->crop.nTop != 0) {
+    GST_WARNING_OBJECT (self, "Downstream can't crop and the visible "
+        "rectangle is not at the top left, outputting whole frames");
+    return TRUE;
   }
 
-  /* Different strides */
+  GST_DEBUG_OBJECT (self, "Downstream can't crop, setting output state "
+      "to the visible rectangle");
 
-  switch (vinfo->finfo->format) {
-    case GST_VIDEO_FORMAT_I420:{
-      gint i, j, height, width;
-      guint8 *src, *dest;
-      gint src_stride, dest_stride;
+  state = gst_video_decoder_set_output_state (GST_VIDEO_DECODER (self),
+      format, self->crop.nWidth, self->crop.nHeight, self->input_state);
+  gst_video_codec_state_unref (state);
 
-      gst_video_frame_map (&frame, vinfo, outbuf, GST_MAP_WRITE);
-      for (i = 0; i < 3; i++) {
-        if (i == 0) {
-          src_stride = port_def->format.video.nStride;
-          dest_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, i);
+  if (!gst_video_decoder_negotiate (GST_VIDEO_DECODER (self)))
+    return FALSE;
 
-          /* XXX: Try this if no stride was set */
-          if (src_stride == 0)
-            src_stride = dest_stride;
-        } else {
-          src_stride = port_def->format.video.nStride / 2;
-          dest_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, i);
+  self->crop_in_caps = TRUE;
 
-          /* XXX: Try this if no stride was set */
-          if (src_stride == 0)
-            src_stride = dest_stride;
-        }
+  return TRUE;
+}
 
-        src = inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset;
-        if (i > 0)
-          src +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
-        if (i == 2)
-          src +=
-              (port_def->format.video.nSliceHeight / 2) *
-              (port_def->format.video.nStride / 2);
-
-        dest = GST_VIDEO_FRAME_COMP_DATA (&frame, i);
-        height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, i);
-        width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, i);
-
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          src += src_stride;
-          dest += dest_stride;
-        }
-      }
-      gst_video_frame_unmap (&frame);
-      ret = TRUE;
-      break;
-    }
-    case GST_VIDEO_FORMAT_NV12:{
-      gint i, j, height, width;
-      guint8 *src, *dest;
-      gint src_stride, dest_stride;
-
-      gst_video_frame_map (&frame, vinfo, outbuf, GST_MAP_WRITE);
-      for (i = 0; i < 2; i++) {
-        if (i == 0) {
-          src_stride = port_def->format.video.nStride;
-          dest_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, i);
-
-          /* XXX: Try this if no stride was set */
-          if (src_stride == 0)
-            src_stride = dest_stride;
-        } else {
-          src_stride = port_def->format.video.nStride;
-          dest_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, i);
-
-          /* XXX: Try this if no stride was set */
-          if (src_stride == 0)
-            src_stride = dest_stride;
-        }
+/* Reads the visible rectangle again after the component changed only
+ * that, and negotiates again if the caps depend on it.
+ *
+ * NOTE: Must be called with the stream lock */
+static gboolean
+gst_omx_video_dec_update_crop_changed (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  GstVideoCodecState *state;
+  GstVideoFormat format;
+  gboolean crop_in_caps = self->crop_in_caps;
 
-        src = inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset;
-        if (i == 1)
-          src +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
+  gst_omx_video_dec_update_crop (self, port, &port->port_def);
+  if (!crop_in_caps && (!self->has_crop || self->crop_meta_supported))
+    return TRUE;
 
-        dest = GST_VIDEO_FRAME_COMP_DATA (&frame, i);
-        height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, i);
-        width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, i) * (i == 0 ? 1 : 2);
+  format =
+      gst_omx_video_get_format_from_omx (port->port_def.format.video.
+      eColorFormat);
+  state = gst_video_decoder_set_output_state (GST_VIDEO_DECODER (self),
+      format, port->port_def.format.video.nFrameWidth,
+      port->port_def.format.video.nFrameHeight, self->input_state);
+  gst_video_codec_state_unref (state);
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          src += src_stride;
-          dest += dest_stride;
-        }
-      }
-      gst_video_frame_unmap (&frame);
-      ret = TRUE;
-      break;
-    }
-    default:
-      GST_ERROR_OBJECT (self, "Unsupported format");
-      goto done;
-      break;
-  }
+  if (!gst_video_decoder_negotiate (GST_VIDEO_DECODER (self)))
+    return FALSE;
 
+  return gst_omx_video_dec_negotiate_crop (self, format);
+}
 
-done:
-  if (ret) {
-    GST_BUFFER_PTS (outbuf) =
-        gst_util_uint64_scale (inbuf->omx_buf->nTimeStamp, GST_SECOND,
-        OMX_TICKS_PER_SECOND);
-    if (inbuf->omx_buf->nTickCount != 0)
-      GST_BUFFER_DURATION (outbuf) =
-          gst_util_uint64_scale (inbuf->omx_buf->nTickCount, GST_SECOND,
-          OMX_TICKS_PER_SECOND);
-  }
+static void
+gst_omx_video_dec_add_crop_meta (GstOMXVideoDec * self, GstBuffer * buffer)
+{
+  GstVideoCropMeta *meta;
 
-  gst_video_codec_state_unref (state);
+  if (!self->has_crop || !self->crop_meta_supported || self->crop_in_caps
+      || !gst_buffer_is_writable (buffer))
+    return;
 
-  return ret;
+  meta = gst_buffer_add_video_crop_meta (buffer);
+  meta->x = self->crop.nLeft;
+  meta->y = self->crop.nTop;
+  meta->width = self->crop.nWidth;
+  meta->height = self->crop.nHeight;
+}
+
+/* Size of a frame with the maximum resolution in the layout of the
+ * port, 0 if unknown */
+static guint32
+gst_omx_video_dec_get_adaptive_buffer_size (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE port_def = port->port_def;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  GstVideoFormat format;
+  GstVideoInfo info;
+  gsize size;
+
+  format =
+      gst_omx_video_get_format_from_omx (port_def.format.video.eColorFormat);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    return 0;
+
+  gst_video_info_set_format (&info, format, self->max_width,
+      self->max_height);
+  port_def.format.video.nFrameWidth = self->max_width;
+  port_def.format.video.nFrameHeight = self->max_height;
+  port_def.format.video.nStride =
+      MAX (port_def.format.video.nStride, GST_VIDEO_INFO_PLANE_STRIDE (&info,
+          0));
+  port_def.format.video.nSliceHeight =
+      MAX (port_def.format.video.nSliceHeight, self->max_height);
+
+  if (!gst_omx_video_get_plane_layout (&port_def, &info, offset, stride,
+          &size))
+    return 0;
+
+  return MIN (size, G_MAXUINT32);
+}
+
+/* With adaptive playback the output port doesn't need to be
+ * reconfigured if the new settings still fit into the allocated
+ * buffers. Only for buffers that are copied, downstream's buffers
+ * have the video meta of the previous settings */
+static gboolean
+gst_omx_video_dec_can_reconfigure_in_place (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  GstOMXBuffer *buf;
+
+  if (!self->adaptive_playback || self->out_port_pool || !port->buffers
+      || port->buffers->len == 0)
+    return FALSE;
+#if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_EGL)
+  if (self->eglimage)
+    return FALSE;
+#endif
+
+  gst_omx_port_get_port_definition (port, &port_def);
+  buf = g_ptr_array_index (port->buffers, 0);
+
+  return port_def.bEnabled
+      && port_def.format.video.nFrameWidth <= self->max_width
+      && port_def.format.video.nFrameHeight <= self->max_height
+      && port_def.nBufferSize <= buf->omx_buf->nAllocLen
+      && port_def.nBufferCountActual == port->buffers->len
+      && gst_omx_video_get_format_from_omx (port_def.format.video.
+      eColorFormat) != GST_VIDEO_FORMAT_UNKNOWN;
 }
 
 static OMX_ERRORTYPE
@@ -1260,7 +1192,7 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
   GstStructure *config;
   gboolean eglimage = FALSE, add_videometa = FALSE;
   GstCaps *caps = NULL;
-  guint min = 0, max = 0;
+  guint min = 0, max = 0, min_buffers;
   GstVideoCodecState *state =
       gst_video_decoder_get_output_state (GST_VIDEO_DECODER (self));
 
@@ -1270,6 +1202,10 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
   port = self->dec_out_port;
 #endif
 
+  /* Additional buffers let the component run ahead of downstream,
+   * but every one of them adds latency */
+  min_buffers = self->low_latency ? 0 : 4;
+
   pool = gst_video_decoder_get_buffer_pool (GST_VIDEO_DECODER (self));
   if (pool) {
     GstAllocator *allocator;
@@ -1278,15 +1214,23 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
     gst_buffer_pool_config_get_params (config, &caps, NULL, &min, &max);
     gst_buffer_pool_config_get_allocator (config, &allocator, NULL);
 
-    /* Need at least 2 buffers for anything meaningful */
-    min = MAX (MAX (min, port->port_def.nBufferCountMin), 4);
-    if (max == 0) {
+    if (self->zero_copy) {
+      /* Downstream keeps up to min buffers and the component needs
+       * nBufferCountMin, plus one spare. Our own pool is used
+       * independent of the limits of downstream's pool */
+      min = MAX (min + port->port_def.nBufferCountMin + 1, min_buffers);
       max = min;
-    } else if (max < port->port_def.nBufferCountMin || max < 2) {
-      /* Can't use pool because can't have enough buffers */
-      gst_caps_replace (&caps, NULL);
     } else {
-      min = max;
+      /* Need at least 2 buffers for anything meaningful */
+      min = MAX (MAX (min, port->port_def.nBufferCountMin), min_buffers);
+      if (max == 0) {
+        max = min;
+      } else if (max < port->port_def.nBufferCountMin || max < 2) {
+        /* Can't use pool because can't have enough buffers */
+        gst_caps_replace (&caps, NULL);
+      } else {
+        min = max;
+      }
     }
 
     add_videometa = gst_buffer_pool_config_has_option (config,
@@ -1301,6 +1245,15 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
 #endif
     caps = caps ? gst_caps_ref (caps) : NULL;
 
+    /* Without video meta downstream assumes the default strides */
+    if (caps && !eglimage && !add_videometa && state
+        && !gst_omx_video_dec_port_has_default_layout (self, port,
+            &state->info)) {
+      GST_DEBUG_OBJECT (self, "Downstream doesn't support video meta and "
+          "the port uses non-default strides");
+      gst_caps_replace (&caps, NULL);
+    }
+
     GST_DEBUG_OBJECT (self, "Trying to use pool %p with caps %" GST_PTR_FORMAT
         " and memory type %s", pool, caps,
         (allocator ? allocator->mem_type : "(null)"));
@@ -1466,6 +1419,9 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
   if (!eglimage) {
     gboolean was_enabled = TRUE;
 
+    port->min_buffer_size = self->adaptive_playback ?
+        gst_omx_video_dec_get_adaptive_buffer_size (self, port) : 0;
+
     if (min != port->port_def.nBufferCountActual) {
       err = gst_omx_port_update_port_definition (port, NULL);
       if (err == OMX_ErrorNone) {
@@ -1796,26 +1752,20 @@ gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
   gst_omx_port_get_port_definition (port, &port_def);
   g_assert (port_def.format.video.eCompressionFormat == OMX_VIDEO_CodingUnused);
 
-  switch (port_def.format.video.eColorFormat) {
-    case OMX_COLOR_FormatYUV420Planar:
-    case OMX_COLOR_FormatYUV420PackedPlanar:
-      GST_DEBUG_OBJECT (self, "Output is I420 (%d)",
-          port_def.format.video.eColorFormat);
-      format = GST_VIDEO_FORMAT_I420;
-      break;
-    case OMX_COLOR_FormatYUV420SemiPlanar:
-      GST_DEBUG_OBJECT (self, "Output is NV12 (%d)",
-          port_def.format.video.eColorFormat);
-      format = GST_VIDEO_FORMAT_NV12;
-      break;
-    default:
-      GST_ERROR_OBJECT (self, "Unsupported color format: %d",
-          port_def.format.video.eColorFormat);
-      GST_VIDEO_DECODER_STREAM_UNLOCK (self);
-      err = OMX_ErrorUndefined;
-      goto done;
-      break;
+  format =
+      gst_omx_video_get_format_from_omx (port_def.format.video.eColorFormat);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+    GST_ERROR_OBJECT (self, "Unsupported color format: %d",
+        port_def.format.video.eColorFormat);
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+    err = OMX_ErrorUndefined;
+    goto done;
   }
+  GST_DEBUG_OBJECT (self, "Output is %s (%d)",
+      gst_video_format_to_string (format),
+      port_def.format.video.eColorFormat);
+
+  gst_omx_video_dec_update_crop (self, port, &port_def);
 
   GST_DEBUG_OBJECT (self,
       "Setting output state: format %s, width %u, height %u",
@@ -1836,6 +1786,12 @@ gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
 
   gst_video_codec_state_unref (state);
 
+  if (!gst_omx_video_dec_negotiate_crop (self, format)) {
+    GST_ERROR_OBJECT (self, "Failed to negotiate");
+    err = OMX_ErrorUndefined;
+    goto done;
+  }
+
   GST_VIDEO_DECODER_STREAM_UNLOCK (self);
 
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_EGL)
@@ -1876,6 +1832,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 #endif
 
   acq_return = gst_omx_port_acquire_buffer (port, &buf);
+  gst_omx_component_post_stats (self->dec);
   if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
     goto component_error;
   } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
@@ -1889,11 +1846,18 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     GstVideoCodecState *state;
     OMX_PARAM_PORTDEFINITIONTYPE port_def;
     GstVideoFormat format;
+    gboolean in_place = FALSE;
 
     GST_DEBUG_OBJECT (self, "Port settings have changed, updating caps");
 
-    /* Reallocate all buffers */
     if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE
+        && gst_omx_video_dec_can_reconfigure_in_place (self, port)) {
+      GST_DEBUG_OBJECT (self, "New settings fit into the allocated buffers");
+      in_place = TRUE;
+    }
+
+    /* Reallocate all buffers */
+    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE && !in_place
         && gst_omx_port_is_enabled (port)) {
       err = gst_omx_port_set_enabled (port, FALSE);
       if (err != OMX_ErrorNone)
@@ -1912,7 +1876,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         goto reconfigure_error;
     }
 
-    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE && !in_place) {
       /* We have the possibility to reconfigure everything now */
       err = gst_omx_video_dec_reconfigure_output_port (self);
       if (err != OMX_ErrorNone)
@@ -1925,27 +1889,22 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       g_assert (port_def.format.video.eCompressionFormat ==
           OMX_VIDEO_CodingUnused);
 
-      switch (port_def.format.video.eColorFormat) {
-        case OMX_COLOR_FormatYUV420Planar:
-        case OMX_COLOR_FormatYUV420PackedPlanar:
-          GST_DEBUG_OBJECT (self, "Output is I420 (%d)",
-              port_def.format.video.eColorFormat);
-          format = GST_VIDEO_FORMAT_I420;
-          break;
-        case OMX_COLOR_FormatYUV420SemiPlanar:
-          GST_DEBUG_OBJECT (self, "Output is NV12 (%d)",
-              port_def.format.video.eColorFormat);
-          format = GST_VIDEO_FORMAT_NV12;
-          break;
-        default:
-          GST_ERROR_OBJECT (self, "Unsupported color format: %d",
-              port_def.format.video.eColorFormat);
-          if (buf)
-            gst_omx_port_release_buffer (port, buf);
-          GST_VIDEO_DECODER_STREAM_UNLOCK (self);
-          goto caps_failed;
-          break;
+      format =
+          gst_omx_video_get_format_from_omx (port_def.format.video.
+          eColorFormat);
+      if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+        GST_ERROR_OBJECT (self, "Unsupported color format: %d",
+            port_def.format.video.eColorFormat);
+        if (buf)
+          gst_omx_port_release_buffer (port, buf);
+        GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+        goto caps_failed;
       }
+      GST_DEBUG_OBJECT (self, "Output is %s (%d)",
+          gst_video_format_to_string (format),
+          port_def.format.video.eColorFormat);
+
+      gst_omx_video_dec_update_crop (self, port, &port_def);
 
       GST_DEBUG_OBJECT (self,
           "Setting output state: format %s, width %u, height %u",
@@ -1968,7 +1927,19 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
       gst_video_codec_state_unref (state);
 
+      if (!gst_omx_video_dec_negotiate_crop (self, format)) {
+        if (buf)
+          gst_omx_port_release_buffer (port, buf);
+        goto caps_failed;
+      }
+
       GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
+      if (in_place) {
+        err = gst_omx_port_mark_reconfigured (port);
+        if (err != OMX_ErrorNone)
+          goto reconfigure_error;
+      }
     }
 
     /* Now get a buffer */
@@ -1993,9 +1964,23 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       (guint) buf->omx_buf->nFlags, (guint64) buf->omx_buf->nTimeStamp);
 
   GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  if (g_atomic_int_get (&port->crop_cookie) != self->crop_cookie
+      && !gst_omx_video_dec_update_crop_changed (self, port)) {
+    gst_omx_port_release_buffer (port, buf);
+    goto caps_failed;
+  }
+
   frame = _find_nearest_frame (self, buf);
 
-  if (frame
+  if (frame && GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame)) {
+    /* The component output it nonetheless, there's no need to
+     * copy it as the base class won't push it */
+    GST_LOG_OBJECT (self, "Skipping output of decode-only frame");
+    gst_omx_video_dec_forget_decode_only_frame (self, frame);
+    flow_ret = gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+    frame = NULL;
+  } else if (frame
       && (deadline = gst_video_decoder_get_max_decode_time
           (GST_VIDEO_DECODER (self), frame)) < 0) {
     GST_WARNING_OBJECT (self,
@@ -2013,7 +1998,10 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
     GST_ERROR_OBJECT (self, "No corresponding frame found");
 
-    if (self->out_port_pool) {
+    /* The pool's buffers have the size of the whole frames */
+    if (self->out_port_pool
+        && (buf->eglimage || (!self->crop_in_caps
+                && !gst_omx_video_dec_out_port_pool_is_dry (self, port)))) {
       gint i, n;
       GstBufferPoolAcquireParams params = { 0, };
 
@@ -2044,10 +2032,14 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         goto invalid_buffer;
       }
     }
+    gst_omx_video_dec_add_crop_meta (self, outbuf);
 
     flow_ret = gst_pad_push (GST_VIDEO_DECODER_SRC_PAD (self), outbuf);
   } else if (buf->omx_buf->nFilledLen > 0 || buf->eglimage) {
-    if (self->out_port_pool) {
+    /* The pool's buffers have the size of the whole frames */
+    if (self->out_port_pool
+        && (buf->eglimage || (!self->crop_in_caps
+                && !gst_omx_video_dec_out_port_pool_is_dry (self, port)))) {
       gint i, n;
       GstBufferPoolAcquireParams params = { 0, };
 
@@ -2071,6 +2063,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         gst_omx_port_release_buffer (port, buf);
         goto invalid_buffer;
       }
+      gst_omx_video_dec_add_crop_meta (self, frame->output_buffer);
       flow_ret =
           gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
       frame = NULL;
@@ -2091,6 +2084,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           gst_omx_port_release_buffer (port, buf);
           goto invalid_buffer;
         }
+        gst_omx_video_dec_add_crop_meta (self, frame->output_buffer);
         flow_ret =
             gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
         frame = NULL;
@@ -2105,8 +2099,10 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
   GST_DEBUG_OBJECT (self, "Finished frame: %s", gst_flow_get_name (flow_ret));
 
+  /* Don't block on the component before the next buffer can be
+   * acquired, the buffer is passed to it from another thread */
   if (buf) {
-    err = gst_omx_port_release_buffer (port, buf);
+    err = gst_omx_port_release_buffer_async (port, buf);
     if (err != OMX_ErrorNone)
       goto release_error;
   }
@@ -2246,6 +2242,8 @@ gst_omx_video_dec_start (GstVideoDecoder * decoder)
   self = GST_OMX_VIDEO_DEC (decoder);
 
   self->last_upstream_ts = 0;
+  gst_omx_video_dec_clear_decode_only_frames (self);
+  self->qos_skip_gop = FALSE;
   self->eos = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
 
@@ -2281,6 +2279,7 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
   self->downstream_flow_ret = GST_FLOW_FLUSHING;
   self->started = FALSE;
   self->eos = FALSE;
+  gst_omx_video_dec_clear_decode_only_frames (self);
 
   g_mutex_lock (&self->drain_lock);
   self->draining = FALSE;
@@ -2352,29 +2351,21 @@ gst_omx_video_dec_get_supported_colorformats (GstOMXVideoDec * self)
       break;
 
     if (err == OMX_ErrorNone || err == OMX_ErrorNoMore) {
-      switch (param.eColorFormat) {
-        case OMX_COLOR_FormatYUV420Planar:
-        case OMX_COLOR_FormatYUV420PackedPlanar:
-          m = g_slice_new (VideoNegotiationMap);
-          m->format = GST_VIDEO_FORMAT_I420;
-          m->type = param.eColorFormat;
-          negotiation_map = g_list_append (negotiation_map, m);
-          GST_DEBUG_OBJECT (self, "Component supports I420 (%d) at index %u",
-              param.eColorFormat, (guint) param.nIndex);
-          break;
-        case OMX_COLOR_FormatYUV420SemiPlanar:
-          m = g_slice_new (VideoNegotiationMap);
-          m->format = GST_VIDEO_FORMAT_NV12;
-          m->type = param.eColorFormat;
-          negotiation_map = g_list_append (negotiation_map, m);
-          GST_DEBUG_OBJECT (self, "Component supports NV12 (%d) at index %u",
-              param.eColorFormat, (guint) param.nIndex);
-          break;
-        default:
-          GST_DEBUG_OBJECT (self,
-              "Component supports unsupported color format %d at index %u",
-              param.eColorFormat, (guint) param.nIndex);
-          break;
+      GstVideoFormat format =
+          gst_omx_video_get_format_from_omx (param.eColorFormat);
+
+      if (format != GST_VIDEO_FORMAT_UNKNOWN) {
+        m = g_slice_new (VideoNegotiationMap);
+        m->format = format;
+        m->type = param.eColorFormat;
+        negotiation_map = g_list_append (negotiation_map, m);
+        GST_DEBUG_OBJECT (self, "Component supports %s (%d) at index %u",
+            gst_video_format_to_string (format), param.eColorFormat,
+            (guint) param.nIndex);
+      } else {
+        GST_DEBUG_OBJECT (self,
+            "Component supports unsupported color format %d at index %u",
+            param.eColorFormat, (guint) param.nIndex);
       }
     }
     old_index = param.nIndex++;
@@ -2486,7 +2477,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   GstOMXVideoDec *self;
   GstOMXVideoDecClass *klass;
   GstVideoInfo *info = &state->info;
-  gboolean is_format_change = FALSE;
+  gboolean is_format_change = FALSE, is_size_change;
   gboolean needs_disable = FALSE;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
 
@@ -2500,8 +2491,8 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   /* Check if the caps change is a real format change or if only irrelevant
    * parts of the caps have changed or nothing at all.
    */
-  is_format_change |= port_def.format.video.nFrameWidth != info->width;
-  is_format_change |= port_def.format.video.nFrameHeight != info->height;
+  is_size_change = port_def.format.video.nFrameWidth != info->width
+      || port_def.format.video.nFrameHeight != info->height;
   is_format_change |= (port_def.format.video.xFramerate == 0
       && info->fps_n != 0)
       || (port_def.format.video.xFramerate !=
@@ -2514,6 +2505,22 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   needs_disable =
       gst_omx_component_get_state (self->dec,
       GST_CLOCK_TIME_NONE) != OMX_StateLoaded;
+
+  /* With adaptive playback the component handles resolution changes
+   * up to the maximum itself, the output port is reconfigured
+   * once its settings change */
+  if (needs_disable && is_size_change && !is_format_change
+      && self->adaptive_playback && info->width <= self->max_width
+      && info->height <= self->max_height) {
+    GST_DEBUG_OBJECT (self, "Resolution changed to %dx%d, not reconfiguring",
+        info->width, info->height);
+    if (self->input_state)
+      gst_video_codec_state_unref (self->input_state);
+    self->input_state = gst_video_codec_state_ref (state);
+    return TRUE;
+  }
+  is_format_change |= is_size_change;
+
   /* If the component is not in Loaded state and a real format change happens
    * we have to disable the port and re-allocate all buffers. If no real
    * format change happened we can just exit here.
@@ -2576,7 +2583,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
       if (gst_omx_port_wait_buffers_released (out_port,
               1 * GST_SECOND) != OMX_ErrorNone)
         return FALSE;
-      if (gst_omx_port_deallocate_buffers (self->dec_in_port) != OMX_ErrorNone)
+      if (gst_omx_video_dec_deallocate_input_buffers (self) != OMX_ErrorNone)
         return FALSE;
       if (gst_omx_video_dec_deallocate_output_buffers (self) != OMX_ErrorNone)
         return FALSE;
@@ -2646,6 +2653,11 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     }
   }
 
+  /* The output port is disabled or the component is in Loaded state
+   * here, as the extension requires */
+  self->adaptive_playback = IS_ADAPTIVE (self)
+      && gst_omx_video_dec_enable_adaptive_playback (self);
+
   GST_DEBUG_OBJECT (self, "Updating outport port definition");
   if (gst_omx_port_update_port_definition (self->dec_out_port,
           NULL) != OMX_ErrorNone)
@@ -2659,7 +2671,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   if (needs_disable) {
     if (gst_omx_port_set_enabled (self->dec_in_port, TRUE) != OMX_ErrorNone)
       return FALSE;
-    if (gst_omx_port_allocate_buffers (self->dec_in_port) != OMX_ErrorNone)
+    if (gst_omx_video_dec_allocate_input_buffers (self) != OMX_ErrorNone)
       return FALSE;
     if (gst_omx_port_wait_enabled (self->dec_in_port,
             5 * GST_SECOND) != OMX_ErrorNone)
@@ -2682,7 +2694,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
       return FALSE;
 
     /* Need to allocate buffers to reach Idle state */
-    if (gst_omx_port_allocate_buffers (self->dec_in_port) != OMX_ErrorNone)
+    if (gst_omx_video_dec_allocate_input_buffers (self) != OMX_ErrorNone)
       return FALSE;
 
     if (gst_omx_component_get_state (self->dec,
@@ -2702,6 +2714,11 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, FALSE);
   gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, FALSE);
 
+  /* Enough index entries for all frames the component can hold */
+  gst_omx_frame_index_reserve (&self->frame_index,
+      self->dec_in_port->port_def.nBufferCountActual +
+      self->dec_out_port->port_def.nBufferCountActual);
+
   if (gst_omx_component_get_last_error (self->dec) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (self, "Component in error state: %s (0x%08x)",
         gst_omx_component_get_last_error_string (self->dec),
@@ -2757,6 +2774,8 @@ gst_omx_video_dec_reset (GstVideoDecoder * decoder, gboolean hard)
 
   /* Start the srcpad loop again */
   self->last_upstream_ts = 0;
+  gst_omx_video_dec_clear_decode_only_frames (self);
+  self->qos_skip_gop = FALSE;
   self->eos = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
   gst_pad_start_task (GST_VIDEO_DECODER_SRC_PAD (self),
@@ -2767,6 +2786,31 @@ gst_omx_video_dec_reset (GstVideoDecoder * decoder, gboolean hard)
   return TRUE;
 }
 
+/* Returns the port buffer if buffer was acquired by upstream
+ * from our input port pool and still has its memory */
+static GstOMXBuffer *
+gst_omx_video_dec_get_in_port_pool_buffer (GstOMXVideoDec * self,
+    GstBuffer * buffer)
+{
+  GstOMXBuffer *buf;
+  GstMemory *mem;
+
+  if (!self->in_port_pool || buffer->pool != self->in_port_pool)
+    return NULL;
+
+  buf = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
+      gst_omx_buffer_data_quark);
+  if (!buf || gst_buffer_n_memory (buffer) != 1)
+    return NULL;
+
+  mem = gst_buffer_peek_memory (buffer, 0);
+  if (g_strcmp0 (mem->allocator->mem_type, GST_OMX_MEMORY_TYPE) != 0
+      || ((GstOMXMemory *) mem)->buf != buf)
+    return NULL;
+
+  return buf;
+}
+
 static GstFlowReturn
 gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame)
@@ -2779,6 +2823,7 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
   GstBuffer *codec_data = NULL;
   guint offset = 0, size;
   GstClockTime timestamp, duration;
+  gboolean in_port_pool_buffer;
   OMX_ERRORTYPE err;
 
   self = GST_OMX_VIDEO_DEC (decoder);
@@ -2796,6 +2841,22 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
     return GST_FLOW_OK;
   }
+#if GST_CHECK_VERSION(1,6,0)
+  /* Only keyframes are decoded and output in key-units trick mode */
+  if ((decoder->input_segment.flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS)
+      && !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+    GST_LOG_OBJECT (self, "Skipping non-keyframe in trick mode");
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+    return GST_FLOW_OK;
+  }
+#endif
+
+  if (gst_omx_video_dec_is_decode_only (self, frame)) {
+    GST_LOG_OBJECT (self, "Frame is outside the segment, decoding only");
+    GST_VIDEO_CODEC_FRAME_SET_DECODE_ONLY (frame);
+    g_queue_push_tail (&self->decode_only_frames,
+        gst_video_codec_frame_ref (frame));
+  }
 
   timestamp = frame->pts;
   duration = frame->duration;
@@ -2805,6 +2866,11 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     return self->downstream_flow_ret;
   }
 
+  if (gst_omx_video_dec_qos_drop (self, frame)) {
+    gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
+    return GST_FLOW_OK;
+  }
+
   if (klass->prepare_frame) {
     GstFlowReturn ret;
 
@@ -2821,83 +2887,95 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
 
   size = gst_buffer_get_size (frame->input_buffer);
   while (offset < size) {
-    /* Make sure to release the base class stream lock, otherwise
-     * _loop() can't call _finish_frame() and we might block forever
-     * because no input buffers are released */
-    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
-    acq_ret = gst_omx_port_acquire_buffer (port, &buf);
+    /* Buffers from our input port pool already contain the whole
+     * frame and are passed to the component without copying */
+    if (offset == 0 && !self->codec_data
+        && (buf =
+            gst_omx_video_dec_get_in_port_pool_buffer (self,
+                frame->input_buffer))) {
+      in_port_pool_buffer = TRUE;
+    } else {
+      in_port_pool_buffer = FALSE;
 
-    if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
-      GST_VIDEO_DECODER_STREAM_LOCK (self);
-      goto component_error;
-    } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
-      GST_VIDEO_DECODER_STREAM_LOCK (self);
-      goto flushing;
-    } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
-      /* Reallocate all buffers */
-      err = gst_omx_port_set_enabled (port, FALSE);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+      /* Make sure to release the base class stream lock, otherwise
+       * _loop() can't call _finish_frame() and we might block forever
+       * because no input buffers are released */
+      GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+      acq_ret = gst_omx_port_acquire_buffer (port, &buf);
 
-      err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
-      if (err != OMX_ErrorNone) {
+      if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
         GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
-
-      err = gst_omx_port_deallocate_buffers (port);
-      if (err != OMX_ErrorNone) {
+        goto component_error;
+      } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
         GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        goto flushing;
+      } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+        /* Reallocate all buffers */
+        err = gst_omx_port_set_enabled (port, FALSE);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_wait_enabled (port, 1 * GST_SECOND);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_set_enabled (port, TRUE);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_video_dec_deallocate_input_buffers (self);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_allocate_buffers (port);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_port_wait_enabled (port, 1 * GST_SECOND);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_wait_enabled (port, 5 * GST_SECOND);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_port_set_enabled (port, TRUE);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_mark_reconfigured (port);
-      if (err != OMX_ErrorNone) {
+        err = gst_omx_video_dec_allocate_input_buffers (self);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
+
+        err = gst_omx_port_wait_enabled (port, 5 * GST_SECOND);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
+
+        err = gst_omx_port_mark_reconfigured (port);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_DECODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
+
+        /* Now get a new buffer and fill it */
         GST_VIDEO_DECODER_STREAM_LOCK (self);
-        goto reconfigure_error;
+        continue;
       }
-
-      /* Now get a new buffer and fill it */
       GST_VIDEO_DECODER_STREAM_LOCK (self);
-      continue;
-    }
-    GST_VIDEO_DECODER_STREAM_LOCK (self);
 
-    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
+      g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
 
-    if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
-      gst_omx_port_release_buffer (port, buf);
-      goto full_buffer;
+      if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
+        gst_omx_port_release_buffer (port, buf);
+        goto full_buffer;
+      }
     }
 
     if (self->downstream_flow_ret != GST_FLOW_OK) {
-      gst_omx_port_release_buffer (port, buf);
+      if (!in_port_pool_buffer)
+        gst_omx_port_release_buffer (port, buf);
       goto flow_error;
     }
 
@@ -2938,13 +3016,20 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     /* Now handle the frame */
     GST_DEBUG_OBJECT (self, "Passing frame offset %d to the component", offset);
 
-    /* Copy the buffer content in chunks of size as requested
-     * by the port */
-    buf->omx_buf->nFilledLen =
-        MIN (size - offset, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
-    gst_buffer_extract (frame->input_buffer, offset,
-        buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-        buf->omx_buf->nFilledLen);
+    if (in_port_pool_buffer) {
+      GstMemory *mem = gst_buffer_peek_memory (frame->input_buffer, 0);
+
+      buf->omx_buf->nOffset = mem->offset;
+      buf->omx_buf->nFilledLen = mem->size;
+    } else {
+      /* Copy the buffer content in chunks of size as requested
+       * by the port */
+      buf->omx_buf->nFilledLen =
+          MIN (size - offset, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
+      gst_buffer_extract (frame->input_buffer, offset,
+          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+          buf->omx_buf->nFilledLen);
+    }
 
     if (timestamp != GST_CLOCK_TIME_NONE) {
       buf->omx_buf->nTimeStamp =
@@ -2963,20 +3048,15 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     }
 
     if (offset == 0) {
-      BufferIdentification *id = g_slice_new0 (BufferIdentification);
-
       if (GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
         buf->omx_buf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
 
-      id->timestamp = buf->omx_buf->nTimeStamp;
-      gst_video_codec_frame_set_user_data (frame, id,
-          (GDestroyNotify) buffer_identification_free);
+      gst_omx_frame_index_add (&self->frame_index, frame,
+          buf->omx_buf->nTimeStamp);
     }
 
-    /* TODO: Set flags
-     *   - OMX_BUFFERFLAG_DECODEONLY for buffers that are outside
-     *     the segment
-     */
+    if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame))
+      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_DECODEONLY;
 
     offset += buf->omx_buf->nFilledLen;
 
@@ -2985,6 +3065,19 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
 
     self->started = TRUE;
     err = gst_omx_port_release_buffer (port, buf);
+
+    /* Only keep the metadata in the frame, the pool's buffer goes
+     * back to the port once the component is done with it and not
+     * once the frame is finished */
+    if (in_port_pool_buffer) {
+      GstBuffer *input_buffer = frame->input_buffer;
+
+      frame->input_buffer =
+          gst_buffer_copy_region (input_buffer, GST_BUFFER_COPY_METADATA, 0,
+          0);
+      gst_buffer_unref (input_buffer);
+    }
+
     if (err != OMX_ErrorNone)
       goto release_error;
   }
@@ -3153,6 +3246,7 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self, gboolean is_eos)
 static gboolean
 gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
 {
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (bdec);
   GstBufferPool *pool;
   GstStructure *config;
 
@@ -3185,6 +3279,12 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
   }
 #endif
 
+  /* Otherwise the caps are set to the visible rectangle, see
+   * gst_omx_video_dec_negotiate_crop() */
+  self->crop_meta_supported =
+      gst_query_find_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE,
+      NULL);
+
   if (!GST_VIDEO_DECODER_CLASS
       (gst_omx_video_dec_parent_class)->decide_allocation (bdec, query))
     return FALSE;
@@ -3203,3 +3303,59 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
 
   return TRUE;
 }
+
+static gboolean
+gst_omx_video_dec_propose_allocation (GstVideoDecoder * bdec, GstQuery * query)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (bdec);
+  GstOMXPort *port = self->dec_in_port;
+  GstStructure *config;
+  GstCaps *caps;
+  guint n;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  /* The port buffers are allocated in set_format(), if there are
+   * none yet or they don't use the pool's memory upstream will only
+   * get the default allocation */
+  if (!caps || !self->in_port_pool || !port->buffers
+      || port->buffers->len == 0)
+    goto done;
+
+  n = port->buffers->len;
+
+  /* The port keeps using the pool's memory if this fails */
+  if (!gst_buffer_pool_is_active (self->in_port_pool)) {
+    config = gst_buffer_pool_get_config (self->in_port_pool);
+    gst_buffer_pool_config_set_params (config, caps,
+        port->port_def.nBufferSize, n, n);
+
+    if (!gst_buffer_pool_set_config (self->in_port_pool, config)) {
+      GST_INFO_OBJECT (self, "Failed to set config on input port pool");
+      goto done;
+    }
+
+    GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = TRUE;
+    /* This now wraps all the port buffers */
+    if (!gst_buffer_pool_set_active (self->in_port_pool, TRUE)) {
+      GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = FALSE;
+      GST_INFO_OBJECT (self, "Failed to activate input port pool");
+      goto done;
+    }
+    GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Proposing input port pool with %u buffers of "
+      "size %u", n, (guint) port->port_def.nBufferSize);
+  gst_query_add_allocation_pool (query, self->in_port_pool,
+      port->port_def.nBufferSize, n, n);
+
+done:
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
+  return
+      GST_VIDEO_DECODER_CLASS
+      (gst_omx_video_dec_parent_class)->propose_allocation (bdec, query);
+}
@@ -30,6 +30,7 @@
 #include <gst/video/gstvideodecoder.h>
 
 #include "gstomx.h"
+#include "gstomxframeindex.h"
 
 G_BEGIN_DECLS
 
@@ -68,6 +69,19 @@ struct _GstOMXVideoDec
 
   GstClockTime last_upstream_ts;
 
+  /* References to the frames that were passed to the component as
+   * decode-only and are not finished yet, oldest first. Protected by
+   * the stream lock */
+  GQueue decode_only_frames;
+
+  /* Input QoS, protected by the stream lock. If qos_skip_gop is
+   * TRUE all frames until the next keyframe are dropped */
+  gboolean qos_skip_gop;
+  guint64 qos_dropped, qos_dropped_gop;
+
+  /* Frames passed to the component */
+  GstOMXFrameIndex frame_index;
+
   /* Draining state */
   GMutex drain_lock;
   GCond drain_cond;
@@ -78,6 +92,29 @@ struct _GstOMXVideoDec
   gboolean eos;
 
   GstFlowReturn downstream_flow_ret;
+
+  /* TRUE if the component enabled adaptive playback, it then changes
+   * the resolution without reconfiguring the output port */
+  gboolean adaptive_playback;
+  /* Visible rectangle of the output frames, if the component
+   * reports one that is smaller than the frames. crop_cookie is the
+   * port's crop_cookie when it was read */
+  gboolean has_crop;
+  OMX_CONFIG_RECTTYPE crop;
+  gint crop_cookie;
+  /* TRUE if downstream supports the crop meta, otherwise the caps
+   * have the size of the visible rectangle if crop_in_caps is TRUE
+   * and only that is copied from the port buffers */
+  gboolean crop_meta_supported;
+  gboolean crop_in_caps;
+
+  /* properties */
+  gboolean zero_copy;
+  guint stats_interval;
+  guint copy_threads;
+  gboolean input_qos;
+  gboolean low_latency;
+  guint max_width, max_height;
 #ifdef USE_OMX_TARGET_RPI
   GstOMXComponent *egl_render;
   GstOMXPort *egl_in_port, *egl_out_port;
@@ -94,6 +131,8 @@ struct _GstOMXVideoDecClass
   gboolean (*is_format_change) (GstOMXVideoDec * self, GstOMXPort * port, GstVideoCodecState * state);
   gboolean (*set_format)       (GstOMXVideoDec * self, GstOMXPort * port, GstVideoCodecState * state);
   GstFlowReturn (*prepare_frame)   (GstOMXVideoDec * self, GstVideoCodecFrame *frame);
+  /* TRUE if no other frames depend on frame */
+  gboolean (*is_droppable)     (GstOMXVideoDec * self, GstVideoCodecFrame *frame);
 };
 
 GType gst_omx_video_dec_get_type (void);
@@ -26,6 +26,8 @@
 #include <gst/video/gstvideometa.h>
 #include <string.h>
 
+#include "gstomxbufferpool.h"
+#include "gstomxvideo.h"
 #include "gstomxvideoenc.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_video_enc_debug_category);
@@ -55,18 +57,6 @@ gst_omx_video_enc_control_rate_get_type (void)
   return qtype;
 }
 
-typedef struct _BufferIdentification BufferIdentification;
-struct _BufferIdentification
-{
-  guint64 timestamp;
-};
-
-static void
-buffer_identification_free (BufferIdentification * id)
-{
-  g_slice_free (BufferIdentification, id);
-}
-
 /* prototypes */
 static void gst_omx_video_enc_finalize (GObject * object);
 static void gst_omx_video_enc_set_property (GObject * object, guint prop_id,
@@ -90,13 +80,25 @@ static gboolean gst_omx_video_enc_reset (GstVideoEncoder * encoder,
 static GstFlowReturn gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame);
 static gboolean gst_omx_video_enc_finish (GstVideoEncoder * encoder);
+static gboolean gst_omx_video_enc_src_event (GstVideoEncoder * encoder,
+    GstEvent * event);
 static gboolean gst_omx_video_enc_propose_allocation (GstVideoEncoder * encoder,
     GstQuery * query);
+static gboolean gst_omx_video_enc_decide_allocation (GstVideoEncoder * encoder,
+    GstQuery * query);
 static GstCaps *gst_omx_video_enc_getcaps (GstVideoEncoder * encoder,
     GstCaps * filter);
 
 static GstFlowReturn gst_omx_video_enc_drain (GstOMXVideoEnc * self,
     gboolean at_eos);
+static void gst_omx_video_enc_clear_lookahead (GstOMXVideoEnc * self);
+
+static OMX_ERRORTYPE gst_omx_video_enc_deallocate_input_buffers (GstOMXVideoEnc
+    * self);
+static OMX_ERRORTYPE gst_omx_video_enc_allocate_output_buffers (GstOMXVideoEnc *
+    self);
+static OMX_ERRORTYPE gst_omx_video_enc_deallocate_output_buffers (GstOMXVideoEnc
+    * self);
 
 static GstFlowReturn gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc *
     self, GstOMXPort * port, GstOMXBuffer * buf, GstVideoCodecFrame * frame);
@@ -108,7 +110,15 @@ enum
   PROP_TARGET_BITRATE,
   PROP_QUANT_I_FRAMES,
   PROP_QUANT_P_FRAMES,
-  PROP_QUANT_B_FRAMES
+  PROP_QUANT_B_FRAMES,
+  PROP_ZERO_COPY,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_COPY_THREADS,
+  PROP_SLICE_OUTPUT,
+  PROP_ROI_DELTA_QP,
+  PROP_LOOKAHEAD,
+  PROP_KEYFRAME_PERIOD
 };
 
 /* FIXME: Better defaults */
@@ -117,6 +127,57 @@ enum
 #define GST_OMX_VIDEO_ENC_QUANT_I_FRAMES_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT (0xffffffff)
+#define GST_OMX_VIDEO_ENC_ZERO_COPY_DEFAULT (FALSE)
+#define GST_OMX_VIDEO_ENC_STATS_INTERVAL_DEFAULT (0)
+#define GST_OMX_VIDEO_ENC_COPY_THREADS_DEFAULT (1)
+#define GST_OMX_VIDEO_ENC_SLICE_OUTPUT_DEFAULT (FALSE)
+#define GST_OMX_VIDEO_ENC_ROI_DELTA_QP_DEFAULT (0)
+#define GST_OMX_VIDEO_ENC_LOOKAHEAD_DEFAULT (0)
+#define GST_OMX_VIDEO_ENC_KEYFRAME_PERIOD_DEFAULT (0)
+
+/* Output buffers downstream may keep if it doesn't say how many */
+#define GST_OMX_VIDEO_ENC_OUT_PORT_EXTRA_BUFFERS (2)
+
+/* Custom upstream event for changing the encoder configuration while
+ * running, e.g. from a network bandwidth estimator. All fields are
+ * optional and are applied together before the next frame:
+ *
+ *   "target-bitrate"       G_TYPE_UINT
+ *   "framerate"            GST_TYPE_FRACTION
+ *   "interval-intraframes" G_TYPE_UINT
+ *   "quant-i-frames"       G_TYPE_UINT
+ *   "quant-p-frames"       G_TYPE_UINT
+ *   "quant-b-frames"       G_TYPE_UINT
+ */
+#define GST_OMX_VIDEO_ENC_RECONFIGURE_EVENT "GstOMXVideoEncReconfigure"
+
+/* Look-ahead analysis. A frame starts a new scene if the mean absolute
+ * difference of its downscaled luma to the previous frame is at least
+ * SCENE_CUT_MIN_SAD and SCENE_CUT_FACTOR times the average of the
+ * following frames in the window, so that fast motion over several
+ * frames is not taken for a cut. The bitrate follows the complexity
+ * of the window relative to the long-term average within these bounds */
+#define GST_OMX_VIDEO_ENC_LOOKAHEAD_MAX (60)
+#define GST_OMX_VIDEO_ENC_SCENE_CUT_MIN_SAD (12)
+#define GST_OMX_VIDEO_ENC_SCENE_CUT_FACTOR (3)
+#define GST_OMX_VIDEO_ENC_SCENE_CUT_MIN_DISTANCE (8)
+#define GST_OMX_VIDEO_ENC_LOOKAHEAD_MIN_RATIO (0.5)
+#define GST_OMX_VIDEO_ENC_LOOKAHEAD_MAX_RATIO (2.0)
+
+typedef struct
+{
+  GstVideoCodecFrame *frame;
+  /* Mean absolute difference to the previous frame and spatial
+   * variance of the downscaled luma */
+  guint sad;
+  guint variance;
+} GstOMXVideoEncLookaheadFrame;
+
+/* Flags for pending_config */
+#define GST_OMX_VIDEO_ENC_CONFIG_BITRATE         (1 << 0)
+#define GST_OMX_VIDEO_ENC_CONFIG_FRAMERATE       (1 << 1)
+#define GST_OMX_VIDEO_ENC_CONFIG_INTRA_INTERVAL  (1 << 2)
+#define GST_OMX_VIDEO_ENC_CONFIG_QUANT           (1 << 3)
 
 /* class initialization */
 
@@ -159,20 +220,87 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
           "Quantization parameter for I-frames (0xffffffff=component default)",
           0, G_MAXUINT, GST_OMX_VIDEO_ENC_QUANT_I_FRAMES_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
-          GST_PARAM_MUTABLE_READY));
+          GST_PARAM_MUTABLE_PLAYING));
 
   g_object_class_install_property (gobject_class, PROP_QUANT_P_FRAMES,
       g_param_spec_uint ("quant-p-frames", "P-Frame Quantization",
           "Quantization parameter for P-frames (0xffffffff=component default)",
           0, G_MAXUINT, GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
-          GST_PARAM_MUTABLE_READY));
+          GST_PARAM_MUTABLE_PLAYING));
 
   g_object_class_install_property (gobject_class, PROP_QUANT_B_FRAMES,
       g_param_spec_uint ("quant-b-frames", "B-Frame Quantization",
           "Quantization parameter for B-frames (0xffffffff=component default)",
           0, G_MAXUINT, GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_ZERO_COPY,
+      g_param_spec_boolean ("zero-copy", "Zero Copy",
+          "Push the OpenMAX output buffers downstream as read-only memory. "
+          "Data is only copied if downstream holds too many buffers",
+          GST_OMX_VIDEO_ENC_ZERO_COPY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Latency and occupancy statistics of the OpenMAX ports",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics Interval",
+          "Interval in milliseconds for collecting the port statistics and "
+          "posting them as element messages (0=disabled)",
+          0, G_MAXUINT, GST_OMX_VIDEO_ENC_STATS_INTERVAL_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COPY_THREADS,
+      g_param_spec_uint ("copy-threads", "Copy Threads",
+          "Number of threads for copying frames that have a different layout "
+          "than the OpenMAX buffers (0=automatic, depending on frame size)",
+          0, GST_OMX_VIDEO_COPY_MAX_THREADS,
+          GST_OMX_VIDEO_ENC_COPY_THREADS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_SLICE_OUTPUT,
+      g_param_spec_boolean ("slice-output", "Slice Output",
+          "Let the component output every slice separately and push them "
+          "downstream before the whole frame is encoded (requires GStreamer "
+          "1.18, ignored by older versions)",
+          GST_OMX_VIDEO_ENC_SLICE_OUTPUT_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_ROI_DELTA_QP,
+      g_param_spec_int ("roi-delta-qp", "ROI Delta QP",
+          "QP delta for regions of interest of the input frames that don't "
+          "specify their own (negative=better quality, 0=ignore them). Only "
+          "used if the qp-map-extension configuration key names the "
+          "component's QP map extension",
+          -51, 51, GST_OMX_VIDEO_ENC_ROI_DELTA_QP_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_LOOKAHEAD,
+      g_param_spec_uint ("lookahead", "Look-ahead",
+          "Number of frames analysed in advance for placing keyframes at "
+          "scene cuts and adapting the bitrate to the content complexity. "
+          "Adds as many frames of latency (0=disabled)",
+          0, GST_OMX_VIDEO_ENC_LOOKAHEAD_MAX,
+          GST_OMX_VIDEO_ENC_LOOKAHEAD_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_KEYFRAME_PERIOD,
+      g_param_spec_uint64 ("keyframe-period-ns", "Keyframe Period",
+          "Force a keyframe at the first frame at or after every multiple of "
+          "this running time in nanoseconds, e.g. at segment boundaries "
+          "(0=disabled)",
+          0, G_MAXUINT64, GST_OMX_VIDEO_ENC_KEYFRAME_PERIOD_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_READY));
 
   element_class->change_state =
@@ -188,8 +316,12 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
   video_encoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_handle_frame);
   video_encoder_class->finish = GST_DEBUG_FUNCPTR (gst_omx_video_enc_finish);
+  video_encoder_class->src_event =
+      GST_DEBUG_FUNCPTR (gst_omx_video_enc_src_event);
   video_encoder_class->propose_allocation =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_propose_allocation);
+  video_encoder_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_omx_video_enc_decide_allocation);
   video_encoder_class->getcaps = GST_DEBUG_FUNCPTR (gst_omx_video_enc_getcaps);
 
   klass->cdata.type = GST_OMX_COMPONENT_TYPE_FILTER;
@@ -209,6 +341,17 @@ gst_omx_video_enc_init (GstOMXVideoEnc * self)
   self->quant_i_frames = GST_OMX_VIDEO_ENC_QUANT_I_FRAMES_DEFAULT;
   self->quant_p_frames = GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT;
   self->quant_b_frames = GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT;
+  self->zero_copy = GST_OMX_VIDEO_ENC_ZERO_COPY_DEFAULT;
+  self->stats_interval = GST_OMX_VIDEO_ENC_STATS_INTERVAL_DEFAULT;
+  self->copy_threads = GST_OMX_VIDEO_ENC_COPY_THREADS_DEFAULT;
+  self->slice_output = GST_OMX_VIDEO_ENC_SLICE_OUTPUT_DEFAULT;
+  self->roi_delta_qp = GST_OMX_VIDEO_ENC_ROI_DELTA_QP_DEFAULT;
+  self->lookahead = GST_OMX_VIDEO_ENC_LOOKAHEAD_DEFAULT;
+  self->keyframe_period = GST_OMX_VIDEO_ENC_KEYFRAME_PERIOD_DEFAULT;
+
+  g_queue_init (&self->lookahead_frames);
+
+  gst_omx_frame_index_init (&self->frame_index);
 
   g_mutex_init (&self->drain_lock);
   g_cond_init (&self->drain_cond);
@@ -221,15 +364,27 @@ gst_omx_video_enc_open (GstVideoEncoder * encoder)
   GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
   gint in_port_index, out_port_index;
 
-  self->enc =
-      gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
-      klass->cdata.component_name, klass->cdata.component_role,
-      klass->cdata.hacks);
+  if (klass->cdata.reuse_component)
+    self->enc =
+        gst_omx_component_acquire (GST_OBJECT_CAST (self),
+        klass->cdata.core_name, klass->cdata.component_name,
+        klass->cdata.component_role, klass->cdata.hacks);
+  else
+    self->enc =
+        gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
+        klass->cdata.component_name, klass->cdata.component_role,
+        klass->cdata.hacks);
   self->started = FALSE;
+  self->out_port_extra_buffers = GST_OMX_VIDEO_ENC_OUT_PORT_EXTRA_BUFFERS;
+  self->qp_map_supported = FALSE;
+  self->qp_map_active = FALSE;
 
   if (!self->enc)
     return FALSE;
 
+  gst_omx_component_set_stats_interval (self->enc,
+      self->stats_interval * GST_MSECOND);
+
   if (gst_omx_component_get_state (self->enc,
           GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
     return FALSE;
@@ -359,6 +514,11 @@ gst_omx_video_enc_open (GstVideoEncoder * encoder)
     }
   }
 
+  /* Everything set until now was applied above */
+  GST_OBJECT_LOCK (self);
+  self->pending_config = 0;
+  GST_OBJECT_UNLOCK (self);
+
   return TRUE;
 }
 
@@ -376,8 +536,8 @@ gst_omx_video_enc_shutdown (GstOMXVideoEnc * self)
       gst_omx_component_get_state (self->enc, 5 * GST_SECOND);
     }
     gst_omx_component_set_state (self->enc, OMX_StateLoaded);
-    gst_omx_port_deallocate_buffers (self->enc_in_port);
-    gst_omx_port_deallocate_buffers (self->enc_out_port);
+    gst_omx_video_enc_deallocate_input_buffers (self);
+    gst_omx_video_enc_deallocate_output_buffers (self);
     if (state > OMX_StateLoaded)
       gst_omx_component_get_state (self->enc, 5 * GST_SECOND);
   }
@@ -385,6 +545,150 @@ gst_omx_video_enc_shutdown (GstOMXVideoEnc * self)
   return TRUE;
 }
 
+/* NOTE: Must be called instead of gst_omx_port_allocate_buffers()
+ * for the input port */
+static OMX_ERRORTYPE
+gst_omx_video_enc_allocate_input_buffers (GstOMXVideoEnc * self)
+{
+  GstOMXPort *port = self->enc_in_port;
+  GstBufferPool *pool;
+  OMX_ERRORTYPE err;
+
+  g_assert (self->in_port_pool == NULL);
+
+  /* The port uses the memory of the pool that is proposed to
+   * upstream, see gst_omx_video_enc_propose_allocation() */
+  pool = gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self), self->enc, port);
+  err = gst_omx_buffer_pool_use_port_buffers (pool);
+  if (err == OMX_ErrorNone) {
+    self->in_port_pool = pool;
+    return OMX_ErrorNone;
+  }
+  gst_object_unref (pool);
+
+  GST_INFO_OBJECT (self, "Component can't use our memory for the input "
+      "port: %s (0x%08x), copying all frames", gst_omx_error_to_string (err),
+      err);
+
+  return gst_omx_port_allocate_buffers (port);
+}
+
+static OMX_ERRORTYPE
+gst_omx_video_enc_deallocate_input_buffers (GstOMXVideoEnc * self)
+{
+  OMX_ERRORTYPE err;
+
+  if (self->in_port_pool) {
+    /* Upstream might still use the pool, it gives out normal
+     * buffers from now on. Let upstream ask for a new one */
+    gst_pad_push_event (GST_VIDEO_ENCODER_SINK_PAD (self),
+        gst_event_new_reconfigure ());
+
+    /* Port buffers that upstream still holds don't need to be
+     * waited for, their memory is freed together with the pool */
+    gst_omx_buffer_pool_deactivate (self->in_port_pool);
+  }
+
+  err = gst_omx_port_deallocate_buffers (self->enc_in_port);
+
+  if (self->in_port_pool) {
+    gst_object_unref (self->in_port_pool);
+    self->in_port_pool = NULL;
+  }
+
+  return err;
+}
+
+/* NOTE: Must be called with a disabled output port and
+ * enables it */
+static OMX_ERRORTYPE
+gst_omx_video_enc_allocate_output_buffers (GstOMXVideoEnc * self)
+{
+  GstOMXPort *port = self->enc_out_port;
+  GstStructure *config;
+  GstCaps *caps;
+  OMX_ERRORTYPE err;
+  guint n;
+
+  if (self->zero_copy) {
+    OMX_PARAM_PORTDEFINITIONTYPE port_def;
+
+    /* Muxers and payloaders keep some buffers for a while,
+     * allocate enough that the component never runs out */
+    gst_omx_port_get_port_definition (port, &port_def);
+    n = port_def.nBufferCountMin + self->out_port_extra_buffers + 1;
+    if (port_def.nBufferCountActual < n) {
+      GST_DEBUG_OBJECT (self, "Growing output port from %u to %u buffers",
+          (guint) port_def.nBufferCountActual, n);
+      port_def.nBufferCountActual = n;
+      err = gst_omx_port_update_port_definition (port, &port_def);
+      if (err != OMX_ErrorNone)
+        GST_WARNING_OBJECT (self, "Failed to set buffer count: %s (0x%08x)",
+            gst_omx_error_to_string (err), err);
+    }
+  }
+
+  err = gst_omx_port_set_enabled (port, TRUE);
+  if (err != OMX_ErrorNone)
+    return err;
+
+  err = gst_omx_port_allocate_buffers (port);
+  if (err != OMX_ErrorNone)
+    return err;
+
+  caps = gst_pad_get_current_caps (GST_VIDEO_ENCODER_SRC_PAD (self));
+  if (!self->zero_copy || !caps)
+    goto done;
+
+  n = port->buffers->len;
+
+  self->out_port_pool =
+      gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self), self->enc, port);
+
+  config = gst_buffer_pool_get_config (self->out_port_pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      port->port_def.nBufferSize, n, n);
+
+  if (!gst_buffer_pool_set_config (self->out_port_pool, config)) {
+    GST_INFO_OBJECT (self, "Failed to set config on output port pool");
+    gst_object_unref (self->out_port_pool);
+    self->out_port_pool = NULL;
+    goto done;
+  }
+
+  GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
+  /* This now wraps all the port buffers */
+  if (!gst_buffer_pool_set_active (self->out_port_pool, TRUE)) {
+    GST_INFO_OBJECT (self, "Failed to activate output port pool");
+    gst_object_unref (self->out_port_pool);
+    self->out_port_pool = NULL;
+    goto done;
+  }
+  GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = FALSE;
+
+done:
+  if (!self->out_port_pool)
+    GST_DEBUG_OBJECT (self, "Copying output buffers for downstream");
+
+  if (caps)
+    gst_caps_unref (caps);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+gst_omx_video_enc_deallocate_output_buffers (GstOMXVideoEnc * self)
+{
+  if (self->out_port_pool) {
+    gst_buffer_pool_set_active (self->out_port_pool, FALSE);
+    GST_OMX_BUFFER_POOL (self->out_port_pool)->deactivated = TRUE;
+    gst_object_unref (self->out_port_pool);
+    self->out_port_pool = NULL;
+  }
+
+  return gst_omx_port_deallocate_buffers (self->enc_out_port);
+}
+
 static gboolean
 gst_omx_video_enc_close (GstVideoEncoder * encoder)
 {
@@ -398,7 +702,7 @@ gst_omx_video_enc_close (GstVideoEncoder * encoder)
   self->enc_in_port = NULL;
   self->enc_out_port = NULL;
   if (self->enc)
-    gst_omx_component_free (self->enc);
+    gst_omx_component_release (self->enc);
   self->enc = NULL;
 
   return TRUE;
@@ -409,6 +713,10 @@ gst_omx_video_enc_finalize (GObject * object)
 {
   GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (object);
 
+  gst_omx_frame_index_clear (&self->frame_index);
+  g_free (self->qp_map);
+  g_free (self->lookahead_thumb);
+
   g_mutex_clear (&self->drain_lock);
   g_cond_clear (&self->drain_cond);
 
@@ -426,31 +734,61 @@ gst_omx_video_enc_set_property (GObject * object, guint prop_id,
       self->control_rate = g_value_get_enum (value);
       break;
     case PROP_TARGET_BITRATE:
+      GST_OBJECT_LOCK (self);
       self->target_bitrate = g_value_get_uint (value);
-      if (self->enc) {
-        OMX_VIDEO_CONFIG_BITRATETYPE config;
-        OMX_ERRORTYPE err;
-
-        GST_OMX_INIT_STRUCT (&config);
-        config.nPortIndex = self->enc_out_port->index;
-        config.nEncodeBitrate = self->target_bitrate;
-        err =
-            gst_omx_component_set_config (self->enc,
-            OMX_IndexConfigVideoBitrate, &config);
-        if (err != OMX_ErrorNone)
-          GST_ERROR_OBJECT (self,
-              "Failed to set bitrate parameter: %s (0x%08x)",
-              gst_omx_error_to_string (err), err);
-      }
+      self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_BITRATE;
+      GST_OBJECT_UNLOCK (self);
       break;
     case PROP_QUANT_I_FRAMES:
+      GST_OBJECT_LOCK (self);
       self->quant_i_frames = g_value_get_uint (value);
+      self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_QUANT;
+      GST_OBJECT_UNLOCK (self);
       break;
     case PROP_QUANT_P_FRAMES:
+      GST_OBJECT_LOCK (self);
       self->quant_p_frames = g_value_get_uint (value);
+      self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_QUANT;
+      GST_OBJECT_UNLOCK (self);
       break;
     case PROP_QUANT_B_FRAMES:
+      GST_OBJECT_LOCK (self);
       self->quant_b_frames = g_value_get_uint (value);
+      self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_QUANT;
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ZERO_COPY:
+      self->zero_copy = g_value_get_boolean (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      self->stats_interval = g_value_get_uint (value);
+      if (self->enc)
+        gst_omx_component_set_stats_interval (self->enc,
+            self->stats_interval * GST_MSECOND);
+      break;
+    case PROP_COPY_THREADS:
+      self->copy_threads = g_value_get_uint (value);
+      break;
+    case PROP_SLICE_OUTPUT:
+#if GST_CHECK_VERSION(1,18,0)
+      self->slice_output = g_value_get_boolean (value);
+#else
+      /* Without gst_video_encoder_finish_subframe() the slices could
+       * only be pushed together with the last one, that has no
+       * advantage over letting the component output whole frames */
+      if (g_value_get_boolean (value))
+        GST_WARNING_OBJECT (self, "Slice output requires GStreamer 1.18, "
+            "ignoring");
+#endif
+      break;
+    case PROP_ROI_DELTA_QP:
+      self->roi_delta_qp = g_value_get_int (value);
+      break;
+    case PROP_LOOKAHEAD:
+      self->lookahead = g_value_get_uint (value);
+      break;
+    case PROP_KEYFRAME_PERIOD:
+      self->keyframe_period = g_value_get_uint64 (value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -469,16 +807,59 @@ gst_omx_video_enc_get_property (GObject * object, guint prop_id, GValue * value,
       g_value_set_enum (value, self->control_rate);
       break;
     case PROP_TARGET_BITRATE:
+      GST_OBJECT_LOCK (self);
       g_value_set_uint (value, self->target_bitrate);
+      GST_OBJECT_UNLOCK (self);
       break;
     case PROP_QUANT_I_FRAMES:
+      GST_OBJECT_LOCK (self);
       g_value_set_uint (value, self->quant_i_frames);
+      GST_OBJECT_UNLOCK (self);
       break;
     case PROP_QUANT_P_FRAMES:
+      GST_OBJECT_LOCK (self);
       g_value_set_uint (value, self->quant_p_frames);
+      GST_OBJECT_UNLOCK (self);
       break;
     case PROP_QUANT_B_FRAMES:
+      GST_OBJECT_LOCK (self);
       g_value_set_uint (value, self->quant_b_frames);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ZERO_COPY:
+      g_value_set_boolean (value, self->zero_copy);
+      break;
+    case PROP_STATS:{
+      GstStructure *stats = NULL;
+
+      if (self->enc) {
+        stats = gst_omx_component_get_stats (self->enc);
+        GST_OBJECT_LOCK (self);
+        gst_structure_set (stats, "keyframes-forced", G_TYPE_UINT64,
+            self->keyframes_forced, "keyframes-missed", G_TYPE_UINT64,
+            self->keyframes_missed, NULL);
+        GST_OBJECT_UNLOCK (self);
+      }
+      g_value_take_boxed (value, stats);
+      break;
+    }
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, self->stats_interval);
+      break;
+    case PROP_COPY_THREADS:
+      g_value_set_uint (value, self->copy_threads);
+      break;
+    case PROP_SLICE_OUTPUT:
+      g_value_set_boolean (value, self->slice_output);
+      break;
+    case PROP_ROI_DELTA_QP:
+      g_value_set_int (value, self->roi_delta_qp);
+      break;
+    case PROP_LOOKAHEAD:
+      g_value_set_uint (value, self->lookahead);
+      break;
+    case PROP_KEYFRAME_PERIOD:
+      g_value_set_uint64 (value, self->keyframe_period);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -551,98 +932,75 @@ gst_omx_video_enc_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
-#define MAX_FRAME_DIST_TICKS  (5 * OMX_TICKS_PER_SECOND)
-#define MAX_FRAME_DIST_FRAMES (100)
-
 static GstVideoCodecFrame *
 _find_nearest_frame (GstOMXVideoEnc * self, GstOMXBuffer * buf)
 {
-  GList *l, *best_l = NULL;
-  GList *finish_frames = NULL;
-  GstVideoCodecFrame *best = NULL;
-  guint64 best_timestamp = 0;
-  guint64 best_diff = G_MAXUINT64;
-  BufferIdentification *best_id = NULL;
-  GList *frames;
-
-  frames = gst_video_encoder_get_frames (GST_VIDEO_ENCODER (self));
-
-  for (l = frames; l; l = l->next) {
-    GstVideoCodecFrame *tmp = l->data;
-    BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-    guint64 timestamp, diff;
-
-    /* This happens for frames that were just added but
-     * which were not passed to the component yet. Ignore
-     * them here!
-     */
-    if (!id)
-      continue;
-
-    timestamp = id->timestamp;
-
-    if (timestamp > buf->omx_buf->nTimeStamp)
-      diff = timestamp - buf->omx_buf->nTimeStamp;
-    else
-      diff = buf->omx_buf->nTimeStamp - timestamp;
+  GstVideoCodecFrame *best;
+  GList *old_frames, *l;
 
-    if (best == NULL || diff < best_diff) {
-      best = tmp;
-      best_timestamp = timestamp;
-      best_diff = diff;
-      best_l = l;
-      best_id = id;
+  best =
+      gst_omx_frame_index_find_nearest (&self->frame_index,
+      buf->omx_buf->nTimeStamp, &old_frames);
 
-      /* For frames without timestamp we simply take the first frame */
-      if ((buf->omx_buf->nTimeStamp == 0 && timestamp == 0) || diff == 0)
-        break;
+  if (old_frames) {
+    g_warning ("Too old frames, bug in encoder -- please file a bug");
+    for (l = old_frames; l; l = l->next) {
+      gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (self), l->data);
     }
+    g_list_free (old_frames);
   }
 
-  if (best_id) {
-    for (l = frames; l && l != best_l; l = l->next) {
-      GstVideoCodecFrame *tmp = l->data;
-      BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-      guint64 diff_ticks, diff_frames;
-
-      /* This happens for frames that were just added but
-       * which were not passed to the component yet. Ignore
-       * them here!
-       */
-      if (!id)
-        continue;
-
-      if (id->timestamp > best_timestamp)
-        break;
-
-      if (id->timestamp == 0 || best_timestamp == 0)
-        diff_ticks = 0;
-      else
-        diff_ticks = best_timestamp - id->timestamp;
-      diff_frames = best->system_frame_number - tmp->system_frame_number;
+  return best;
+}
 
-      if (diff_ticks > MAX_FRAME_DIST_TICKS
-          || diff_frames > MAX_FRAME_DIST_FRAMES) {
-        finish_frames =
-            g_list_prepend (finish_frames, gst_video_codec_frame_ref (tmp));
-      }
+/* Returns a buffer of the output port pool that wraps buf, or NULL
+ * if the data has to be copied. The port buffer goes back to the
+ * component once downstream released it. If downstream keeps so
+ * many of them that the component would be left with less than it
+ * needs, copy instead to not stall encoding. The port gets more
+ * buffers the next time it is reallocated */
+static GstBuffer *
+gst_omx_video_enc_wrap_output_buffer (GstOMXVideoEnc * self,
+    GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXBufferPool *pool;
+  GstBufferPoolAcquireParams params = { 0, };
+  GstBuffer *outbuf = NULL;
+  gint i, n, n_outstanding;
+
+  if (!self->out_port_pool)
+    return NULL;
+
+  pool = GST_OMX_BUFFER_POOL (self->out_port_pool);
+
+  n_outstanding = g_atomic_int_get (&pool->n_outstanding);
+  if ((gint) port->port_def.nBufferCountActual - n_outstanding - 1 <
+      (gint) port->port_def.nBufferCountMin) {
+    if (n_outstanding + 1 > self->out_port_extra_buffers) {
+      GST_DEBUG_OBJECT (self, "Downstream holds %d output buffers, copying",
+          n_outstanding);
+      self->out_port_extra_buffers = n_outstanding + 1;
     }
+    return NULL;
   }
 
-  if (finish_frames) {
-    g_warning ("Too old frames, bug in encoder -- please file a bug");
-    for (l = finish_frames; l; l = l->next) {
-      gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (self), l->data);
-    }
+  n = port->buffers->len;
+  for (i = 0; i < n; i++) {
+    GstOMXBuffer *tmp = g_ptr_array_index (port->buffers, i);
+
+    if (tmp == buf)
+      break;
   }
+  g_assert (i != n);
 
-  if (best)
-    gst_video_codec_frame_ref (best);
+  pool->current_buffer_index = i;
+  if (gst_buffer_pool_acquire_buffer (self->out_port_pool, &outbuf,
+          &params) != GST_FLOW_OK)
+    return NULL;
 
-  g_list_foreach (frames, (GFunc) gst_video_codec_frame_unref, NULL);
-  g_list_free (frames);
+  self->out_buffer_pooled = TRUE;
 
-  return best;
+  return outbuf;
 }
 
 static GstFlowReturn
@@ -681,17 +1039,26 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
   } else if (buf->omx_buf->nFilledLen > 0) {
     GstBuffer *outbuf;
     GstMapInfo map = GST_MAP_INFO_INIT;
+    gboolean slices, last_slice;
 
     GST_DEBUG_OBJECT (self, "Handling output data");
 
-    if (buf->omx_buf->nFilledLen > 0) {
-      outbuf = gst_buffer_new_and_alloc (buf->omx_buf->nFilledLen);
+    /* With slice output every buffer without the end of frame flag
+     * only contains some slices of the frame */
+    slices = self->slice_output && frame;
+    last_slice = (buf->omx_buf->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) != 0;
 
-      gst_buffer_map (outbuf, &map, GST_MAP_WRITE);
-      memcpy (map.data,
-          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-          buf->omx_buf->nFilledLen);
-      gst_buffer_unmap (outbuf, &map);
+    if (buf->omx_buf->nFilledLen > 0) {
+      outbuf = gst_omx_video_enc_wrap_output_buffer (self, port, buf);
+      if (!outbuf) {
+        outbuf = gst_buffer_new_and_alloc (buf->omx_buf->nFilledLen);
+
+        gst_buffer_map (outbuf, &map, GST_MAP_WRITE);
+        memcpy (map.data,
+            buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+            buf->omx_buf->nFilledLen);
+        gst_buffer_unmap (outbuf, &map);
+      }
     } else {
       outbuf = gst_buffer_new ();
     }
@@ -710,14 +1077,35 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
         GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
       else
         GST_BUFFER_FLAG_UNSET (outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
-    } else {
+    } else if (!slices) {
+      /* With slice output only the first slice of a keyframe
+       * might be flagged */
       if (frame)
         GST_VIDEO_CODEC_FRAME_UNSET_SYNC_POINT (frame);
       else
         GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
     }
 
-    if (frame) {
+    if (slices) {
+      if (last_slice)
+        GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_MARKER);
+
+      frame->output_buffer = outbuf;
+      if (last_slice) {
+        flow_ret =
+            gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (self), frame);
+      } else {
+#if GST_CHECK_VERSION(1,18,0)
+        flow_ret =
+            gst_video_encoder_finish_subframe (GST_VIDEO_ENCODER (self),
+            frame);
+#else
+        /* slice-output can't be enabled before 1.18 */
+        g_assert_not_reached ();
+#endif
+        gst_video_codec_frame_unref (frame);
+      }
+    } else if (frame) {
       frame->output_buffer = outbuf;
       flow_ret =
           gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (self), frame);
@@ -732,6 +1120,45 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
   return flow_ret;
 }
 
+/* Verifies that the first output of a frame that was forced to be a
+ * keyframe has the sync frame flag and reports it otherwise, the
+ * stream is then not decodable from there as expected */
+static void
+gst_omx_video_enc_check_keyframe (GstOMXVideoEnc * self, GstOMXBuffer * buf,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
+  GstClockTime running_time;
+  guint64 missed;
+
+  /* With slice output only the first slice is checked */
+  if (frame->system_frame_number == self->keyframe_checked_frame)
+    return;
+  self->keyframe_checked_frame = frame->system_frame_number;
+
+  if ((klass->cdata.hacks & GST_OMX_HACK_SYNCFRAME_FLAG_NOT_USED)
+      || (buf->omx_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME))
+    return;
+
+  GST_OBJECT_LOCK (self);
+  missed = ++self->keyframes_missed;
+  GST_OBJECT_UNLOCK (self);
+  running_time =
+      gst_segment_to_running_time (&GST_VIDEO_ENCODER (self)->input_segment,
+      GST_FORMAT_TIME, frame->pts);
+
+  GST_WARNING_OBJECT (self, "Component did not produce the keyframe forced "
+      "at %" GST_TIME_FORMAT " (frame %u), %" G_GUINT64_FORMAT " missed",
+      GST_TIME_ARGS (running_time), frame->system_frame_number, missed);
+
+  gst_element_post_message (GST_ELEMENT_CAST (self),
+      gst_message_new_element (GST_OBJECT_CAST (self),
+          gst_structure_new ("GstOMXVideoEncKeyframeMissed",
+              "running-time", G_TYPE_UINT64, running_time,
+              "frame-number", G_TYPE_UINT, frame->system_frame_number,
+              "missed", G_TYPE_UINT64, missed, NULL)));
+}
+
 static void
 gst_omx_video_enc_loop (GstOMXVideoEnc * self)
 {
@@ -746,6 +1173,7 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
   klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
 
   acq_return = gst_omx_port_acquire_buffer (port, &buf);
+  gst_omx_component_post_stats (self->enc);
   if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
     goto component_error;
   } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
@@ -772,7 +1200,7 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
 
-      err = gst_omx_port_deallocate_buffers (port);
+      err = gst_omx_video_enc_deallocate_output_buffers (self);
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
 
@@ -808,11 +1236,7 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
     GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
 
     if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
-      err = gst_omx_port_set_enabled (port, TRUE);
-      if (err != OMX_ErrorNone)
-        goto reconfigure_error;
-
-      err = gst_omx_port_allocate_buffers (port);
+      err = gst_omx_video_enc_allocate_output_buffers (self);
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
 
@@ -853,14 +1277,24 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
   GST_VIDEO_ENCODER_STREAM_LOCK (self);
   frame = _find_nearest_frame (self, buf);
 
+  if (frame && GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)
+      && !(buf->omx_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
+      && buf->omx_buf->nFilledLen > 0)
+    gst_omx_video_enc_check_keyframe (self, buf, frame);
+
   g_assert (klass->handle_output_frame);
+  self->out_buffer_pooled = FALSE;
   flow_ret = klass->handle_output_frame (self, self->enc_out_port, buf, frame);
 
   GST_DEBUG_OBJECT (self, "Finished frame: %s", gst_flow_get_name (flow_ret));
 
-  err = gst_omx_port_release_buffer (port, buf);
-  if (err != OMX_ErrorNone)
-    goto release_error;
+  /* Otherwise it goes back to the component once downstream
+   * released it */
+  if (!self->out_buffer_pooled) {
+    err = gst_omx_port_release_buffer (port, buf);
+    if (err != OMX_ErrorNone)
+      goto release_error;
+  }
 
   self->downstream_flow_ret = flow_ret;
 
@@ -983,6 +1417,16 @@ gst_omx_video_enc_start (GstVideoEncoder * encoder)
   self->last_upstream_ts = 0;
   self->eos = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
+  self->lookahead_complexity = 0;
+  self->lookahead_bitrate = 0;
+  self->lookahead_since_cut = GST_OMX_VIDEO_ENC_SCENE_CUT_MIN_DISTANCE;
+  self->next_keyframe_rt = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_LOCK (self);
+  self->keyframes_forced = 0;
+  self->keyframes_missed = 0;
+  GST_OBJECT_UNLOCK (self);
+  self->keyframe_checked_frame = G_MAXUINT32;
+  self->gop_reset_unsupported = FALSE;
 
   return TRUE;
 }
@@ -1008,6 +1452,8 @@ gst_omx_video_enc_stop (GstVideoEncoder * encoder)
   self->started = FALSE;
   self->eos = FALSE;
 
+  gst_omx_video_enc_clear_lookahead (self);
+
   if (self->input_state)
     gst_video_codec_state_unref (self->input_state);
   self->input_state = NULL;
@@ -1068,29 +1514,21 @@ gst_omx_video_enc_get_supported_colorformats (GstOMXVideoEnc * self)
       break;
 
     if (err == OMX_ErrorNone || err == OMX_ErrorNoMore) {
-      switch (param.eColorFormat) {
-        case OMX_COLOR_FormatYUV420Planar:
-        case OMX_COLOR_FormatYUV420PackedPlanar:
-          m = g_slice_new (VideoNegotiationMap);
-          m->format = GST_VIDEO_FORMAT_I420;
-          m->type = param.eColorFormat;
-          negotiation_map = g_list_append (negotiation_map, m);
-          GST_DEBUG_OBJECT (self, "Component supports I420 (%d) at index %u",
-              param.eColorFormat, (guint) param.nIndex);
-          break;
-        case OMX_COLOR_FormatYUV420SemiPlanar:
-          m = g_slice_new (VideoNegotiationMap);
-          m->format = GST_VIDEO_FORMAT_NV12;
-          m->type = param.eColorFormat;
-          negotiation_map = g_list_append (negotiation_map, m);
-          GST_DEBUG_OBJECT (self, "Component supports NV12 (%d) at index %u",
-              param.eColorFormat, (guint) param.nIndex);
-          break;
-        default:
-          GST_DEBUG_OBJECT (self,
-              "Component supports unsupported color format %d at index %u",
-              param.eColorFormat, (guint) param.nIndex);
-          break;
+      GstVideoFormat format =
+          gst_omx_video_get_format_from_omx (param.eColorFormat);
+
+      if (format != GST_VIDEO_FORMAT_UNKNOWN) {
+        m = g_slice_new (VideoNegotiationMap);
+        m->format = format;
+        m->type = param.eColorFormat;
+        negotiation_map = g_list_append (negotiation_map, m);
+        GST_DEBUG_OBJECT (self, "Component supports %s (%d) at index %u",
+            gst_video_format_to_string (format), param.eColorFormat,
+            (guint) param.nIndex);
+      } else {
+        GST_DEBUG_OBJECT (self,
+            "Component supports unsupported color format %d at index %u",
+            param.eColorFormat, (guint) param.nIndex);
       }
     }
     old_index = param.nIndex++;
@@ -1147,9 +1585,9 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     if (gst_omx_port_wait_buffers_released (self->enc_out_port,
             1 * GST_SECOND) != OMX_ErrorNone)
       return FALSE;
-    if (gst_omx_port_deallocate_buffers (self->enc_in_port) != OMX_ErrorNone)
+    if (gst_omx_video_enc_deallocate_input_buffers (self) != OMX_ErrorNone)
       return FALSE;
-    if (gst_omx_port_deallocate_buffers (self->enc_out_port) != OMX_ErrorNone)
+    if (gst_omx_video_enc_deallocate_output_buffers (self) != OMX_ErrorNone)
       return FALSE;
     if (gst_omx_port_wait_enabled (self->enc_in_port,
             1 * GST_SECOND) != OMX_ErrorNone)
@@ -1164,18 +1602,12 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
   negotiation_map = gst_omx_video_enc_get_supported_colorformats (self);
   if (!negotiation_map) {
     /* Fallback */
-    switch (info->finfo->format) {
-      case GST_VIDEO_FORMAT_I420:
-        port_def.format.video.eColorFormat = OMX_COLOR_FormatYUV420Planar;
-        break;
-      case GST_VIDEO_FORMAT_NV12:
-        port_def.format.video.eColorFormat = OMX_COLOR_FormatYUV420SemiPlanar;
-        break;
-      default:
-        GST_ERROR_OBJECT (self, "Unsupported format %s",
-            gst_video_format_to_string (info->finfo->format));
-        return FALSE;
-        break;
+    port_def.format.video.eColorFormat =
+        gst_omx_video_get_omx_from_format (info->finfo->format);
+    if (port_def.format.video.eColorFormat == OMX_COLOR_FormatUnused) {
+      GST_ERROR_OBJECT (self, "Unsupported format %s",
+          gst_video_format_to_string (info->finfo->format));
+      return FALSE;
     }
   } else {
     for (l = negotiation_map; l; l = l->next) {
@@ -1191,34 +1623,33 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
   }
 
   port_def.format.video.nFrameWidth = info->width;
-  if (port_def.nBufferAlignment)
+  if (port_def.nBufferAlignment) {
+    guint row_size =
+        GST_VIDEO_INFO_COMP_WIDTH (info, 0) * GST_VIDEO_INFO_COMP_PSTRIDE (info,
+        0);
+
     port_def.format.video.nStride =
-        (info->width + port_def.nBufferAlignment - 1) &
+        (row_size + port_def.nBufferAlignment - 1) &
         (~(port_def.nBufferAlignment - 1));
-  else
-    port_def.format.video.nStride = GST_ROUND_UP_4 (info->width);       /* safe (?) default */
+  } else {
+    port_def.format.video.nStride = GST_VIDEO_INFO_PLANE_STRIDE (info, 0);      /* safe (?) default */
+  }
 
   port_def.format.video.nFrameHeight = info->height;
   port_def.format.video.nSliceHeight = info->height;
 
-  switch (port_def.format.video.eColorFormat) {
-    case OMX_COLOR_FormatYUV420Planar:
-    case OMX_COLOR_FormatYUV420PackedPlanar:
-      port_def.nBufferSize =
-          (port_def.format.video.nStride * port_def.format.video.nFrameHeight) +
-          2 * ((port_def.format.video.nStride / 2) *
-          ((port_def.format.video.nFrameHeight + 1) / 2));
-      break;
-
-    case OMX_COLOR_FormatYUV420SemiPlanar:
-      port_def.nBufferSize =
-          (port_def.format.video.nStride * port_def.format.video.nFrameHeight) +
-          (port_def.format.video.nStride *
-          ((port_def.format.video.nFrameHeight + 1) / 2));
-      break;
-
-    default:
-      g_assert_not_reached ();
+  {
+    gsize offset[GST_VIDEO_MAX_PLANES];
+    gint stride[GST_VIDEO_MAX_PLANES];
+    gsize size;
+
+    if (!gst_omx_video_get_plane_layout (&port_def, info, offset, stride,
+            &size)) {
+      GST_ERROR_OBJECT (self, "Unsupported format %s",
+          gst_video_format_to_string (info->finfo->format));
+      return FALSE;
+    }
+    port_def.nBufferSize = size;
   }
 
   if (info->fps_n == 0) {
@@ -1235,6 +1666,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
           &port_def) != OMX_ErrorNone)
     return FALSE;
 
+  self->qp_map_supported = FALSE;
   if (klass->set_format) {
     if (!klass->set_format (self, self->enc_in_port, state)) {
       GST_ERROR_OBJECT (self, "Subclass failed to set the new format");
@@ -1266,7 +1698,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
   if (needs_disable) {
     if (gst_omx_port_set_enabled (self->enc_in_port, TRUE) != OMX_ErrorNone)
       return FALSE;
-    if (gst_omx_port_allocate_buffers (self->enc_in_port) != OMX_ErrorNone)
+    if (gst_omx_video_enc_allocate_input_buffers (self) != OMX_ErrorNone)
       return FALSE;
     if (gst_omx_port_wait_enabled (self->enc_in_port,
             5 * GST_SECOND) != OMX_ErrorNone)
@@ -1286,7 +1718,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
       return FALSE;
 
     /* Need to allocate buffers to reach Idle state */
-    if (gst_omx_port_allocate_buffers (self->enc_in_port) != OMX_ErrorNone)
+    if (gst_omx_video_enc_allocate_input_buffers (self) != OMX_ErrorNone)
       return FALSE;
 
     if (gst_omx_component_get_state (self->enc,
@@ -1306,6 +1738,11 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
   gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, FALSE);
   gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, FALSE);
 
+  /* Enough index entries for all frames the component can hold */
+  gst_omx_frame_index_reserve (&self->frame_index,
+      self->enc_in_port->port_def.nBufferCountActual +
+      self->enc_out_port->port_def.nBufferCountActual);
+
   if (gst_omx_component_get_last_error (self->enc) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (self, "Component in error state: %s (0x%08x)",
         gst_omx_component_get_last_error_string (self->enc),
@@ -1317,6 +1754,13 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     gst_video_codec_state_unref (self->input_state);
   self->input_state = gst_video_codec_state_ref (state);
 
+  if (self->lookahead > 0 && info->fps_n > 0) {
+    GstClockTime latency = gst_util_uint64_scale (self->lookahead,
+        info->fps_d * GST_SECOND, info->fps_n);
+
+    gst_video_encoder_set_latency (encoder, latency, latency);
+  }
+
   /* Start the srcpad loop again */
   GST_DEBUG_OBJECT (self, "Starting task again");
   self->downstream_flow_ret = GST_FLOW_OK;
@@ -1335,6 +1779,9 @@ gst_omx_video_enc_reset (GstVideoEncoder * encoder, gboolean hard)
 
   GST_DEBUG_OBJECT (self, "Resetting encoder");
 
+  gst_omx_video_enc_clear_lookahead (self);
+  self->next_keyframe_rt = GST_CLOCK_TIME_NONE;
+
   gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
   gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
 
@@ -1369,6 +1816,7 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
   OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->enc_in_port->port_def;
   gboolean ret = FALSE;
   GstVideoFrame frame;
+  gsize filled;
 
   if (info->width != port_def->format.video.nFrameWidth ||
       info->height != port_def->format.video.nFrameHeight) {
@@ -1376,264 +1824,480 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
     goto done;
   }
 
-  /* Same strides and everything */
-  if (gst_buffer_get_size (inbuf) ==
-      outbuf->omx_buf->nAllocLen - outbuf->omx_buf->nOffset) {
-    outbuf->omx_buf->nFilledLen = gst_buffer_get_size (inbuf);
-
-    gst_buffer_extract (inbuf, 0,
-        outbuf->omx_buf->pBuffer + outbuf->omx_buf->nOffset,
-        outbuf->omx_buf->nFilledLen);
-    ret = TRUE;
+  /* Planes with the same strides are copied at once, and all of
+   * them are split between the copy threads */
+  if (!gst_video_frame_map (&frame, info, inbuf, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (self, "Invalid input buffer size");
     goto done;
   }
 
-  /* Different strides */
-
-  switch (info->finfo->format) {
-    case GST_VIDEO_FORMAT_I420:{
-      gint i, j, height, width;
-      guint8 *src, *dest;
-      gint src_stride, dest_stride;
-
-      outbuf->omx_buf->nFilledLen = 0;
-
-      if (!gst_video_frame_map (&frame, info, inbuf, GST_MAP_READ)) {
-        GST_ERROR_OBJECT (self, "Invalid input buffer size");
-        ret = FALSE;
-        break;
-      }
-
-      for (i = 0; i < 3; i++) {
-        if (i == 0) {
-          dest_stride = port_def->format.video.nStride;
-          src_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, 0);
-
-          /* XXX: Try this if no stride was set */
-          if (dest_stride == 0)
-            dest_stride = src_stride;
-        } else {
-          dest_stride = port_def->format.video.nStride / 2;
-          src_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, 1);
-
-          /* XXX: Try this if no stride was set */
-          if (dest_stride == 0)
-            dest_stride = src_stride;
-        }
-
-        dest = outbuf->omx_buf->pBuffer + outbuf->omx_buf->nOffset;
-        if (i > 0)
-          dest +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
-        if (i == 2)
-          dest +=
-              (port_def->format.video.nSliceHeight / 2) *
-              (port_def->format.video.nStride / 2);
-
-        src = GST_VIDEO_FRAME_COMP_DATA (&frame, i);
-        height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, i);
-        width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, i);
-
-        if (dest + dest_stride * height >
-            outbuf->omx_buf->pBuffer + outbuf->omx_buf->nAllocLen) {
-          gst_video_frame_unmap (&frame);
-          GST_ERROR_OBJECT (self, "Invalid output buffer size");
-          ret = FALSE;
-          break;
-        }
-
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
-      }
-      gst_video_frame_unmap (&frame);
-      ret = TRUE;
-      break;
-    }
-    case GST_VIDEO_FORMAT_NV12:{
-      gint i, j, height, width;
-      guint8 *src, *dest;
-      gint src_stride, dest_stride;
+  ret = gst_omx_video_copy_frame (port_def, &frame,
+      outbuf->omx_buf->pBuffer + outbuf->omx_buf->nOffset,
+      outbuf->omx_buf->nAllocLen - outbuf->omx_buf->nOffset, TRUE,
+      self->copy_threads, &filled);
+  gst_video_frame_unmap (&frame);
 
-      outbuf->omx_buf->nFilledLen = 0;
+  if (ret)
+    outbuf->omx_buf->nFilledLen = filled;
+  else
+    GST_ERROR_OBJECT (self, "Unsupported format %s or invalid output buffer "
+        "size", gst_video_format_to_string (info->finfo->format));
 
-      if (!gst_video_frame_map (&frame, info, inbuf, GST_MAP_READ)) {
-        GST_ERROR_OBJECT (self, "Invalid input buffer size");
-        ret = FALSE;
-        break;
-      }
+done:
 
-      for (i = 0; i < 2; i++) {
-        if (i == 0) {
-          dest_stride = port_def->format.video.nStride;
-          src_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, 0);
-          /* XXX: Try this if no stride was set */
-          if (dest_stride == 0)
-            dest_stride = src_stride;
-        } else {
-          dest_stride = port_def->format.video.nStride;
-          src_stride = GST_VIDEO_FRAME_COMP_STRIDE (&frame, 1);
-
-          /* XXX: Try this if no stride was set */
-          if (dest_stride == 0)
-            dest_stride = src_stride;
-        }
+  gst_video_codec_state_unref (state);
 
-        dest = outbuf->omx_buf->pBuffer + outbuf->omx_buf->nOffset;
-        if (i == 1)
-          dest +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
-
-        src = GST_VIDEO_FRAME_COMP_DATA (&frame, i);
-        height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, i);
-        width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, i) * (i == 0 ? 1 : 2);
-
-        if (dest + dest_stride * height >
-            outbuf->omx_buf->pBuffer + outbuf->omx_buf->nAllocLen) {
-          gst_video_frame_unmap (&frame);
-          GST_ERROR_OBJECT (self, "Invalid output buffer size");
-          ret = FALSE;
-          break;
-        }
+  return ret;
+}
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
+/* Returns the port buffer if buffer was acquired by upstream
+ * from our input port pool and still has its memory */
+static GstOMXBuffer *
+gst_omx_video_enc_get_in_port_pool_buffer (GstOMXVideoEnc * self,
+    GstBuffer * buffer)
+{
+  GstOMXBuffer *buf;
+  GstMemory *mem;
 
-      }
-      gst_video_frame_unmap (&frame);
-      ret = TRUE;
-      break;
-    }
-    default:
-      GST_ERROR_OBJECT (self, "Unsupported format");
-      goto done;
-      break;
-  }
+  if (!self->in_port_pool || buffer->pool != self->in_port_pool)
+    return NULL;
 
-done:
+  buf = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
+      gst_omx_buffer_data_quark);
+  if (!buf || gst_buffer_n_memory (buffer) != 1)
+    return NULL;
 
-  gst_video_codec_state_unref (state);
+  mem = gst_buffer_peek_memory (buffer, 0);
+  if (g_strcmp0 (mem->allocator->mem_type, GST_OMX_MEMORY_TYPE) != 0
+      || ((GstOMXMemory *) mem)->buf != buf)
+    return NULL;
 
-  return ret;
+  return buf;
 }
 
-static GstFlowReturn
-gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
-    GstVideoCodecFrame * frame)
+/* Applies all configuration changes that were queued since the last
+ * frame at once, so that no frame is encoded with only part of them.
+ * Failures are not fatal, the component keeps its previous settings */
+static void
+gst_omx_video_enc_apply_pending_config (GstOMXVideoEnc * self)
 {
-  GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
-  GstOMXVideoEnc *self;
-  GstOMXPort *port;
-  GstOMXBuffer *buf;
+  GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
+  guint pending;
+  guint32 bitrate, quant_i, quant_p, quant_b, intra_interval;
+  gint fps_n, fps_d;
   OMX_ERRORTYPE err;
 
-  self = GST_OMX_VIDEO_ENC (encoder);
+  GST_OBJECT_LOCK (self);
+  pending = self->pending_config;
+  self->pending_config = 0;
+  bitrate = self->target_bitrate;
+  fps_n = self->pending_fps_n;
+  fps_d = self->pending_fps_d;
+  intra_interval = self->pending_intra_interval;
+  quant_i = self->quant_i_frames;
+  quant_p = self->quant_p_frames;
+  quant_b = self->quant_b_frames;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!pending)
+    return;
 
-  GST_DEBUG_OBJECT (self, "Handling frame");
+  GST_DEBUG_OBJECT (self, "Applying configuration changes 0x%x", pending);
 
-  if (self->eos) {
-    GST_WARNING_OBJECT (self, "Got frame after EOS");
-    gst_video_codec_frame_unref (frame);
-    return GST_FLOW_EOS;
-  }
+  if ((pending & GST_OMX_VIDEO_ENC_CONFIG_BITRATE) && bitrate != 0xffffffff) {
+    OMX_VIDEO_CONFIG_BITRATETYPE config;
 
-  if (self->downstream_flow_ret != GST_FLOW_OK) {
-    gst_video_codec_frame_unref (frame);
+    GST_OMX_INIT_STRUCT (&config);
+    config.nPortIndex = self->enc_out_port->index;
+    config.nEncodeBitrate = bitrate;
+    err =
+        gst_omx_component_set_config (self->enc,
+        OMX_IndexConfigVideoBitrate, &config);
+    if (err != OMX_ErrorNone)
+      GST_ERROR_OBJECT (self, "Failed to set bitrate parameter: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+    /* The look-ahead adapts the new bitrate again */
+    self->lookahead_bitrate = bitrate;
+  }
+
+  if ((pending & GST_OMX_VIDEO_ENC_CONFIG_FRAMERATE) && fps_n > 0
+      && fps_d > 0) {
+    OMX_CONFIG_FRAMERATETYPE config;
+
+    GST_OMX_INIT_STRUCT (&config);
+    config.nPortIndex = self->enc_out_port->index;
+    if (!(klass->cdata.hacks & GST_OMX_HACK_VIDEO_FRAMERATE_INTEGER))
+      config.xEncodeFramerate = gst_util_uint64_scale (fps_n, 1 << 16, fps_d);
+    else
+      config.xEncodeFramerate = fps_n / fps_d;
+    err =
+        gst_omx_component_set_config (self->enc,
+        OMX_IndexConfigVideoFramerate, &config);
+    if (err != OMX_ErrorNone)
+      GST_ERROR_OBJECT (self, "Failed to set framerate: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+  }
+
+  if (pending & GST_OMX_VIDEO_ENC_CONFIG_INTRA_INTERVAL) {
+    OMX_VIDEO_CONFIG_AVCINTRAPERIOD config;
+
+    GST_OMX_INIT_STRUCT (&config);
+    config.nPortIndex = self->enc_out_port->index;
+    err =
+        gst_omx_component_get_config (self->enc,
+        OMX_IndexConfigVideoAVCIntraPeriod, &config);
+    if (err == OMX_ErrorNone) {
+      config.nPFrames = intra_interval;
+      err =
+          gst_omx_component_set_config (self->enc,
+          OMX_IndexConfigVideoAVCIntraPeriod, &config);
+    }
+    if (err == OMX_ErrorUnsupportedIndex)
+      GST_WARNING_OBJECT (self,
+          "Changing the intra frame interval not supported by the component");
+    else if (err != OMX_ErrorNone)
+      GST_ERROR_OBJECT (self,
+          "Failed to set intra frame interval: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+  }
+
+  if (pending & GST_OMX_VIDEO_ENC_CONFIG_QUANT) {
+    OMX_VIDEO_PARAM_QUANTIZATIONTYPE quant_param;
+
+    /* There is no config for this, but many components accept
+     * the parameter while executing */
+    GST_OMX_INIT_STRUCT (&quant_param);
+    quant_param.nPortIndex = self->enc_out_port->index;
+    err =
+        gst_omx_component_get_parameter (self->enc,
+        OMX_IndexParamVideoQuantization, &quant_param);
+    if (err == OMX_ErrorNone) {
+      if (quant_i != 0xffffffff)
+        quant_param.nQpI = quant_i;
+      if (quant_p != 0xffffffff)
+        quant_param.nQpP = quant_p;
+      if (quant_b != 0xffffffff)
+        quant_param.nQpB = quant_b;
+
+      err =
+          gst_omx_component_set_parameter (self->enc,
+          OMX_IndexParamVideoQuantization, &quant_param);
+    }
+    if (err == OMX_ErrorUnsupportedIndex
+        || err == OMX_ErrorIncorrectStateOperation)
+      GST_WARNING_OBJECT (self,
+          "Changing quantization parameters not supported by the component");
+    else if (err != OMX_ErrorNone)
+      GST_ERROR_OBJECT (self,
+          "Failed to set quantization parameters: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+  }
+}
+
+#if GST_CHECK_VERSION(1,2,0)
+/* Fills the macroblocks covered by roi with its QP delta. A region can
+ * carry its own delta in an "omx/roi" parameter with an int "delta-qp"
+ * field, or a delta per macroblock of the region in an "omx/qp-map"
+ * parameter with a "map" buffer of one gint8 per macroblock in raster
+ * order. Returns TRUE if any delta was set */
+static gboolean
+gst_omx_video_enc_fill_qp_map (GstOMXVideoEnc * self,
+    GstVideoRegionOfInterestMeta * roi, guint mb_width, guint mb_height)
+{
+  GstBuffer *map_buffer = NULL;
+  GstMapInfo map = GST_MAP_INFO_INIT;
+  gint delta_qp = self->roi_delta_qp;
+  guint x0, y0, x1, y1, x, y;
+  gboolean active = FALSE;
+
+#if GST_CHECK_VERSION(1,14,0)
+  {
+    GstStructure *s;
+
+    s = gst_video_region_of_interest_meta_get_param (roi, "omx/roi");
+    if (s)
+      gst_structure_get_int (s, "delta-qp", &delta_qp);
+
+    s = gst_video_region_of_interest_meta_get_param (roi, "omx/qp-map");
+    if (s)
+      gst_structure_get (s, "map", GST_TYPE_BUFFER, &map_buffer, NULL);
+  }
+#endif
+
+  if (!map_buffer && delta_qp == 0)
+    return FALSE;
+
+  x0 = MIN (roi->x / 16, mb_width);
+  y0 = MIN (roi->y / 16, mb_height);
+  x1 = MIN ((roi->x + roi->w + 15) / 16, mb_width);
+  y1 = MIN ((roi->y + roi->h + 15) / 16, mb_height);
+
+  if (map_buffer) {
+    if (!gst_buffer_map (map_buffer, &map, GST_MAP_READ)
+        || map.size < (gsize) (x1 - x0) * (y1 - y0)) {
+      GST_WARNING_OBJECT (self, "Invalid QP map for region %ux%u at %u,%u",
+          roi->w, roi->h, roi->x, roi->y);
+      if (map.memory)
+        gst_buffer_unmap (map_buffer, &map);
+      gst_buffer_unref (map_buffer);
+      return FALSE;
+    }
+  }
+
+  delta_qp = CLAMP (delta_qp, -51, 51);
+  for (y = y0; y < y1; y++) {
+    gint8 *row = self->qp_map + y * mb_width;
+
+    for (x = x0; x < x1; x++) {
+      if (map_buffer) {
+        gint8 value = ((gint8 *) map.data)[(y - y0) * (x1 - x0) + (x - x0)];
+
+        row[x] = CLAMP (value, -51, 51);
+      } else
+        row[x] = delta_qp;
+      active |= row[x] != 0;
+    }
+  }
+
+  if (map_buffer) {
+    gst_buffer_unmap (map_buffer, &map);
+    gst_buffer_unref (map_buffer);
+  }
+
+  return active;
+}
+
+static void
+gst_omx_video_enc_clear_qp_map (GstOMXVideoEnc * self, guint size)
+{
+  if (self->qp_map_size != size) {
+    g_free (self->qp_map);
+    self->qp_map_size = size;
+    self->qp_map = g_malloc (size);
+  }
+  memset (self->qp_map, 0, size);
+}
+
+/* Translates the region of interest metas of the frame into a QP delta
+ * per macroblock and passes it to the component. Overlapping regions
+ * use the delta of the last one. Frames without regions only reset the
+ * map if the previous one was not empty */
+static void
+gst_omx_video_enc_set_roi (GstOMXVideoEnc * self, GstBuffer * buffer)
+{
+  GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
+  GstVideoInfo *info = &self->input_state->info;
+  gpointer state = NULL;
+  GstMeta *meta;
+  guint mb_width, mb_height;
+  gboolean active = FALSE, have_roi = FALSE;
+
+  mb_width = (GST_VIDEO_INFO_WIDTH (info) + 15) / 16;
+  mb_height = (GST_VIDEO_INFO_HEIGHT (info) + 15) / 16;
+
+  while ((meta = gst_buffer_iterate_meta (buffer, &state))) {
+    if (meta->info->api != GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)
+      continue;
+
+    if (!have_roi) {
+      if (!klass->set_qp_map || !self->qp_map_supported) {
+        GST_LOG_OBJECT (self, "Component does not support QP maps");
+        return;
+      }
+
+      gst_omx_video_enc_clear_qp_map (self, mb_width * mb_height);
+      have_roi = TRUE;
+    }
+
+    active |= gst_omx_video_enc_fill_qp_map (self,
+        (GstVideoRegionOfInterestMeta *) meta, mb_width, mb_height);
+  }
+
+  if (!active && !self->qp_map_active)
+    return;
+
+  if (!have_roi)
+    gst_omx_video_enc_clear_qp_map (self, mb_width * mb_height);
+
+  GST_LOG_OBJECT (self, "Setting %s QP map of %ux%u macroblocks",
+      active ? "new" : "empty", mb_width, mb_height);
+  if (!klass->set_qp_map (self, self->qp_map, mb_width, mb_height))
+    GST_WARNING_OBJECT (self, "Failed to set QP map");
+  self->qp_map_active = active;
+}
+#endif
+
+/* Forces a keyframe on the first frame at or after every multiple of
+ * keyframe-period-ns in running time. Only depending on the running
+ * time, encoders of different renditions of the same input place
+ * their keyframes on the same frames */
+static void
+gst_omx_video_enc_force_periodic_keyframe (GstOMXVideoEnc * self,
+    GstVideoCodecFrame * frame)
+{
+  GstClockTime running_time;
+
+  if (!GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return;
+
+  running_time =
+      gst_segment_to_running_time (&GST_VIDEO_ENCODER (self)->input_segment,
+      GST_FORMAT_TIME, frame->pts);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return;
+
+  if (GST_CLOCK_TIME_IS_VALID (self->next_keyframe_rt)
+      && running_time < self->next_keyframe_rt)
+    return;
+
+  GST_DEBUG_OBJECT (self, "Forcing keyframe at %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (running_time));
+  GST_VIDEO_CODEC_FRAME_SET_FORCE_KEYFRAME (frame);
+  self->next_keyframe_rt =
+      (running_time / self->keyframe_period + 1) * self->keyframe_period;
+}
+
+/* Restarts the periodic intra frames of the component from the last
+ * forced keyframe, otherwise it would add keyframes where its own
+ * period ends. There is no codec independent index for this, without
+ * the subclass' reset_gop only IntraVOPRefresh is used */
+static void
+gst_omx_video_enc_reset_gop (GstOMXVideoEnc * self)
+{
+  GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
+
+  if (!klass->reset_gop || self->gop_reset_unsupported)
+    return;
+
+  if (!klass->reset_gop (self)) {
+    GST_INFO_OBJECT (self, "Resetting the GOP not supported");
+    self->gop_reset_unsupported = TRUE;
+  }
+}
+
+static GstFlowReturn
+gst_omx_video_enc_encode_frame (GstOMXVideoEnc * self,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
+  GstOMXPort *port;
+  GstOMXBuffer *buf;
+  gboolean in_port_pool_buffer;
+  OMX_ERRORTYPE err;
+
+  GST_DEBUG_OBJECT (self, "Handling frame");
+
+  if (self->eos) {
+    GST_WARNING_OBJECT (self, "Got frame after EOS");
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_EOS;
+  }
+
+  if (self->downstream_flow_ret != GST_FLOW_OK) {
+    gst_video_codec_frame_unref (frame);
     return self->downstream_flow_ret;
   }
 
+  gst_omx_video_enc_apply_pending_config (self);
+#if GST_CHECK_VERSION(1,2,0)
+  gst_omx_video_enc_set_roi (self, frame->input_buffer);
+#endif
+
   port = self->enc_in_port;
 
   while (acq_ret != GST_OMX_ACQUIRE_BUFFER_OK) {
-    BufferIdentification *id;
     GstClockTime timestamp, duration;
 
-    /* Make sure to release the base class stream lock, otherwise
-     * _loop() can't call _finish_frame() and we might block forever
-     * because no input buffers are released */
-    GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
-    acq_ret = gst_omx_port_acquire_buffer (port, &buf);
+    /* Buffers from our input port pool already contain the raw
+     * frame in the layout of the port and are passed to the
+     * component without copying */
+    if ((buf =
+            gst_omx_video_enc_get_in_port_pool_buffer (self,
+                frame->input_buffer))) {
+      in_port_pool_buffer = TRUE;
+      acq_ret = GST_OMX_ACQUIRE_BUFFER_OK;
+    } else {
+      in_port_pool_buffer = FALSE;
 
-    if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
-      GST_VIDEO_ENCODER_STREAM_LOCK (self);
-      goto component_error;
-    } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
-      GST_VIDEO_ENCODER_STREAM_LOCK (self);
-      goto flushing;
-    } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
-      /* Reallocate all buffers */
-      err = gst_omx_port_set_enabled (port, FALSE);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+      /* Make sure to release the base class stream lock, otherwise
+       * _loop() can't call _finish_frame() and we might block forever
+       * because no input buffers are released */
+      GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
+      acq_ret = gst_omx_port_acquire_buffer (port, &buf);
 
-      err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
-      if (err != OMX_ErrorNone) {
+      if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
         GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
-
-      err = gst_omx_port_deallocate_buffers (port);
-      if (err != OMX_ErrorNone) {
+        goto component_error;
+      } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
         GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        goto flushing;
+      } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+        /* Reallocate all buffers */
+        err = gst_omx_port_set_enabled (port, FALSE);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_wait_enabled (port, 1 * GST_SECOND);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_set_enabled (port, TRUE);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_video_enc_deallocate_input_buffers (self);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_allocate_buffers (port);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_port_wait_enabled (port, 1 * GST_SECOND);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_wait_enabled (port, 5 * GST_SECOND);
-      if (err != OMX_ErrorNone) {
-        GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        err = gst_omx_port_set_enabled (port, TRUE);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      err = gst_omx_port_mark_reconfigured (port);
-      if (err != OMX_ErrorNone) {
+        err = gst_omx_video_enc_allocate_input_buffers (self);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
+
+        err = gst_omx_port_wait_enabled (port, 5 * GST_SECOND);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
+
+        err = gst_omx_port_mark_reconfigured (port);
+        if (err != OMX_ErrorNone) {
+          GST_VIDEO_ENCODER_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
+
+        /* Now get a new buffer and fill it */
         GST_VIDEO_ENCODER_STREAM_LOCK (self);
-        goto reconfigure_error;
+        continue;
       }
-
-      /* Now get a new buffer and fill it */
       GST_VIDEO_ENCODER_STREAM_LOCK (self);
-      continue;
-    }
-    GST_VIDEO_ENCODER_STREAM_LOCK (self);
 
-    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
+      g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
 
-    if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
-      gst_omx_port_release_buffer (port, buf);
-      goto full_buffer;
+      if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
+        gst_omx_port_release_buffer (port, buf);
+        goto full_buffer;
+      }
     }
 
     if (self->downstream_flow_ret != GST_FLOW_OK) {
-      gst_omx_port_release_buffer (port, buf);
+      if (!in_port_pool_buffer)
+        gst_omx_port_release_buffer (port, buf);
       goto flow_error;
     }
 
@@ -1651,14 +2315,27 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
       err =
           gst_omx_component_set_config (self->enc,
           OMX_IndexConfigVideoIntraVOPRefresh, &config);
-      if (err != OMX_ErrorNone)
+      if (err != OMX_ErrorNone) {
         GST_ERROR_OBJECT (self, "Failed to force a keyframe: %s (0x%08x)",
             gst_omx_error_to_string (err), err);
+      } else {
+        GST_OBJECT_LOCK (self);
+        self->keyframes_forced++;
+        GST_OBJECT_UNLOCK (self);
+        if (self->keyframe_period > 0)
+          gst_omx_video_enc_reset_gop (self);
+      }
     }
 
-    /* Copy the buffer content in chunks of size as requested
-     * by the port */
-    if (!gst_omx_video_enc_fill_buffer (self, frame->input_buffer, buf)) {
+    if (in_port_pool_buffer) {
+      GstMemory *mem = gst_buffer_peek_memory (frame->input_buffer, 0);
+
+      buf->omx_buf->nOffset = mem->offset;
+      buf->omx_buf->nFilledLen = mem->size;
+    } else if (!gst_omx_video_enc_fill_buffer (self, frame->input_buffer,
+            buf)) {
+      /* Copy the buffer content in chunks of size as requested
+       * by the port */
       gst_omx_port_release_buffer (port, buf);
       goto buffer_fill_error;
     }
@@ -1678,13 +2355,24 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
       self->last_upstream_ts += duration;
     }
 
-    id = g_slice_new0 (BufferIdentification);
-    id->timestamp = buf->omx_buf->nTimeStamp;
-    gst_video_codec_frame_set_user_data (frame, id,
-        (GDestroyNotify) buffer_identification_free);
+    gst_omx_frame_index_add (&self->frame_index, frame,
+        buf->omx_buf->nTimeStamp);
 
     self->started = TRUE;
     err = gst_omx_port_release_buffer (port, buf);
+
+    /* Only keep the metadata in the frame, the pool's buffer goes
+     * back to the port once the component is done with it and not
+     * once the frame is finished */
+    if (in_port_pool_buffer) {
+      GstBuffer *input_buffer = frame->input_buffer;
+
+      frame->input_buffer =
+          gst_buffer_copy_region (input_buffer, GST_BUFFER_COPY_METADATA, 0,
+          0);
+      gst_buffer_unref (input_buffer);
+    }
+
     if (err != OMX_ErrorNone)
       goto release_error;
 
@@ -1750,6 +2438,216 @@ release_error:
   }
 }
 
+/* Downscales the luma of the frame by 8 in both directions and
+ * compares it with the one of the previous frame */
+static void
+gst_omx_video_enc_analyze_frame (GstOMXVideoEnc * self,
+    GstOMXVideoEncLookaheadFrame * lf)
+{
+  GstVideoInfo *info = &self->input_state->info;
+  GstVideoFrame vframe;
+  const guint8 *data;
+  guint stride, pstride, tw, th, x, y, n;
+  guint64 sum = 0, sum_sq = 0, sad = 0;
+  gboolean have_prev;
+
+  lf->sad = 0;
+  lf->variance = 0;
+
+  if (!GST_VIDEO_INFO_IS_YUV (info)
+      || !gst_video_frame_map (&vframe, info, lf->frame->input_buffer,
+          GST_MAP_READ))
+    return;
+
+  tw = GST_VIDEO_FRAME_COMP_WIDTH (&vframe, 0) / 8;
+  th = GST_VIDEO_FRAME_COMP_HEIGHT (&vframe, 0) / 8;
+  n = tw * th;
+  if (n == 0)
+    goto done;
+
+  have_prev = self->lookahead_thumb_size == n;
+  if (!have_prev) {
+    g_free (self->lookahead_thumb);
+    self->lookahead_thumb = g_malloc (n);
+    self->lookahead_thumb_size = n;
+  }
+
+  data = GST_VIDEO_FRAME_COMP_DATA (&vframe, 0);
+  stride = GST_VIDEO_FRAME_COMP_STRIDE (&vframe, 0);
+  pstride = GST_VIDEO_FRAME_COMP_PSTRIDE (&vframe, 0);
+
+  /* Every value is the average of 4 samples of its 8x8 block */
+  for (y = 0; y < th; y++) {
+    const guint8 *row0 = data + (8 * y + 2) * stride;
+    const guint8 *row1 = data + (8 * y + 5) * stride;
+    guint8 *thumb = self->lookahead_thumb + y * tw;
+
+    for (x = 0; x < tw; x++) {
+      guint o0 = (8 * x + 2) * pstride, o1 = (8 * x + 5) * pstride;
+      guint v = (row0[o0] + row0[o1] + row1[o0] + row1[o1] + 2) / 4;
+
+      if (have_prev)
+        sad += ABS ((gint) v - (gint) thumb[x]);
+      thumb[x] = v;
+      sum += v;
+      sum_sq += v * v;
+    }
+  }
+
+  lf->sad = sad / n;
+  lf->variance = sum_sq / n - (sum / n) * (sum / n);
+
+done:
+  gst_video_frame_unmap (&vframe);
+}
+
+static guint
+gst_omx_video_enc_lookahead_complexity (GstOMXVideoEncLookaheadFrame * lf)
+{
+  /* Temporal complexity, the spatial one for the first frames */
+  return 1 + (lf->sad ? lf->sad : lf->variance / 16);
+}
+
+/* Passes the oldest frame of the look-ahead window to the component
+ * after deciding from the whole window if it starts a new scene and
+ * which bitrate the following frames need */
+static GstFlowReturn
+gst_omx_video_enc_encode_lookahead_frame (GstOMXVideoEnc * self)
+{
+  GstOMXVideoEncLookaheadFrame *lf;
+  GstVideoCodecFrame *frame;
+  guint64 sad_sum = 0, complexity_sum;
+  guint32 target_bitrate;
+  guint n = 0;
+  GList *l;
+
+  lf = g_queue_pop_head (&self->lookahead_frames);
+  frame = lf->frame;
+
+  complexity_sum = gst_omx_video_enc_lookahead_complexity (lf);
+  for (l = self->lookahead_frames.head; l; l = l->next) {
+    GstOMXVideoEncLookaheadFrame *next = l->data;
+
+    sad_sum += next->sad;
+    complexity_sum += gst_omx_video_enc_lookahead_complexity (next);
+    n++;
+  }
+
+  self->lookahead_since_cut++;
+  if (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)) {
+    self->lookahead_since_cut = 0;
+  } else if (n > 0 && lf->sad >= GST_OMX_VIDEO_ENC_SCENE_CUT_MIN_SAD
+      && (guint64) lf->sad * n > GST_OMX_VIDEO_ENC_SCENE_CUT_FACTOR * sad_sum
+      && self->lookahead_since_cut >=
+      GST_OMX_VIDEO_ENC_SCENE_CUT_MIN_DISTANCE) {
+    GST_DEBUG_OBJECT (self, "Scene cut at frame %u (difference %u)",
+        frame->system_frame_number, lf->sad);
+    GST_VIDEO_CODEC_FRAME_SET_FORCE_KEYFRAME (frame);
+    self->lookahead_since_cut = 0;
+  }
+
+  GST_OBJECT_LOCK (self);
+  target_bitrate = self->target_bitrate;
+  GST_OBJECT_UNLOCK (self);
+
+  if (target_bitrate != 0xffffffff && n > 0) {
+    gdouble complexity = (gdouble) complexity_sum / (n + 1);
+    gdouble ratio;
+    guint32 bitrate;
+
+    if (self->lookahead_complexity == 0)
+      self->lookahead_complexity = complexity;
+    else
+      self->lookahead_complexity =
+          0.95 * self->lookahead_complexity + 0.05 * complexity;
+
+    ratio = CLAMP (complexity / self->lookahead_complexity,
+        GST_OMX_VIDEO_ENC_LOOKAHEAD_MIN_RATIO,
+        GST_OMX_VIDEO_ENC_LOOKAHEAD_MAX_RATIO);
+    bitrate = target_bitrate * ratio;
+
+    /* Don't reconfigure the component for small changes */
+    if (ABS ((gint64) bitrate - (gint64) self->lookahead_bitrate) >
+        self->lookahead_bitrate / 20) {
+      OMX_VIDEO_CONFIG_BITRATETYPE config;
+      OMX_ERRORTYPE err;
+
+      GST_LOG_OBJECT (self, "Changing bitrate to %u for complexity %.1f",
+          bitrate, complexity);
+
+      GST_OMX_INIT_STRUCT (&config);
+      config.nPortIndex = self->enc_out_port->index;
+      config.nEncodeBitrate = bitrate;
+      err =
+          gst_omx_component_set_config (self->enc,
+          OMX_IndexConfigVideoBitrate, &config);
+      if (err != OMX_ErrorNone)
+        GST_WARNING_OBJECT (self, "Failed to set bitrate: %s (0x%08x)",
+            gst_omx_error_to_string (err), err);
+      self->lookahead_bitrate = bitrate;
+    }
+  }
+
+  g_slice_free (GstOMXVideoEncLookaheadFrame, lf);
+
+  return gst_omx_video_enc_encode_frame (self, frame);
+}
+
+/* Passes all frames of the look-ahead window to the component */
+static GstFlowReturn
+gst_omx_video_enc_flush_lookahead (GstOMXVideoEnc * self)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (ret == GST_FLOW_OK && !g_queue_is_empty (&self->lookahead_frames))
+    ret = gst_omx_video_enc_encode_lookahead_frame (self);
+
+  /* Frames left after an error are released by the base class */
+  gst_omx_video_enc_clear_lookahead (self);
+
+  return ret;
+}
+
+static void
+gst_omx_video_enc_clear_lookahead (GstOMXVideoEnc * self)
+{
+  GstOMXVideoEncLookaheadFrame *lf;
+
+  while ((lf = g_queue_pop_head (&self->lookahead_frames))) {
+    gst_video_codec_frame_unref (lf->frame);
+    g_slice_free (GstOMXVideoEncLookaheadFrame, lf);
+  }
+
+  self->lookahead_thumb_size = 0;
+  self->lookahead_since_cut = GST_OMX_VIDEO_ENC_SCENE_CUT_MIN_DISTANCE;
+}
+
+static GstFlowReturn
+gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (encoder);
+  GstOMXVideoEncLookaheadFrame *lf;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (self->keyframe_period > 0)
+    gst_omx_video_enc_force_periodic_keyframe (self, frame);
+
+  if (self->lookahead == 0)
+    return gst_omx_video_enc_encode_frame (self, frame);
+
+  lf = g_slice_new (GstOMXVideoEncLookaheadFrame);
+  lf->frame = frame;
+  gst_omx_video_enc_analyze_frame (self, lf);
+  g_queue_push_tail (&self->lookahead_frames, lf);
+
+  while (ret == GST_FLOW_OK
+      && g_queue_get_length (&self->lookahead_frames) > self->lookahead)
+    ret = gst_omx_video_enc_encode_lookahead_frame (self);
+
+  return ret;
+}
+
 static GstFlowReturn
 gst_omx_video_enc_finish (GstVideoEncoder * encoder)
 {
@@ -1760,6 +2658,56 @@ gst_omx_video_enc_finish (GstVideoEncoder * encoder)
   return gst_omx_video_enc_drain (self, TRUE);
 }
 
+static gboolean
+gst_omx_video_enc_src_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (encoder);
+  const GstStructure *s;
+  guint value;
+  gint fps_n, fps_d;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_UPSTREAM
+      || !gst_event_has_name (event, GST_OMX_VIDEO_ENC_RECONFIGURE_EVENT))
+    return
+        GST_VIDEO_ENCODER_CLASS (gst_omx_video_enc_parent_class)->src_event
+        (encoder, event);
+
+  s = gst_event_get_structure (event);
+  GST_DEBUG_OBJECT (self, "Queueing reconfiguration %" GST_PTR_FORMAT, s);
+
+  GST_OBJECT_LOCK (self);
+  if (gst_structure_get_uint (s, "target-bitrate", &value)) {
+    self->target_bitrate = value;
+    self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_BITRATE;
+  }
+  if (gst_structure_get_fraction (s, "framerate", &fps_n, &fps_d)) {
+    self->pending_fps_n = fps_n;
+    self->pending_fps_d = fps_d;
+    self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_FRAMERATE;
+  }
+  if (gst_structure_get_uint (s, "interval-intraframes", &value)) {
+    self->pending_intra_interval = value;
+    self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_INTRA_INTERVAL;
+  }
+  if (gst_structure_get_uint (s, "quant-i-frames", &value)) {
+    self->quant_i_frames = value;
+    self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_QUANT;
+  }
+  if (gst_structure_get_uint (s, "quant-p-frames", &value)) {
+    self->quant_p_frames = value;
+    self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_QUANT;
+  }
+  if (gst_structure_get_uint (s, "quant-b-frames", &value)) {
+    self->quant_b_frames = value;
+    self->pending_config |= GST_OMX_VIDEO_ENC_CONFIG_QUANT;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_omx_video_enc_drain (GstOMXVideoEnc * self, gboolean at_eos)
 {
@@ -1772,6 +2720,14 @@ gst_omx_video_enc_drain (GstOMXVideoEnc * self, gboolean at_eos)
 
   klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
 
+  /* The frames of the look-ahead window have to go first */
+  if (!g_queue_is_empty (&self->lookahead_frames)) {
+    GstFlowReturn ret = gst_omx_video_enc_flush_lookahead (self);
+
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
   if (!self->started) {
     GST_DEBUG_OBJECT (self, "Component not started yet");
     return GST_FLOW_OK;
@@ -1837,13 +2793,116 @@ static gboolean
 gst_omx_video_enc_propose_allocation (GstVideoEncoder * encoder,
     GstQuery * query)
 {
+  GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (encoder);
+  GstOMXPort *port = self->enc_in_port;
+  GstStructure *config;
+  GstCaps *caps;
+  guint n;
+
   gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+#if GST_CHECK_VERSION(1,2,0)
+  if (GST_OMX_VIDEO_ENC_GET_CLASS (encoder)->set_qp_map
+      && self->qp_map_supported)
+    gst_query_add_allocation_meta (query,
+        GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE, NULL);
+#endif
+
+  gst_query_parse_allocation (query, &caps, NULL);
+
+  GST_VIDEO_ENCODER_STREAM_LOCK (self);
+
+  /* The port buffers are allocated in set_format(), if there are
+   * none yet or they don't use the pool's memory upstream will only
+   * get the default allocation */
+  if (!caps || !self->in_port_pool || !port->buffers
+      || port->buffers->len == 0)
+    goto done;
+
+  /* The look-ahead window keeps up to lookahead input buffers while
+   * the port pool only has as many buffers as the port. Upstream
+   * would block on the pool while the window waits for more frames */
+  if (self->lookahead > 0) {
+    GST_DEBUG_OBJECT (self, "Not proposing the input port pool with "
+        "look-ahead");
+    goto done;
+  }
+
+  n = port->buffers->len;
+
+  /* The port keeps using the pool's memory if this fails */
+  if (!gst_buffer_pool_is_active (self->in_port_pool)) {
+    GstVideoInfo info;
+    gsize offset[GST_VIDEO_MAX_PLANES];
+    gint stride[GST_VIDEO_MAX_PLANES];
+
+    if (!gst_video_info_from_caps (&info, caps)
+        || !gst_omx_video_get_plane_layout (&port->port_def, &info, offset,
+            stride, NULL)) {
+      GST_DEBUG_OBJECT (self, "Unknown layout for caps %" GST_PTR_FORMAT,
+          caps);
+      goto done;
+    }
+
+    /* The buffers get a video meta with the stride and slice height
+     * of the port, upstream has to write the frames in that layout */
+    config = gst_buffer_pool_get_config (self->in_port_pool);
+    gst_buffer_pool_config_set_params (config, caps,
+        port->port_def.nBufferSize, n, n);
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+    if (!gst_buffer_pool_set_config (self->in_port_pool, config)) {
+      GST_INFO_OBJECT (self, "Failed to set config on input port pool");
+      goto done;
+    }
+
+    GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = TRUE;
+    /* This now wraps all the port buffers */
+    if (!gst_buffer_pool_set_active (self->in_port_pool, TRUE)) {
+      GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = FALSE;
+      GST_INFO_OBJECT (self, "Failed to activate input port pool");
+      goto done;
+    }
+    GST_OMX_BUFFER_POOL (self->in_port_pool)->allocating = FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Proposing input port pool with %u buffers of "
+      "size %u", n, (guint) port->port_def.nBufferSize);
+  gst_query_add_allocation_pool (query, self->in_port_pool,
+      port->port_def.nBufferSize, n, n);
+
+done:
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
 
   return
       GST_VIDEO_ENCODER_CLASS
       (gst_omx_video_enc_parent_class)->propose_allocation (encoder, query);
 }
 
+/* The output port is allocated after negotiation with as many extra
+ * buffers as downstream keeps at most, see
+ * gst_omx_video_enc_allocate_output_buffers() */
+static gboolean
+gst_omx_video_enc_decide_allocation (GstVideoEncoder * encoder,
+    GstQuery * query)
+{
+  GstOMXVideoEnc *self = GST_OMX_VIDEO_ENC (encoder);
+  guint i, n, min;
+
+  n = gst_query_get_n_allocation_pools (query);
+  for (i = 0; i < n; i++) {
+    gst_query_parse_nth_allocation_pool (query, i, NULL, NULL, &min, NULL);
+    if (min > self->out_port_extra_buffers) {
+      GST_DEBUG_OBJECT (self, "Downstream keeps up to %u output buffers", min);
+      self->out_port_extra_buffers = min;
+    }
+  }
+
+  return
+      GST_VIDEO_ENCODER_CLASS
+      (gst_omx_video_enc_parent_class)->decide_allocation (encoder, query);
+}
+
 static GstCaps *
 gst_omx_video_enc_getcaps (GstVideoEncoder * encoder, GstCaps * filter)
 {
@@ -26,6 +26,7 @@
 #include <gst/video/gstvideoencoder.h>
 
 #include "gstomx.h"
+#include "gstomxframeindex.h"
 
 G_BEGIN_DECLS
 
@@ -53,6 +54,8 @@ struct _GstOMXVideoEnc
   GstOMXComponent *enc;
   GstOMXPort *enc_in_port, *enc_out_port;
 
+  GstBufferPool *in_port_pool, *out_port_pool;
+
   /* < private > */
   GstVideoCodecState *input_state;
   /* TRUE if the component is configured and saw
@@ -61,6 +64,9 @@ struct _GstOMXVideoEnc
 
   GstClockTime last_upstream_ts;
 
+  /* Frames passed to the component */
+  GstOMXFrameIndex frame_index;
+
   /* Draining state */
   GMutex drain_lock;
   GCond drain_cond;
@@ -70,13 +76,68 @@ struct _GstOMXVideoEnc
   /* TRUE if upstream is EOS */
   gboolean eos;
 
+  /* Number of output buffers downstream wants to keep at the same
+   * time, from the allocation query or as seen while encoding. The
+   * output port is allocated with that many buffers more than the
+   * component needs whenever it is (re)allocated, it never grows
+   * while encoding */
+  guint out_port_extra_buffers;
+  /* TRUE if the current output buffer was given to downstream
+   * from the output port pool and must not be released */
+  gboolean out_buffer_pooled;
+
+  /* QP delta per macroblock for the current frame, built from the
+   * region of interest metas. qp_map_active is TRUE if the last map
+   * given to the component was not all zero. qp_map_supported is set
+   * by subclasses in set_format() if set_qp_map() can be used */
+  gboolean qp_map_supported;
+  gint8 *qp_map;
+  guint qp_map_size;
+  gboolean qp_map_active;
+
+  /* Look-ahead window, protected by the stream lock. Frames are
+   * analysed when they arrive and passed to the component once
+   * the window is full */
+  GQueue lookahead_frames;
+  /* Downscaled luma of the last analysed frame */
+  guint8 *lookahead_thumb;
+  guint lookahead_thumb_size;
+  /* Long-term average complexity and the last bitrate that was
+   * set because of it */
+  gdouble lookahead_complexity;
+  guint32 lookahead_bitrate;
+  guint lookahead_since_cut;
+
+  /* Running time from which on the next keyframe is forced with
+   * keyframe-period-ns, protected by the stream lock */
+  GstClockTime next_keyframe_rt;
+  /* Forced keyframes and the ones the component did not produce,
+   * protected by the object lock. The last frame that was checked for
+   * it and if the component's GOP counter can be reset */
+  guint64 keyframes_forced, keyframes_missed;
+  guint32 keyframe_checked_frame;
+  gboolean gop_reset_unsupported;
+
   /* properties */
+  gboolean zero_copy;
+  guint stats_interval;
+  guint copy_threads;
+  gboolean slice_output;
+  gint roi_delta_qp;
+  guint lookahead;
+  guint64 keyframe_period;
   guint32 control_rate;
   guint32 target_bitrate;
   guint32 quant_i_frames;
   guint32 quant_p_frames;
   guint32 quant_b_frames;
 
+  /* Runtime configuration changes, applied before the next frame
+   * is passed to the component. Protected by the object lock */
+  guint pending_config;
+  gint pending_fps_n, pending_fps_d;
+  guint32 pending_intra_interval;
+
   GstFlowReturn downstream_flow_ret;
 };
 
@@ -89,6 +150,13 @@ struct _GstOMXVideoEncClass
   gboolean            (*set_format)          (GstOMXVideoEnc * self, GstOMXPort * port, GstVideoCodecState * state);
   GstCaps            *(*get_caps)           (GstOMXVideoEnc * self, GstOMXPort * port, GstVideoCodecState * state);
   GstFlowReturn       (*handle_output_frame) (GstOMXVideoEnc * self, GstOMXPort * port, GstOMXBuffer * buffer, GstVideoCodecFrame * frame);
+  /* Sets a QP delta per 16x16 macroblock in raster order for the next frame.
+   * There is no standard OpenMAX index for this, subclasses implement it
+   * through an extension and set qp_map_supported if the component has it */
+  gboolean            (*set_qp_map)          (GstOMXVideoEnc * self, const gint8 * map, guint mb_width, guint mb_height);
+  /* Restarts the component's periodic intra frames after a forced
+   * keyframe, with the codec specific intra period index */
+  gboolean            (*reset_gop)           (GstOMXVideoEnc * self);
 };
 
 GType gst_omx_video_enc_get_type (void);
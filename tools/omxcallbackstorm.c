@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2014, RidgeRun LLC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Callback storm microbenchmark
+ *
+ * Runs a number of encoder pipelines in parallel against the loopback
+ * core with tiny frames and no processing latency, so that the time is
+ * dominated by the EmptyBufferDone/FillBufferDone callbacks and the
+ * message passing between the component threads and the elements.
+ * Prints the callback rate and the CPU time spent per callback.
+ *
+ *   omxcallbackstorm [-p PIPELINES] [-n FRAMES] [PIPELINE-DESCRIPTION]
+ *
+ * The loopback options can be overridden with the usual OMX_LOOPBACK_*
+ * environment variables, by default every port gets 16 buffers.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/resource.h>
+#include <gst/gst.h>
+
+#define DEFAULT_PIPELINE \
+  "videotestsrc num-buffers=%u pattern=black ! " \
+  "video/x-raw,format=I420,width=64,height=64,framerate=1000/1 ! " \
+  "omxh264enc ! fakesink sync=false"
+
+/* One EmptyBufferDone and one FillBufferDone per frame */
+#define CALLBACKS_PER_FRAME 2
+
+static gint64
+get_cpu_time (void)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) < 0)
+    return 0;
+
+  return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+      G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static gboolean
+wait_pipeline (GstElement * pipeline)
+{
+  GstBus *bus;
+  GstMessage *msg;
+  gboolean ret = TRUE;
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    GError *err = NULL;
+    gchar *debug = NULL;
+
+    gst_message_parse_error (msg, &err, &debug);
+    g_printerr ("Error from %s: %s\n%s\n", GST_OBJECT_NAME (msg->src),
+        err->message, debug ? debug : "");
+    g_clear_error (&err);
+    g_free (debug);
+    ret = FALSE;
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  return ret;
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  gint n_pipelines = 4;
+  gint n_frames = 10000;
+  GOptionEntry entries[] = {
+    {"pipelines", 'p', 0, G_OPTION_ARG_INT, &n_pipelines,
+        "Number of pipelines running in parallel", "N"},
+    {"frames", 'n', 0, G_OPTION_ARG_INT, &n_frames,
+        "Number of frames per pipeline, a custom pipeline has to "
+          "produce the same number", "N"},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement **pipelines;
+  gchar *description;
+  gint64 start, cpu_start, elapsed, cpu;
+  guint64 n_callbacks;
+  gint i, ret = 0;
+
+  /* The loopback core reads its options whenever a component handle
+   * is created, so they have to be set before any pipeline is built */
+  g_setenv ("OMX_LOOPBACK_LATENCY", "0", FALSE);
+  g_setenv ("OMX_LOOPBACK_IN_BUFFERS", "16", FALSE);
+  g_setenv ("OMX_LOOPBACK_OUT_BUFFERS", "16", FALSE);
+
+  ctx = g_option_context_new ("[PIPELINE-DESCRIPTION]");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Failed to parse options: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (n_pipelines < 1 || n_frames < 1) {
+    g_printerr ("Number of pipelines and frames must be positive\n");
+    return 1;
+  }
+
+  if (argc > 1)
+    description = g_strjoinv (" ", &argv[1]);
+  else
+    description = g_strdup_printf (DEFAULT_PIPELINE, (guint) n_frames);
+
+  pipelines = g_new0 (GstElement *, n_pipelines);
+  for (i = 0; i < n_pipelines; i++) {
+    pipelines[i] = gst_parse_launch (description, &err);
+    if (!pipelines[i]) {
+      g_printerr ("Failed to create pipeline: %s\n",
+          err ? err->message : "unknown error");
+      g_clear_error (&err);
+      ret = 1;
+      goto done;
+    }
+    g_clear_error (&err);
+
+    /* Get all components allocated and idle before measuring */
+    if (gst_element_set_state (pipelines[i],
+            GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE) {
+      g_printerr ("Failed to start pipeline\n");
+      ret = 1;
+      goto done;
+    }
+  }
+
+  for (i = 0; i < n_pipelines; i++)
+    gst_element_get_state (pipelines[i], NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  start = g_get_monotonic_time ();
+  cpu_start = get_cpu_time ();
+
+  for (i = 0; i < n_pipelines; i++)
+    gst_element_set_state (pipelines[i], GST_STATE_PLAYING);
+  for (i = 0; i < n_pipelines; i++)
+    if (!wait_pipeline (pipelines[i]))
+      ret = 1;
+
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+  cpu = get_cpu_time () - cpu_start;
+
+  if (ret == 0) {
+    n_callbacks = (guint64) n_pipelines * n_frames * CALLBACKS_PER_FRAME;
+
+    g_print ("Pipelines: %d, frames: %d, time: %.3f s, cpu: %.3f s\n",
+        n_pipelines, n_frames, elapsed / (gdouble) G_USEC_PER_SEC,
+        cpu / (gdouble) G_USEC_PER_SEC);
+    g_print ("Callbacks: %" G_GUINT64_FORMAT ", %.0f/s, %.3f us cpu each\n",
+        n_callbacks, n_callbacks * (gdouble) G_USEC_PER_SEC / elapsed,
+        (gdouble) cpu / n_callbacks);
+  }
+
+done:
+  for (i = 0; i < n_pipelines; i++) {
+    if (!pipelines[i])
+      continue;
+    gst_element_set_state (pipelines[i], GST_STATE_NULL);
+    gst_object_unref (pipelines[i]);
+  }
+  g_free (pipelines);
+  g_free (description);
+
+  return ret;
+}
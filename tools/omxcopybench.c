@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2014, RidgeRun LLC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Frame copy benchmark
+ *
+ * Encodes raw frames with the loopback encoder, whose port stride is
+ * aligned to 256 bytes so that every frame takes the row by row copy
+ * into the input port. Run it once per copy kernel and compare the
+ * frame rates:
+ *
+ *   omxcopybench -k memcpy -W 1920 -H 1080
+ *   omxcopybench -k sse2 -W 1920 -H 1080
+ *   omxcopybench -k avx2 -W 1920 -H 1080
+ *
+ * The loopback encoder copies every frame once more into its output
+ * buffer, which is the same for all kernels.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+#define PIPELINE \
+  "videotestsrc num-buffers=%d pattern=black ! " \
+  "video/x-raw,format=NV12,width=%d,height=%d,framerate=30/1 ! " \
+  "omxh264enc copy-threads=%d ! fakesink sync=false"
+
+gint
+main (gint argc, gchar ** argv)
+{
+  gchar *kernel = NULL;
+  gint width = 1920, height = 1080, n_frames = 500, n_threads = 1;
+  GOptionEntry entries[] = {
+    {"kernel", 'k', 0, G_OPTION_ARG_STRING, &kernel,
+        "Copy kernel, memcpy, sse2 or avx2 (default: the one picked for "
+          "the CPU)", "NAME"},
+    {"width", 'W', 0, G_OPTION_ARG_INT, &width, "Frame width", "PIXELS"},
+    {"height", 'H', 0, G_OPTION_ARG_INT, &height, "Frame height", "PIXELS"},
+    {"frames", 'n', 0, G_OPTION_ARG_INT, &n_frames, "Number of frames", "N"},
+    {"copy-threads", 't', 0, G_OPTION_ARG_INT, &n_threads,
+        "Copy threads of the encoder (0 = automatic)", "N"},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *pipeline;
+  GstBus *bus;
+  GstMessage *msg;
+  gchar *description;
+  gint64 start, elapsed;
+  gint ret = 0;
+
+  ctx = g_option_context_new (NULL);
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Failed to parse options: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (width < 16 || height < 16 || n_frames < 1 || n_threads < 0) {
+    g_printerr ("Invalid frame size, number of frames or threads\n");
+    return 1;
+  }
+
+  /* Read by the plugin and the loopback core when they are first used */
+  if (kernel)
+    g_setenv ("GST_OMX_VIDEO_COPY", kernel, TRUE);
+  g_setenv ("OMX_LOOPBACK_LATENCY", "0", FALSE);
+  g_setenv ("OMX_LOOPBACK_STRIDE_ALIGN", "256", FALSE);
+
+  description =
+      g_strdup_printf (PIPELINE, n_frames, width, height, n_threads);
+  pipeline = gst_parse_launch (description, &err);
+  g_free (description);
+  if (!pipeline) {
+    g_printerr ("Failed to create pipeline: %s\n",
+        err ? err->message : "unknown error");
+    g_clear_error (&err);
+    return 1;
+  }
+  g_clear_error (&err);
+
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gchar *debug = NULL;
+
+    gst_message_parse_error (msg, &err, &debug);
+    g_printerr ("Error from %s: %s\n%s\n", GST_OBJECT_NAME (msg->src),
+        err->message, debug ? debug : "");
+    g_clear_error (&err);
+    g_free (debug);
+    ret = 1;
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (ret == 0)
+    g_print ("%s %dx%d NV12, %d copy threads: %d frames, %.1f fps, "
+        "%.3f ms per frame\n", kernel ? kernel : "default", width, height,
+        n_threads, n_frames, n_frames * (gdouble) G_USEC_PER_SEC / elapsed,
+        elapsed / 1000.0 / n_frames);
+
+  g_free (kernel);
+
+  return ret;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2014, RidgeRun LLC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures the latency of every frame between the source and the sink
+ * of a pipeline. The source has to be named "src" and the sink "sink",
+ * the frames are matched by their timestamps. Frames that don't arrive
+ * at the sink are counted as dropped.
+ *
+ * Sinks based on GstBaseSink with a "signal-handoffs" property, like
+ * fakesink, report every frame when it is rendered, i.e. after waiting
+ * for its running time. For other sinks only the arrival on the sink
+ * pad is measured, before synchronisation. That is the transit latency
+ * of the pipeline and not the glass-to-glass latency, which also
+ * includes the wait in the sink and the display itself.
+ *
+ *   omxlatency [-v] [PIPELINE-DESCRIPTION]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+#define DEFAULT_PIPELINE \
+  "videotestsrc name=src is-live=true num-buffers=300 ! " \
+  "video/x-raw,width=1280,height=720,framerate=30/1 ! " \
+  "x264enc tune=zerolatency ! h264parse ! " \
+  "omxh264dec low-latency=true ! fakesink name=sink sync=true"
+
+typedef struct
+{
+  GstClockTime pts;
+  gint64 time;
+} Frame;
+
+typedef struct
+{
+  GMutex lock;
+  GQueue frames;                /* Frames that left the source */
+
+  gboolean verbose;
+
+  guint64 n_frames, n_dropped;
+  gint64 sum, min, max;
+} Latency;
+
+static void
+frame_free (Frame * frame)
+{
+  g_slice_free (Frame, frame);
+}
+
+static GstPadProbeReturn
+src_probe (GstPad * pad, GstPadProbeInfo * info, Latency * latency)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  Frame *frame;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  frame = g_slice_new (Frame);
+  frame->pts = GST_BUFFER_PTS (buffer);
+  frame->time = g_get_monotonic_time ();
+
+  g_mutex_lock (&latency->lock);
+  g_queue_push_tail (&latency->frames, frame);
+  g_mutex_unlock (&latency->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+frame_done (Latency * latency, GstBuffer * buffer)
+{
+  gint64 now = g_get_monotonic_time ();
+  Frame *frame;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return;
+
+  g_mutex_lock (&latency->lock);
+  while ((frame = g_queue_peek_head (&latency->frames))
+      && frame->pts < GST_BUFFER_PTS (buffer)) {
+    g_queue_pop_head (&latency->frames);
+    frame_free (frame);
+    latency->n_dropped++;
+  }
+
+  if (frame && frame->pts == GST_BUFFER_PTS (buffer)) {
+    gint64 diff = now - frame->time;
+
+    g_queue_pop_head (&latency->frames);
+    frame_free (frame);
+
+    if (latency->n_frames == 0 || diff < latency->min)
+      latency->min = diff;
+    if (latency->n_frames == 0 || diff > latency->max)
+      latency->max = diff;
+    latency->sum += diff;
+    latency->n_frames++;
+
+    if (latency->verbose)
+      g_print ("%" GST_TIME_FORMAT ": %.3f ms\n",
+          GST_TIME_ARGS (GST_BUFFER_PTS (buffer)), diff / 1000.0);
+  }
+  g_mutex_unlock (&latency->lock);
+}
+
+/* Emitted from the sink's render function, after synchronisation */
+static void
+sink_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    Latency * latency)
+{
+  frame_done (latency, buffer);
+}
+
+static GstPadProbeReturn
+sink_probe (GstPad * pad, GstPadProbeInfo * info, Latency * latency)
+{
+  frame_done (latency, GST_PAD_PROBE_INFO_BUFFER (info));
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+add_handoff (GstElement * pipeline, const gchar * name, Latency * latency)
+{
+  GstElement *element;
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+  if (!element)
+    return FALSE;
+
+  if (!g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+          "signal-handoffs")) {
+    g_printerr ("Element '%s' has no handoff signal, measuring the transit "
+        "latency until its sink pad instead of the rendering time\n", name);
+    gst_object_unref (element);
+    return FALSE;
+  }
+
+  g_object_set (element, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (element, "handoff", G_CALLBACK (sink_handoff), latency);
+  gst_object_unref (element);
+
+  return TRUE;
+}
+
+static gboolean
+add_probe (GstElement * pipeline, const gchar * name, const gchar * pad_name,
+    GstPadProbeCallback callback, Latency * latency)
+{
+  GstElement *element;
+  GstPad *pad;
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+  if (!element) {
+    g_printerr ("No element named '%s' in the pipeline\n", name);
+    return FALSE;
+  }
+
+  pad = gst_element_get_static_pad (element, pad_name);
+  gst_object_unref (element);
+  if (!pad) {
+    g_printerr ("Element '%s' has no %s pad\n", name, pad_name);
+    return FALSE;
+  }
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, callback, latency, NULL);
+  gst_object_unref (pad);
+
+  return TRUE;
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  gboolean verbose = FALSE;
+  GOptionEntry entries[] = {
+    {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+        "Print the latency of every frame", NULL},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *pipeline;
+  GstBus *bus;
+  GstMessage *msg;
+  Latency latency = { {0}, };
+  gchar *description;
+  gboolean rendered;
+  gint ret = 0;
+
+  ctx = g_option_context_new ("[PIPELINE-DESCRIPTION]");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Failed to parse options: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (argc > 1)
+    description = g_strjoinv (" ", &argv[1]);
+  else
+    description = g_strdup (DEFAULT_PIPELINE);
+
+  pipeline = gst_parse_launch (description, &err);
+  g_free (description);
+  if (!pipeline) {
+    g_printerr ("Failed to create pipeline: %s\n",
+        err ? err->message : "unknown error");
+    g_clear_error (&err);
+    return 1;
+  }
+  g_clear_error (&err);
+
+  g_mutex_init (&latency.lock);
+  g_queue_init (&latency.frames);
+  latency.verbose = verbose;
+
+  rendered = add_handoff (pipeline, "sink", &latency);
+
+  if (!add_probe (pipeline, "src", "src", (GstPadProbeCallback) src_probe,
+          &latency)
+      || (!rendered && !add_probe (pipeline, "sink", "sink",
+              (GstPadProbeCallback) sink_probe, &latency))) {
+    gst_object_unref (pipeline);
+    return 1;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gchar *debug = NULL;
+
+    gst_message_parse_error (msg, &err, &debug);
+    g_printerr ("Error from %s: %s\n%s\n", GST_OBJECT_NAME (msg->src),
+        err->message, debug ? debug : "");
+    g_clear_error (&err);
+    g_free (debug);
+    ret = 1;
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  /* Frames still queued never arrived at the sink */
+  latency.n_dropped += g_queue_get_length (&latency.frames);
+  g_queue_foreach (&latency.frames, (GFunc) frame_free, NULL);
+
+  g_print ("Frames: %" G_GUINT64_FORMAT ", dropped: %" G_GUINT64_FORMAT "\n",
+      latency.n_frames, latency.n_dropped);
+  if (latency.n_frames > 0)
+    g_print ("%s latency: min %.3f ms, avg %.3f ms, max %.3f ms\n",
+        rendered ? "Render" : "Transit", latency.min / 1000.0,
+        latency.sum / 1000.0 / latency.n_frames, latency.max / 1000.0);
+
+  g_queue_clear (&latency.frames);
+  g_mutex_clear (&latency.lock);
+
+  return ret;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2014, RidgeRun LLC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Look-ahead allocation test
+ *
+ * Encodes frames from videotestsrc, which allocates its buffers from
+ * the pool proposed by the encoder, with look-ahead enabled and
+ * disabled. With look-ahead the encoder holds more input frames than
+ * its input port has buffers, so it must not propose the port pool.
+ * Fails if a pipeline does not finish in time or not every frame was
+ * encoded.
+ *
+ *   omxlookaheadtest [-l LOOKAHEAD] [-n FRAMES] [-t TIMEOUT]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+#define PIPELINE \
+  "videotestsrc num-buffers=%d ! " \
+  "video/x-raw,format=I420,width=320,height=240,framerate=30/1 ! " \
+  "omxh264enc name=enc lookahead=%u ! fakesink sync=false"
+
+typedef struct
+{
+  guint n_in, n_pooled, n_out;
+} Counts;
+
+static GstPadProbeReturn
+in_probe (GstPad * pad, GstPadProbeInfo * info, Counts * counts)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  counts->n_in++;
+  if (buffer->pool
+      && g_str_equal (G_OBJECT_TYPE_NAME (buffer->pool), "GstOMXBufferPool"))
+    counts->n_pooled++;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+out_probe (GstPad * pad, GstPadProbeInfo * info, Counts * counts)
+{
+  counts->n_out++;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+run (guint lookahead, gint n_frames, gint timeout)
+{
+  GstElement *pipeline, *enc;
+  GstPad *pad;
+  GstBus *bus;
+  GstMessage *msg;
+  GError *err = NULL;
+  gchar *description;
+  Counts counts = { 0, };
+  gboolean ret = TRUE;
+
+  description = g_strdup_printf (PIPELINE, n_frames, lookahead);
+  pipeline = gst_parse_launch (description, &err);
+  g_free (description);
+  if (!pipeline) {
+    g_printerr ("Failed to create pipeline: %s\n",
+        err ? err->message : "unknown error");
+    g_clear_error (&err);
+    return FALSE;
+  }
+  g_clear_error (&err);
+
+  enc = gst_bin_get_by_name (GST_BIN (pipeline), "enc");
+  pad = gst_element_get_static_pad (enc, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) in_probe, &counts, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (enc, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) out_probe, &counts, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (enc);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, timeout * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (!msg) {
+    g_printerr ("lookahead=%u: timed out after %d s with %u of %d frames "
+        "encoded\n", lookahead, timeout, counts.n_out, n_frames);
+    ret = FALSE;
+  } else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gchar *debug = NULL;
+
+    gst_message_parse_error (msg, &err, &debug);
+    g_printerr ("lookahead=%u: error from %s: %s\n%s\n", lookahead,
+        GST_OBJECT_NAME (msg->src), err->message, debug ? debug : "");
+    g_clear_error (&err);
+    g_free (debug);
+    ret = FALSE;
+  }
+  if (msg)
+    gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (ret && counts.n_out != (guint) n_frames) {
+    g_printerr ("lookahead=%u: %u of %d frames encoded\n", lookahead,
+        counts.n_out, n_frames);
+    ret = FALSE;
+  }
+
+  /* The port pool is only proposed upstream without look-ahead */
+  if (ret && lookahead == 0 && counts.n_pooled == 0) {
+    g_printerr ("lookahead=0: no frame came from the port pool\n");
+    ret = FALSE;
+  } else if (ret && lookahead > 0 && counts.n_pooled > 0) {
+    g_printerr ("lookahead=%u: %u frames came from the port pool\n",
+        lookahead, counts.n_pooled);
+    ret = FALSE;
+  }
+
+  g_print ("lookahead=%u: %s, %u frames in, %u from the port pool, %u out\n",
+      lookahead, ret ? "ok" : "FAILED", counts.n_in, counts.n_pooled,
+      counts.n_out);
+
+  return ret;
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  gint lookahead = 8, n_frames = 100, timeout = 10;
+  GOptionEntry entries[] = {
+    {"lookahead", 'l', 0, G_OPTION_ARG_INT, &lookahead,
+        "Look-ahead of the encoder", "FRAMES"},
+    {"frames", 'n', 0, G_OPTION_ARG_INT, &n_frames, "Number of frames", "N"},
+    {"timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+        "Seconds until a pipeline is considered stuck", "SECONDS"},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  gint ret = 0;
+
+  ctx = g_option_context_new (NULL);
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Failed to parse options: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (lookahead < 1 || n_frames < 1 || timeout < 1) {
+    g_printerr ("Look-ahead, number of frames and timeout must be "
+        "positive\n");
+    return 1;
+  }
+
+  g_setenv ("OMX_LOOPBACK_LATENCY", "0", FALSE);
+
+  /* Without look-ahead upstream is expected to use the port pool */
+  if (!run (0, n_frames, timeout))
+    ret = 1;
+  if (!run (lookahead, n_frames, timeout))
+    ret = 1;
+
+  return ret;
+}
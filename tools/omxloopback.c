@@ -0,0 +1,1559 @@
+/*
+ * Copyright (C) 2014, RidgeRun LLC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Loopback OpenMAX IL core
+ *
+ * Software-only IL core that provides passthrough video decoder and
+ * encoder components. Each component runs its own processing thread and
+ * simply copies the input payload into an output buffer, which allows
+ * to exercise and benchmark the plugin without any hardware.
+ *
+ * The components can be tuned with the following environment variables,
+ * which are read whenever a new component handle is created:
+ *
+ *   OMX_LOOPBACK_LATENCY                    microseconds spent per buffer
+ *   OMX_LOOPBACK_IN_BUFFERS                 input port buffer count
+ *   OMX_LOOPBACK_OUT_BUFFERS                output port buffer count
+ *   OMX_LOOPBACK_STRIDE_ALIGN               raw video stride alignment
+ *   OMX_LOOPBACK_KEYFRAME_INTERVAL          encoder sync frame interval
+ *   OMX_LOOPBACK_SETTINGS_CHANGED_INTERVAL  emit a decoder output port
+ *                                           settings change every N frames
+ *   OMX_LOOPBACK_ERROR_AFTER                signal OMX_ErrorHardware after
+ *                                           N frames
+ *
+ * A value of 0 disables the interval and error options.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#ifdef GST_OMX_STRUCT_PACKING
+# if GST_OMX_STRUCT_PACKING == 1
+#  pragma pack(1)
+# elif GST_OMX_STRUCT_PACKING == 2
+#  pragma pack(2)
+# elif GST_OMX_STRUCT_PACKING == 4
+#  pragma pack(4)
+# elif GST_OMX_STRUCT_PACKING == 8
+#  pragma pack(8)
+# else
+#  error "Unsupported struct packing value"
+# endif
+#endif
+
+#include <OMX_Core.h>
+#include <OMX_Component.h>
+
+#ifdef GST_OMX_STRUCT_PACKING
+#pragma pack()
+#endif
+
+#define LOOPBACK_INIT_STRUCT(st) G_STMT_START { \
+  memset ((st), 0, sizeof (*(st))); \
+  (st)->nSize = sizeof (*(st)); \
+  (st)->nVersion.s.nVersionMajor = OMX_VERSION_MAJOR; \
+  (st)->nVersion.s.nVersionMinor = OMX_VERSION_MINOR; \
+  (st)->nVersion.s.nRevision = OMX_VERSION_REVISION; \
+  (st)->nVersion.s.nStep = OMX_VERSION_STEP; \
+} G_STMT_END
+
+#define LOOPBACK_IN_PORT 0
+#define LOOPBACK_OUT_PORT 1
+#define LOOPBACK_N_PORTS 2
+
+#define LOOPBACK_DEFAULT_WIDTH 320
+#define LOOPBACK_DEFAULT_HEIGHT 240
+#define LOOPBACK_BITSTREAM_BUFFER_SIZE (1024 * 1024)
+
+#define LOOPBACK_ROUND_UP(x, n) ((((x) + (n) - 1) / (n)) * (n))
+
+/* QP delta per macroblock of the next input frame, as set by
+ * omxh264enc with the qp-map-extension key of the loopback
+ * gstomx.conf. The layout has to match GstOMXVideoQpMapConfig */
+#define LOOPBACK_QP_MAP_EXTENSION "OMX.gstreamer.index.config.videoQpMap"
+#define LOOPBACK_INDEX_QP_MAP (OMX_IndexVendorStartUnused + 1)
+
+typedef struct
+{
+  OMX_U32 nSize;
+  OMX_VERSIONTYPE nVersion;
+  OMX_U32 nPortIndex;
+  OMX_U32 nMbWidth;
+  OMX_U32 nMbHeight;
+  OMX_S8 *pQpDelta;
+} LoopbackQpMapConfig;
+
+typedef enum
+{
+  LOOPBACK_DECODER,
+  LOOPBACK_ENCODER
+} LoopbackKind;
+
+typedef struct
+{
+  const gchar *name;
+  LoopbackKind kind;
+  const gchar *roles[4];
+} LoopbackComponentInfo;
+
+static const LoopbackComponentInfo loopback_components[] = {
+  {"OMX.loopback.video_decoder", LOOPBACK_DECODER,
+      {"video_decoder.avc", "video_decoder.mpeg4", "video_decoder.h263", NULL}},
+  {"OMX.loopback.video_encoder", LOOPBACK_ENCODER,
+      {"video_encoder.avc", "video_encoder.mpeg4", "video_encoder.h263", NULL}},
+};
+
+typedef struct
+{
+  guint latency;
+  guint in_buffers;
+  guint out_buffers;
+  guint stride_align;
+  guint keyframe_interval;
+  guint settings_changed_interval;
+  guint error_after;
+} LoopbackOptions;
+
+typedef struct
+{
+  OMX_PARAM_PORTDEFINITIONTYPE def;
+  /* All buffer headers of this port */
+  GPtrArray *headers;
+  /* Buffers currently owned by the component */
+  GQueue queue;
+  /* TRUE while a port enable/disable command is pending */
+  gboolean enabling, disabling;
+} LoopbackPort;
+
+typedef enum
+{
+  LOOPBACK_CALLBACK_EVENT,
+  LOOPBACK_CALLBACK_EMPTY_DONE,
+  LOOPBACK_CALLBACK_FILL_DONE
+} LoopbackCallbackType;
+
+typedef struct
+{
+  LoopbackCallbackType type;
+  OMX_EVENTTYPE event;
+  OMX_U32 data1, data2;
+  OMX_BUFFERHEADERTYPE *header;
+} LoopbackCallback;
+
+typedef struct
+{
+  OMX_COMMANDTYPE cmd;
+  OMX_U32 param;
+} LoopbackCommand;
+
+typedef struct
+{
+  OMX_COMPONENTTYPE handle;
+  const LoopbackComponentInfo *info;
+  LoopbackOptions options;
+
+  OMX_CALLBACKTYPE callbacks;
+  OMX_PTR app_data;
+  gchar role[OMX_MAX_STRINGNAME_SIZE];
+
+  GMutex lock;
+  GCond cond;
+  GThread *thread;
+  gboolean running;
+
+  /* Commands not yet seen by the processing thread */
+  GQueue commands;
+
+  OMX_STATETYPE state;
+  /* OMX_StateInvalid if no state change is pending */
+  OMX_STATETYPE target_state;
+
+  LoopbackPort ports[LOOPBACK_N_PORTS];
+
+  OMX_VIDEO_PARAM_BITRATETYPE bitrate;
+  OMX_VIDEO_PARAM_QUANTIZATIONTYPE quantization;
+
+  guint64 n_frames;
+  gboolean force_keyframe;
+  /* Macroblocks with a QP delta in the last QP map */
+  guint qp_map_mbs;
+  /* TRUE after a port settings change until the output
+   * port was disabled by the client */
+  gboolean settings_changed;
+  /* TRUE after an injected error */
+  gboolean failed;
+} LoopbackComponent;
+
+#define LOOPBACK_COMPONENT(h) \
+  ((LoopbackComponent *) ((OMX_COMPONENTTYPE *) (h))->pComponentPrivate)
+
+static guint
+loopback_get_option (const gchar * name, guint default_value)
+{
+  const gchar *str;
+  gchar *end;
+  guint64 value;
+
+  str = g_getenv (name);
+  if (!str || *str == '\0')
+    return default_value;
+
+  value = g_ascii_strtoull (str, &end, 10);
+  if (*end != '\0' || value > G_MAXUINT) {
+    g_warning ("Invalid value '%s' for %s", str, name);
+    return default_value;
+  }
+
+  return value;
+}
+
+static void
+loopback_options_init (LoopbackOptions * options)
+{
+  options->latency = loopback_get_option ("OMX_LOOPBACK_LATENCY", 0);
+  options->in_buffers =
+      MAX (loopback_get_option ("OMX_LOOPBACK_IN_BUFFERS", 4), 1);
+  options->out_buffers =
+      MAX (loopback_get_option ("OMX_LOOPBACK_OUT_BUFFERS", 4), 1);
+  options->stride_align =
+      MAX (loopback_get_option ("OMX_LOOPBACK_STRIDE_ALIGN", 16), 2);
+  options->keyframe_interval =
+      loopback_get_option ("OMX_LOOPBACK_KEYFRAME_INTERVAL", 30);
+  options->settings_changed_interval =
+      loopback_get_option ("OMX_LOOPBACK_SETTINGS_CHANGED_INTERVAL", 0);
+  options->error_after = loopback_get_option ("OMX_LOOPBACK_ERROR_AFTER", 0);
+}
+
+static gboolean
+loopback_port_is_raw (LoopbackComponent * self, OMX_U32 index)
+{
+  if (self->info->kind == LOOPBACK_DECODER)
+    return index == LOOPBACK_OUT_PORT;
+  else
+    return index == LOOPBACK_IN_PORT;
+}
+
+static gboolean
+loopback_color_format_is_supported (OMX_COLOR_FORMATTYPE format)
+{
+  return format == OMX_COLOR_FormatYUV420Planar
+      || format == OMX_COLOR_FormatYUV420PackedPlanar
+      || format == OMX_COLOR_FormatYUV420SemiPlanar;
+}
+
+/* Both I420 and NV12 have the same size for a given stride
+ * and slice height, chroma planes of I420 use half the stride */
+static void
+loopback_port_update_raw_size (LoopbackComponent * self, LoopbackPort * port)
+{
+  OMX_VIDEO_PORTDEFINITIONTYPE *video = &port->def.format.video;
+  OMX_U32 size;
+
+  if (video->nStride < (OMX_S32) video->nFrameWidth
+      || (video->nStride & 1))
+    video->nStride =
+        LOOPBACK_ROUND_UP (video->nFrameWidth, self->options.stride_align);
+  if (video->nSliceHeight < video->nFrameHeight || (video->nSliceHeight & 1))
+    video->nSliceHeight = LOOPBACK_ROUND_UP (video->nFrameHeight, 16);
+
+  size = video->nStride * video->nSliceHeight;
+  size += 2 * ((video->nStride / 2) * (video->nSliceHeight / 2));
+
+  port->def.nBufferSize = MAX (port->def.nBufferSize, size);
+}
+
+static void
+loopback_port_init (LoopbackComponent * self, OMX_U32 index)
+{
+  LoopbackPort *port = &self->ports[index];
+  OMX_PARAM_PORTDEFINITIONTYPE *def = &port->def;
+
+  LOOPBACK_INIT_STRUCT (def);
+  def->nPortIndex = index;
+  def->eDir = (index == LOOPBACK_IN_PORT) ? OMX_DirInput : OMX_DirOutput;
+  def->nBufferCountMin = (index == LOOPBACK_IN_PORT) ?
+      self->options.in_buffers : self->options.out_buffers;
+  def->nBufferCountActual = def->nBufferCountMin;
+  def->bEnabled = OMX_TRUE;
+  def->bPopulated = OMX_FALSE;
+  def->eDomain = OMX_PortDomainVideo;
+  def->format.video.nFrameWidth = LOOPBACK_DEFAULT_WIDTH;
+  def->format.video.nFrameHeight = LOOPBACK_DEFAULT_HEIGHT;
+
+  if (loopback_port_is_raw (self, index)) {
+    def->nBufferAlignment = self->options.stride_align;
+    def->format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    def->format.video.eColorFormat = OMX_COLOR_FormatYUV420Planar;
+    loopback_port_update_raw_size (self, port);
+  } else {
+    def->nBufferSize = LOOPBACK_BITSTREAM_BUFFER_SIZE;
+    def->format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+    def->format.video.eColorFormat = OMX_COLOR_FormatUnused;
+  }
+
+  port->headers = g_ptr_array_new ();
+  g_queue_init (&port->queue);
+  port->enabling = port->disabling = FALSE;
+}
+
+static void
+loopback_port_update_populated (LoopbackPort * port)
+{
+  port->def.bPopulated =
+      (port->headers->len >= port->def.nBufferCountActual) ? OMX_TRUE :
+      OMX_FALSE;
+}
+
+/* Input port settings are propagated to the output port like a
+ * real codec would do after parsing the stream headers */
+static void
+loopback_component_propagate_settings (LoopbackComponent * self)
+{
+  OMX_VIDEO_PORTDEFINITIONTYPE *in_video =
+      &self->ports[LOOPBACK_IN_PORT].def.format.video;
+  LoopbackPort *out = &self->ports[LOOPBACK_OUT_PORT];
+
+  out->def.format.video.nFrameWidth = in_video->nFrameWidth;
+  out->def.format.video.nFrameHeight = in_video->nFrameHeight;
+  out->def.format.video.xFramerate = in_video->xFramerate;
+
+  if (self->info->kind == LOOPBACK_DECODER) {
+    out->def.format.video.nStride = 0;
+    out->def.format.video.nSliceHeight = 0;
+    out->def.nBufferSize = 0;
+    loopback_port_update_raw_size (self, out);
+  } else {
+    out->def.nBufferSize =
+        MAX (self->ports[LOOPBACK_IN_PORT].def.nBufferSize,
+        LOOPBACK_BITSTREAM_BUFFER_SIZE);
+  }
+}
+
+static void
+loopback_push_event (GQueue * callbacks, OMX_EVENTTYPE event, OMX_U32 data1,
+    OMX_U32 data2)
+{
+  LoopbackCallback *cb = g_slice_new0 (LoopbackCallback);
+
+  cb->type = LOOPBACK_CALLBACK_EVENT;
+  cb->event = event;
+  cb->data1 = data1;
+  cb->data2 = data2;
+  g_queue_push_tail (callbacks, cb);
+}
+
+static void
+loopback_push_buffer_done (GQueue * callbacks, OMX_U32 port_index,
+    OMX_BUFFERHEADERTYPE * header)
+{
+  LoopbackCallback *cb = g_slice_new0 (LoopbackCallback);
+
+  cb->type = (port_index == LOOPBACK_IN_PORT) ?
+      LOOPBACK_CALLBACK_EMPTY_DONE : LOOPBACK_CALLBACK_FILL_DONE;
+  cb->header = header;
+  g_queue_push_tail (callbacks, cb);
+}
+
+/* Must be called without self->lock */
+static void
+loopback_component_dispatch (LoopbackComponent * self, GQueue * callbacks)
+{
+  LoopbackCallback *cb;
+
+  while ((cb = g_queue_pop_head (callbacks))) {
+    switch (cb->type) {
+      case LOOPBACK_CALLBACK_EVENT:
+        if (self->callbacks.EventHandler)
+          self->callbacks.EventHandler (&self->handle, self->app_data,
+              cb->event, cb->data1, cb->data2, NULL);
+        break;
+      case LOOPBACK_CALLBACK_EMPTY_DONE:
+        if (self->callbacks.EmptyBufferDone)
+          self->callbacks.EmptyBufferDone (&self->handle, self->app_data,
+              cb->header);
+        break;
+      case LOOPBACK_CALLBACK_FILL_DONE:
+        if (self->callbacks.FillBufferDone)
+          self->callbacks.FillBufferDone (&self->handle, self->app_data,
+              cb->header);
+        break;
+    }
+    g_slice_free (LoopbackCallback, cb);
+  }
+}
+
+static void
+loopback_port_return_buffers (LoopbackPort * port, GQueue * callbacks)
+{
+  OMX_BUFFERHEADERTYPE *header;
+
+  while ((header = g_queue_pop_head (&port->queue))) {
+    if (port->def.eDir == OMX_DirOutput)
+      header->nFilledLen = 0;
+    loopback_push_buffer_done (callbacks, port->def.nPortIndex, header);
+  }
+}
+
+static void
+loopback_component_handle_command (LoopbackComponent * self,
+    LoopbackCommand * cmd, GQueue * callbacks)
+{
+  OMX_U32 i;
+
+  switch (cmd->cmd) {
+    case OMX_CommandStateSet:{
+      OMX_STATETYPE state = cmd->param;
+
+      if (state == self->state) {
+        loopback_push_event (callbacks, OMX_EventError, OMX_ErrorSameState, 0);
+        break;
+      }
+
+      switch (state) {
+        case OMX_StateLoaded:
+          if (self->state != OMX_StateIdle)
+            goto invalid_transition;
+          break;
+        case OMX_StateIdle:
+          if (self->state != OMX_StateLoaded
+              && self->state != OMX_StateExecuting
+              && self->state != OMX_StatePause)
+            goto invalid_transition;
+          break;
+        case OMX_StateExecuting:
+        case OMX_StatePause:
+          if (self->state != OMX_StateIdle
+              && self->state != OMX_StateExecuting
+              && self->state != OMX_StatePause)
+            goto invalid_transition;
+          break;
+        default:
+          goto invalid_transition;
+      }
+
+      /* Going back to Idle returns all buffers to the client */
+      if (state == OMX_StateIdle && self->state != OMX_StateLoaded) {
+        for (i = 0; i < LOOPBACK_N_PORTS; i++)
+          loopback_port_return_buffers (&self->ports[i], callbacks);
+      }
+
+      self->target_state = state;
+      break;
+
+    invalid_transition:
+      loopback_push_event (callbacks, OMX_EventError,
+          OMX_ErrorIncorrectStateTransition, 0);
+      break;
+    }
+    case OMX_CommandFlush:
+      for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+        if (cmd->param != OMX_ALL && cmd->param != i)
+          continue;
+
+        loopback_port_return_buffers (&self->ports[i], callbacks);
+        loopback_push_event (callbacks, OMX_EventCmdComplete,
+            OMX_CommandFlush, i);
+      }
+      break;
+    case OMX_CommandPortDisable:
+      for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+        if (cmd->param != OMX_ALL && cmd->param != i)
+          continue;
+
+        loopback_port_return_buffers (&self->ports[i], callbacks);
+        self->ports[i].enabling = FALSE;
+        self->ports[i].disabling = TRUE;
+      }
+      break;
+    case OMX_CommandPortEnable:
+      for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+        if (cmd->param != OMX_ALL && cmd->param != i)
+          continue;
+
+        self->ports[i].def.bEnabled = OMX_TRUE;
+        self->ports[i].disabling = FALSE;
+        self->ports[i].enabling = TRUE;
+      }
+      break;
+    default:
+      loopback_push_event (callbacks, OMX_EventError, OMX_ErrorNotImplemented,
+          0);
+      break;
+  }
+}
+
+/* Completes pending state changes and port commands as soon
+ * as the client has (de)allocated all required buffers */
+static void
+loopback_component_check_pending (LoopbackComponent * self,
+    GQueue * callbacks)
+{
+  OMX_U32 i;
+
+  for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+    LoopbackPort *port = &self->ports[i];
+
+    if (port->disabling && port->headers->len == 0) {
+      port->disabling = FALSE;
+      port->def.bEnabled = OMX_FALSE;
+      if (i == LOOPBACK_OUT_PORT)
+        self->settings_changed = FALSE;
+      loopback_push_event (callbacks, OMX_EventCmdComplete,
+          OMX_CommandPortDisable, i);
+    }
+
+    if (port->enabling && (self->state == OMX_StateLoaded
+            || port->def.bPopulated)) {
+      port->enabling = FALSE;
+      loopback_push_event (callbacks, OMX_EventCmdComplete,
+          OMX_CommandPortEnable, i);
+    }
+  }
+
+  if (self->target_state != OMX_StateInvalid) {
+    gboolean done = TRUE;
+
+    for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+      LoopbackPort *port = &self->ports[i];
+
+      if (self->target_state == OMX_StateIdle
+          && self->state == OMX_StateLoaded && port->def.bEnabled
+          && !port->def.bPopulated)
+        done = FALSE;
+      else if (self->target_state == OMX_StateLoaded
+          && port->headers->len > 0)
+        done = FALSE;
+    }
+
+    if (done) {
+      self->state = self->target_state;
+      self->target_state = OMX_StateInvalid;
+      loopback_push_event (callbacks, OMX_EventCmdComplete,
+          OMX_CommandStateSet, self->state);
+    }
+  }
+}
+
+static gboolean
+loopback_port_is_ready (LoopbackPort * port)
+{
+  return port->def.bEnabled && !port->enabling && !port->disabling
+      && !g_queue_is_empty (&port->queue);
+}
+
+/* Called with self->lock, returns with self->lock. Returns FALSE if
+ * there was nothing to process */
+static gboolean
+loopback_component_process (LoopbackComponent * self, GQueue * callbacks)
+{
+  LoopbackPort *in = &self->ports[LOOPBACK_IN_PORT];
+  LoopbackPort *out = &self->ports[LOOPBACK_OUT_PORT];
+  OMX_BUFFERHEADERTYPE *inbuf, *outbuf = NULL;
+  gboolean needs_output, sync = FALSE;
+  OMX_U32 frame_size = 0;
+
+  if (self->state != OMX_StateExecuting || self->failed)
+    return FALSE;
+
+  if (!loopback_port_is_ready (in))
+    return FALSE;
+
+  inbuf = g_queue_peek_head (&in->queue);
+
+  if (inbuf->nFlags & OMX_BUFFERFLAG_EOS)
+    needs_output = TRUE;
+  else if (inbuf->nFilledLen == 0)
+    needs_output = FALSE;
+  else if (self->info->kind == LOOPBACK_DECODER
+      && (inbuf->nFlags & (OMX_BUFFERFLAG_CODECCONFIG |
+              OMX_BUFFERFLAG_DECODEONLY)))
+    needs_output = FALSE;
+  else
+    needs_output = TRUE;
+
+  if (needs_output) {
+    if (self->settings_changed || !loopback_port_is_ready (out))
+      return FALSE;
+    outbuf = g_queue_pop_head (&out->queue);
+
+    if (self->info->kind == LOOPBACK_DECODER) {
+      frame_size = MIN (out->def.nBufferSize, outbuf->nAllocLen);
+    } else {
+      frame_size = MIN (inbuf->nFilledLen, outbuf->nAllocLen);
+      if (self->force_keyframe || (self->options.keyframe_interval
+              && self->n_frames % self->options.keyframe_interval == 0))
+        sync = TRUE;
+      self->force_keyframe = FALSE;
+    }
+  }
+  g_queue_pop_head (&in->queue);
+  g_mutex_unlock (&self->lock);
+
+  if (self->options.latency && inbuf->nFilledLen > 0)
+    g_usleep (self->options.latency);
+
+  if (outbuf) {
+    outbuf->nOffset = 0;
+    outbuf->nTimeStamp = inbuf->nTimeStamp;
+    outbuf->nTickCount = inbuf->nTickCount;
+    outbuf->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+
+    if (inbuf->nFilledLen > 0) {
+      memcpy (outbuf->pBuffer, inbuf->pBuffer + inbuf->nOffset,
+          MIN (inbuf->nFilledLen, frame_size));
+      outbuf->nFilledLen = frame_size;
+      if (self->info->kind == LOOPBACK_DECODER)
+        outbuf->nFlags |= (inbuf->nFlags & OMX_BUFFERFLAG_SYNCFRAME);
+      else if (sync)
+        outbuf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
+    } else {
+      outbuf->nFilledLen = 0;
+    }
+
+    if (inbuf->nFlags & OMX_BUFFERFLAG_EOS)
+      outbuf->nFlags |= OMX_BUFFERFLAG_EOS;
+  }
+  inbuf->nFilledLen = 0;
+  inbuf->nOffset = 0;
+
+  g_mutex_lock (&self->lock);
+
+  loopback_push_buffer_done (callbacks, LOOPBACK_IN_PORT, inbuf);
+  if (outbuf) {
+    loopback_push_buffer_done (callbacks, LOOPBACK_OUT_PORT, outbuf);
+
+    if (outbuf->nFlags & OMX_BUFFERFLAG_EOS)
+      loopback_push_event (callbacks, OMX_EventBufferFlag, LOOPBACK_OUT_PORT,
+          outbuf->nFlags);
+
+    if (outbuf->nFilledLen > 0) {
+      self->n_frames++;
+
+      if (self->options.error_after
+          && self->n_frames == self->options.error_after) {
+        self->failed = TRUE;
+        loopback_push_event (callbacks, OMX_EventError, OMX_ErrorHardware, 0);
+      } else if (self->info->kind == LOOPBACK_DECODER
+          && self->options.settings_changed_interval
+          && self->n_frames % self->options.settings_changed_interval == 0) {
+        self->settings_changed = TRUE;
+        loopback_push_event (callbacks, OMX_EventPortSettingsChanged,
+            LOOPBACK_OUT_PORT, OMX_IndexParamPortDefinition);
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+static gpointer
+loopback_component_thread (LoopbackComponent * self)
+{
+  GQueue callbacks = G_QUEUE_INIT;
+  LoopbackCommand *cmd;
+
+  g_mutex_lock (&self->lock);
+  while (self->running) {
+    gboolean processed;
+
+    while ((cmd = g_queue_pop_head (&self->commands))) {
+      loopback_component_handle_command (self, cmd, &callbacks);
+      g_slice_free (LoopbackCommand, cmd);
+    }
+    loopback_component_check_pending (self, &callbacks);
+
+    processed = loopback_component_process (self, &callbacks);
+
+    if (!g_queue_is_empty (&callbacks)) {
+      g_mutex_unlock (&self->lock);
+      loopback_component_dispatch (self, &callbacks);
+      g_mutex_lock (&self->lock);
+    } else if (!processed && g_queue_is_empty (&self->commands)) {
+      g_cond_wait (&self->cond, &self->lock);
+    }
+  }
+  g_mutex_unlock (&self->lock);
+
+  return NULL;
+}
+
+static OMX_ERRORTYPE
+loopback_get_component_version (OMX_HANDLETYPE hComponent,
+    OMX_STRING pComponentName, OMX_VERSIONTYPE * pComponentVersion,
+    OMX_VERSIONTYPE * pSpecVersion, OMX_UUIDTYPE * pComponentUUID)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+
+  if (!pComponentName || !pComponentVersion || !pSpecVersion)
+    return OMX_ErrorBadParameter;
+
+  g_strlcpy (pComponentName, self->info->name, OMX_MAX_STRINGNAME_SIZE);
+  pComponentVersion->nVersion = OMX_VERSION;
+  pSpecVersion->nVersion = OMX_VERSION;
+  if (pComponentUUID)
+    memset (pComponentUUID, 0, sizeof (OMX_UUIDTYPE));
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_send_command (OMX_HANDLETYPE hComponent, OMX_COMMANDTYPE Cmd,
+    OMX_U32 nParam1, OMX_PTR pCmdData)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  LoopbackCommand *cmd;
+
+  if (Cmd != OMX_CommandStateSet && nParam1 != OMX_ALL
+      && nParam1 >= LOOPBACK_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+
+  cmd = g_slice_new (LoopbackCommand);
+  cmd->cmd = Cmd;
+  cmd->param = nParam1;
+
+  g_mutex_lock (&self->lock);
+  g_queue_push_tail (&self->commands, cmd);
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_get_parameter (OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nParamIndex,
+    OMX_PTR pComponentParameterStructure)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!pComponentParameterStructure)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&self->lock);
+  switch (nParamIndex) {
+    case OMX_IndexParamVideoInit:{
+      OMX_PORT_PARAM_TYPE *param = pComponentParameterStructure;
+
+      param->nPorts = LOOPBACK_N_PORTS;
+      param->nStartPortNumber = LOOPBACK_IN_PORT;
+      break;
+    }
+    case OMX_IndexParamPortDefinition:{
+      OMX_PARAM_PORTDEFINITIONTYPE *param = pComponentParameterStructure;
+
+      if (param->nPortIndex >= LOOPBACK_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      *param = self->ports[param->nPortIndex].def;
+      break;
+    }
+    case OMX_IndexParamStandardComponentRole:{
+      OMX_PARAM_COMPONENTROLETYPE *param = pComponentParameterStructure;
+
+      g_strlcpy ((gchar *) param->cRole, self->role, sizeof (param->cRole));
+      break;
+    }
+    case OMX_IndexParamVideoPortFormat:{
+      OMX_VIDEO_PARAM_PORTFORMATTYPE *param = pComponentParameterStructure;
+      OMX_VIDEO_PORTDEFINITIONTYPE *video;
+      static const OMX_COLOR_FORMATTYPE formats[] = {
+        OMX_COLOR_FormatYUV420Planar, OMX_COLOR_FormatYUV420SemiPlanar
+      };
+
+      if (param->nPortIndex >= LOOPBACK_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      video = &self->ports[param->nPortIndex].def.format.video;
+
+      if (loopback_port_is_raw (self, param->nPortIndex)) {
+        if (param->nIndex < G_N_ELEMENTS (formats)) {
+          param->eCompressionFormat = OMX_VIDEO_CodingUnused;
+          param->eColorFormat = formats[param->nIndex];
+          param->xFramerate = video->xFramerate;
+        } else {
+          err = OMX_ErrorNoMore;
+        }
+      } else if (param->nIndex == 0) {
+        param->eCompressionFormat = video->eCompressionFormat;
+        param->eColorFormat = OMX_COLOR_FormatUnused;
+        param->xFramerate = video->xFramerate;
+      } else {
+        err = OMX_ErrorNoMore;
+      }
+
+      /* Don't leave a valid format behind for clients that
+       * look at the structure after OMX_ErrorNoMore */
+      if (err == OMX_ErrorNoMore) {
+        param->eCompressionFormat = OMX_VIDEO_CodingUnused;
+        param->eColorFormat = OMX_COLOR_FormatUnused;
+      }
+      break;
+    }
+    case OMX_IndexParamVideoBitrate:{
+      OMX_VIDEO_PARAM_BITRATETYPE *param = pComponentParameterStructure;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      param->eControlRate = self->bitrate.eControlRate;
+      param->nTargetBitrate = self->bitrate.nTargetBitrate;
+      break;
+    }
+    case OMX_IndexParamVideoQuantization:{
+      OMX_VIDEO_PARAM_QUANTIZATIONTYPE *param = pComponentParameterStructure;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      param->nQpI = self->quantization.nQpI;
+      param->nQpP = self->quantization.nQpP;
+      param->nQpB = self->quantization.nQpB;
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_set_parameter (OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex,
+    OMX_PTR pComponentParameterStructure)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!pComponentParameterStructure)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&self->lock);
+  switch (nIndex) {
+    case OMX_IndexParamPortDefinition:{
+      OMX_PARAM_PORTDEFINITIONTYPE *param = pComponentParameterStructure;
+      LoopbackPort *port;
+      OMX_VIDEO_PORTDEFINITIONTYPE *video;
+
+      if (param->nPortIndex >= LOOPBACK_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      port = &self->ports[param->nPortIndex];
+      video = &port->def.format.video;
+
+      if (param->nBufferCountActual < port->def.nBufferCountMin) {
+        err = OMX_ErrorBadParameter;
+        break;
+      }
+
+      port->def.nBufferCountActual = param->nBufferCountActual;
+      video->nFrameWidth = param->format.video.nFrameWidth;
+      video->nFrameHeight = param->format.video.nFrameHeight;
+      video->xFramerate = param->format.video.xFramerate;
+      video->nBitrate = param->format.video.nBitrate;
+
+      if (loopback_port_is_raw (self, param->nPortIndex)) {
+        if (loopback_color_format_is_supported (param->format.video.
+                eColorFormat))
+          video->eColorFormat = param->format.video.eColorFormat;
+        video->nStride = param->format.video.nStride;
+        video->nSliceHeight = param->format.video.nSliceHeight;
+        port->def.nBufferSize = param->nBufferSize;
+        loopback_port_update_raw_size (self, port);
+      } else {
+        video->eCompressionFormat = param->format.video.eCompressionFormat;
+        port->def.nBufferSize =
+            MAX (param->nBufferSize, LOOPBACK_BITSTREAM_BUFFER_SIZE);
+      }
+
+      if (param->nPortIndex == LOOPBACK_IN_PORT)
+        loopback_component_propagate_settings (self);
+
+      loopback_port_update_populated (port);
+      break;
+    }
+    case OMX_IndexParamStandardComponentRole:{
+      OMX_PARAM_COMPONENTROLETYPE *param = pComponentParameterStructure;
+      guint i;
+
+      if (self->state != OMX_StateLoaded) {
+        err = OMX_ErrorIncorrectStateOperation;
+        break;
+      }
+
+      err = OMX_ErrorBadParameter;
+      for (i = 0; self->info->roles[i]; i++) {
+        if (strcmp ((const gchar *) param->cRole, self->info->roles[i]) == 0) {
+          g_strlcpy (self->role, self->info->roles[i], sizeof (self->role));
+          err = OMX_ErrorNone;
+          break;
+        }
+      }
+      break;
+    }
+    case OMX_IndexParamVideoPortFormat:{
+      OMX_VIDEO_PARAM_PORTFORMATTYPE *param = pComponentParameterStructure;
+      LoopbackPort *port;
+
+      if (param->nPortIndex >= LOOPBACK_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      port = &self->ports[param->nPortIndex];
+
+      if (loopback_port_is_raw (self, param->nPortIndex)) {
+        if (!loopback_color_format_is_supported (param->eColorFormat)) {
+          err = OMX_ErrorUnsupportedSetting;
+          break;
+        }
+        port->def.format.video.eColorFormat = param->eColorFormat;
+      } else {
+        port->def.format.video.eCompressionFormat = param->eCompressionFormat;
+      }
+      break;
+    }
+    case OMX_IndexParamVideoBitrate:{
+      OMX_VIDEO_PARAM_BITRATETYPE *param = pComponentParameterStructure;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      self->bitrate.eControlRate = param->eControlRate;
+      self->bitrate.nTargetBitrate = param->nTargetBitrate;
+      break;
+    }
+    case OMX_IndexParamVideoQuantization:{
+      OMX_VIDEO_PARAM_QUANTIZATIONTYPE *param = pComponentParameterStructure;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      self->quantization.nQpI = param->nQpI;
+      self->quantization.nQpP = param->nQpP;
+      self->quantization.nQpB = param->nQpB;
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_get_config (OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex,
+    OMX_PTR pComponentConfigStructure)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!pComponentConfigStructure)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&self->lock);
+  switch (nIndex) {
+    case OMX_IndexConfigVideoBitrate:{
+      OMX_VIDEO_CONFIG_BITRATETYPE *config = pComponentConfigStructure;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      config->nEncodeBitrate = self->bitrate.nTargetBitrate;
+      break;
+    }
+    case OMX_IndexConfigVideoFramerate:{
+      OMX_CONFIG_FRAMERATETYPE *config = pComponentConfigStructure;
+
+      if (config->nPortIndex >= LOOPBACK_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      config->xEncodeFramerate =
+          self->ports[config->nPortIndex].def.format.video.xFramerate;
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_set_config (OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex,
+    OMX_PTR pComponentConfigStructure)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!pComponentConfigStructure)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&self->lock);
+  /* Cast for the vendor indices outside of the enum */
+  switch ((guint) nIndex) {
+    case OMX_IndexConfigVideoBitrate:{
+      OMX_VIDEO_CONFIG_BITRATETYPE *config = pComponentConfigStructure;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      self->bitrate.nTargetBitrate = config->nEncodeBitrate;
+      break;
+    }
+    case OMX_IndexConfigVideoFramerate:{
+      OMX_CONFIG_FRAMERATETYPE *config = pComponentConfigStructure;
+
+      if (config->nPortIndex >= LOOPBACK_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      self->ports[config->nPortIndex].def.format.video.xFramerate =
+          config->xEncodeFramerate;
+      break;
+    }
+    case OMX_IndexConfigVideoIntraVOPRefresh:{
+      OMX_CONFIG_INTRAREFRESHVOPTYPE *config = pComponentConfigStructure;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      if (config->IntraRefreshVOP)
+        self->force_keyframe = TRUE;
+      break;
+    }
+    case LOOPBACK_INDEX_QP_MAP:{
+      LoopbackQpMapConfig *config = pComponentConfigStructure;
+      OMX_PARAM_PORTDEFINITIONTYPE *def = &self->ports[LOOPBACK_IN_PORT].def;
+      guint i, n;
+
+      if (self->info->kind != LOOPBACK_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      if (config->nSize != sizeof (LoopbackQpMapConfig)
+          || config->nPortIndex != LOOPBACK_IN_PORT
+          || config->nMbWidth != (def->format.video.nFrameWidth + 15) / 16
+          || config->nMbHeight != (def->format.video.nFrameHeight + 15) / 16
+          || !config->pQpDelta) {
+        err = OMX_ErrorBadParameter;
+        break;
+      }
+      n = config->nMbWidth * config->nMbHeight;
+      self->qp_map_mbs = 0;
+      for (i = 0; i < n; i++) {
+        if (config->pQpDelta[i] < -51 || config->pQpDelta[i] > 51) {
+          err = OMX_ErrorBadParameter;
+          break;
+        }
+        if (config->pQpDelta[i] != 0)
+          self->qp_map_mbs++;
+      }
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_get_extension_index (OMX_HANDLETYPE hComponent,
+    OMX_STRING cParameterName, OMX_INDEXTYPE * pIndexType)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+
+  if (!cParameterName || !pIndexType)
+    return OMX_ErrorBadParameter;
+
+  if (self->info->kind == LOOPBACK_ENCODER
+      && g_str_equal (cParameterName, LOOPBACK_QP_MAP_EXTENSION)) {
+    *pIndexType = LOOPBACK_INDEX_QP_MAP;
+    return OMX_ErrorNone;
+  }
+
+  return OMX_ErrorUnsupportedIndex;
+}
+
+static OMX_ERRORTYPE
+loopback_get_state (OMX_HANDLETYPE hComponent, OMX_STATETYPE * pState)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+
+  if (!pState)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&self->lock);
+  *pState = self->state;
+  g_mutex_unlock (&self->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_component_tunnel_request (OMX_HANDLETYPE hComp, OMX_U32 nPort,
+    OMX_HANDLETYPE hTunneledComp, OMX_U32 nTunneledPort,
+    OMX_TUNNELSETUPTYPE * pTunnelSetup)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+static OMX_ERRORTYPE
+loopback_add_buffer (LoopbackComponent * self,
+    OMX_BUFFERHEADERTYPE ** ppBufferHdr, OMX_U32 nPortIndex,
+    OMX_PTR pAppPrivate, OMX_U32 nSizeBytes, OMX_U8 * pBuffer,
+    gboolean allocated)
+{
+  OMX_BUFFERHEADERTYPE *header;
+  LoopbackPort *port;
+
+  if (!ppBufferHdr || !pBuffer)
+    return OMX_ErrorBadParameter;
+  if (nPortIndex >= LOOPBACK_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+
+  g_mutex_lock (&self->lock);
+  port = &self->ports[nPortIndex];
+
+  if (nSizeBytes < port->def.nBufferSize) {
+    g_mutex_unlock (&self->lock);
+    return OMX_ErrorBadParameter;
+  }
+
+  header = g_slice_new0 (OMX_BUFFERHEADERTYPE);
+  LOOPBACK_INIT_STRUCT (header);
+  header->pBuffer = pBuffer;
+  header->nAllocLen = nSizeBytes;
+  header->pAppPrivate = pAppPrivate;
+  /* Remember who has to free the memory */
+  header->pPlatformPrivate = allocated ? pBuffer : NULL;
+  if (nPortIndex == LOOPBACK_IN_PORT) {
+    header->nInputPortIndex = nPortIndex;
+    header->nOutputPortIndex = OMX_ALL;
+  } else {
+    header->nInputPortIndex = OMX_ALL;
+    header->nOutputPortIndex = nPortIndex;
+  }
+
+  g_ptr_array_add (port->headers, header);
+  loopback_port_update_populated (port);
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  *ppBufferHdr = header;
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_use_buffer (OMX_HANDLETYPE hComponent,
+    OMX_BUFFERHEADERTYPE ** ppBufferHdr, OMX_U32 nPortIndex,
+    OMX_PTR pAppPrivate, OMX_U32 nSizeBytes, OMX_U8 * pBuffer)
+{
+  return loopback_add_buffer (LOOPBACK_COMPONENT (hComponent), ppBufferHdr,
+      nPortIndex, pAppPrivate, nSizeBytes, pBuffer, FALSE);
+}
+
+static OMX_ERRORTYPE
+loopback_allocate_buffer (OMX_HANDLETYPE hComponent,
+    OMX_BUFFERHEADERTYPE ** ppBuffer, OMX_U32 nPortIndex,
+    OMX_PTR pAppPrivate, OMX_U32 nSizeBytes)
+{
+  OMX_U8 *data;
+  OMX_ERRORTYPE err;
+
+  data = g_malloc (nSizeBytes);
+  err =
+      loopback_add_buffer (LOOPBACK_COMPONENT (hComponent), ppBuffer,
+      nPortIndex, pAppPrivate, nSizeBytes, data, TRUE);
+  if (err != OMX_ErrorNone)
+    g_free (data);
+
+  return err;
+}
+
+static void
+loopback_buffer_header_free (OMX_BUFFERHEADERTYPE * header)
+{
+  if (header->pPlatformPrivate)
+    g_free (header->pBuffer);
+  g_slice_free (OMX_BUFFERHEADERTYPE, header);
+}
+
+static OMX_ERRORTYPE
+loopback_free_buffer (OMX_HANDLETYPE hComponent, OMX_U32 nPortIndex,
+    OMX_BUFFERHEADERTYPE * pBuffer)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  LoopbackPort *port;
+
+  if (nPortIndex >= LOOPBACK_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+
+  g_mutex_lock (&self->lock);
+  port = &self->ports[nPortIndex];
+  if (!g_ptr_array_remove (port->headers, pBuffer)) {
+    g_mutex_unlock (&self->lock);
+    return OMX_ErrorBadParameter;
+  }
+  g_queue_remove (&port->queue, pBuffer);
+  loopback_port_update_populated (port);
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  loopback_buffer_header_free (pBuffer);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_queue_buffer (LoopbackComponent * self, OMX_U32 nPortIndex,
+    OMX_BUFFERHEADERTYPE * pBuffer)
+{
+  LoopbackPort *port;
+
+  if (!pBuffer)
+    return OMX_ErrorBadParameter;
+  if (nPortIndex >= LOOPBACK_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+
+  g_mutex_lock (&self->lock);
+  port = &self->ports[nPortIndex];
+
+  if (self->state != OMX_StateIdle && self->state != OMX_StateExecuting
+      && self->state != OMX_StatePause) {
+    g_mutex_unlock (&self->lock);
+    return OMX_ErrorIncorrectStateOperation;
+  }
+  if (!port->def.bEnabled || port->disabling) {
+    g_mutex_unlock (&self->lock);
+    return OMX_ErrorIncorrectStateOperation;
+  }
+
+  g_queue_push_tail (&port->queue, pBuffer);
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_empty_this_buffer (OMX_HANDLETYPE hComponent,
+    OMX_BUFFERHEADERTYPE * pBuffer)
+{
+  if (!pBuffer || pBuffer->nInputPortIndex != LOOPBACK_IN_PORT)
+    return OMX_ErrorBadPortIndex;
+
+  return loopback_queue_buffer (LOOPBACK_COMPONENT (hComponent),
+      LOOPBACK_IN_PORT, pBuffer);
+}
+
+static OMX_ERRORTYPE
+loopback_fill_this_buffer (OMX_HANDLETYPE hComponent,
+    OMX_BUFFERHEADERTYPE * pBuffer)
+{
+  if (!pBuffer || pBuffer->nOutputPortIndex != LOOPBACK_OUT_PORT)
+    return OMX_ErrorBadPortIndex;
+
+  return loopback_queue_buffer (LOOPBACK_COMPONENT (hComponent),
+      LOOPBACK_OUT_PORT, pBuffer);
+}
+
+static OMX_ERRORTYPE
+loopback_set_callbacks (OMX_HANDLETYPE hComponent,
+    OMX_CALLBACKTYPE * pCallbacks, OMX_PTR pAppData)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+
+  if (!pCallbacks)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&self->lock);
+  self->callbacks = *pCallbacks;
+  self->app_data = pAppData;
+  g_mutex_unlock (&self->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_component_deinit (OMX_HANDLETYPE hComponent)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  LoopbackCommand *cmd;
+  guint i, j;
+
+  g_mutex_lock (&self->lock);
+  self->running = FALSE;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  g_thread_join (self->thread);
+
+  while ((cmd = g_queue_pop_head (&self->commands)))
+    g_slice_free (LoopbackCommand, cmd);
+
+  for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+    LoopbackPort *port = &self->ports[i];
+
+    for (j = 0; j < port->headers->len; j++)
+      loopback_buffer_header_free (g_ptr_array_index (port->headers, j));
+    g_ptr_array_free (port->headers, TRUE);
+    g_queue_clear (&port->queue);
+  }
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_slice_free (LoopbackComponent, self);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_use_egl_image (OMX_HANDLETYPE hComponent,
+    OMX_BUFFERHEADERTYPE ** ppBufferHdr, OMX_U32 nPortIndex,
+    OMX_PTR pAppPrivate, void *eglImage)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+static OMX_ERRORTYPE
+loopback_component_role_enum (OMX_HANDLETYPE hComponent, OMX_U8 * cRole,
+    OMX_U32 nIndex)
+{
+  LoopbackComponent *self = LOOPBACK_COMPONENT (hComponent);
+  guint i;
+
+  if (!cRole)
+    return OMX_ErrorBadParameter;
+
+  for (i = 0; self->info->roles[i]; i++) {
+    if (i == nIndex) {
+      g_strlcpy ((gchar *) cRole, self->info->roles[i],
+          OMX_MAX_STRINGNAME_SIZE);
+      return OMX_ErrorNone;
+    }
+  }
+
+  return OMX_ErrorNoMore;
+}
+
+static const LoopbackComponentInfo *
+loopback_find_component (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (loopback_components); i++) {
+    if (strcmp (loopback_components[i].name, name) == 0)
+      return &loopback_components[i];
+  }
+
+  return NULL;
+}
+
+OMX_ERRORTYPE
+OMX_Init (void)
+{
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE
+OMX_Deinit (void)
+{
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE
+OMX_ComponentNameEnum (OMX_STRING cComponentName, OMX_U32 nNameLength,
+    OMX_U32 nIndex)
+{
+  if (!cComponentName)
+    return OMX_ErrorBadParameter;
+  if (nIndex >= G_N_ELEMENTS (loopback_components))
+    return OMX_ErrorNoMore;
+
+  g_strlcpy (cComponentName, loopback_components[nIndex].name, nNameLength);
+
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE
+OMX_GetHandle (OMX_HANDLETYPE * pHandle, OMX_STRING cComponentName,
+    OMX_PTR pAppData, OMX_CALLBACKTYPE * pCallBacks)
+{
+  const LoopbackComponentInfo *info;
+  LoopbackComponent *self;
+  OMX_COMPONENTTYPE *handle;
+  guint i;
+
+  if (!pHandle || !cComponentName || !pCallBacks)
+    return OMX_ErrorBadParameter;
+
+  info = loopback_find_component (cComponentName);
+  if (!info)
+    return OMX_ErrorComponentNotFound;
+
+  self = g_slice_new0 (LoopbackComponent);
+  self->info = info;
+  loopback_options_init (&self->options);
+  self->callbacks = *pCallBacks;
+  self->app_data = pAppData;
+  g_strlcpy (self->role, info->roles[0], sizeof (self->role));
+
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->commands);
+
+  self->state = OMX_StateLoaded;
+  self->target_state = OMX_StateInvalid;
+
+  for (i = 0; i < LOOPBACK_N_PORTS; i++)
+    loopback_port_init (self, i);
+  loopback_component_propagate_settings (self);
+
+  LOOPBACK_INIT_STRUCT (&self->bitrate);
+  self->bitrate.nPortIndex = LOOPBACK_OUT_PORT;
+  self->bitrate.eControlRate = OMX_Video_ControlRateVariable;
+  self->bitrate.nTargetBitrate = 1000000;
+  LOOPBACK_INIT_STRUCT (&self->quantization);
+  self->quantization.nPortIndex = LOOPBACK_OUT_PORT;
+  self->quantization.nQpI = self->quantization.nQpP =
+      self->quantization.nQpB = 26;
+
+  handle = &self->handle;
+  LOOPBACK_INIT_STRUCT (handle);
+  handle->pComponentPrivate = self;
+  handle->pApplicationPrivate = pAppData;
+  handle->GetComponentVersion = loopback_get_component_version;
+  handle->SendCommand = loopback_send_command;
+  handle->GetParameter = loopback_get_parameter;
+  handle->SetParameter = loopback_set_parameter;
+  handle->GetConfig = loopback_get_config;
+  handle->SetConfig = loopback_set_config;
+  handle->GetExtensionIndex = loopback_get_extension_index;
+  handle->GetState = loopback_get_state;
+  handle->ComponentTunnelRequest = loopback_component_tunnel_request;
+  handle->UseBuffer = loopback_use_buffer;
+  handle->AllocateBuffer = loopback_allocate_buffer;
+  handle->FreeBuffer = loopback_free_buffer;
+  handle->EmptyThisBuffer = loopback_empty_this_buffer;
+  handle->FillThisBuffer = loopback_fill_this_buffer;
+  handle->SetCallbacks = loopback_set_callbacks;
+  handle->ComponentDeInit = loopback_component_deinit;
+  handle->UseEGLImage = loopback_use_egl_image;
+  handle->ComponentRoleEnum = loopback_component_role_enum;
+
+  self->running = TRUE;
+  self->thread =
+      g_thread_new (info->name, (GThreadFunc) loopback_component_thread, self);
+
+  *pHandle = handle;
+
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE
+OMX_FreeHandle (OMX_HANDLETYPE hComponent)
+{
+  if (!hComponent)
+    return OMX_ErrorBadParameter;
+
+  return loopback_component_deinit (hComponent);
+}
+
+OMX_ERRORTYPE
+OMX_SetupTunnel (OMX_HANDLETYPE hOutput, OMX_U32 nPortOutput,
+    OMX_HANDLETYPE hInput, OMX_U32 nPortInput)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+OMX_ERRORTYPE
+OMX_GetRolesOfComponent (OMX_STRING compName, OMX_U32 * pNumRoles,
+    OMX_U8 ** roles)
+{
+  const LoopbackComponentInfo *info;
+  OMX_U32 i, n_roles = 0;
+
+  if (!compName || !pNumRoles)
+    return OMX_ErrorBadParameter;
+
+  info = loopback_find_component (compName);
+  if (!info)
+    return OMX_ErrorComponentNotFound;
+
+  while (info->roles[n_roles])
+    n_roles++;
+
+  if (roles) {
+    for (i = 0; i < MIN (*pNumRoles, n_roles); i++)
+      g_strlcpy ((gchar *) roles[i], info->roles[i], OMX_MAX_STRINGNAME_SIZE);
+  }
+  *pNumRoles = n_roles;
+
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE
+OMX_GetComponentsOfRole (OMX_STRING role, OMX_U32 * pNumComps,
+    OMX_U8 ** compNames)
+{
+  OMX_U32 i, j, n_comps = 0;
+
+  if (!role || !pNumComps)
+    return OMX_ErrorBadParameter;
+
+  for (i = 0; i < G_N_ELEMENTS (loopback_components); i++) {
+    for (j = 0; loopback_components[i].roles[j]; j++) {
+      if (strcmp (loopback_components[i].roles[j], role) != 0)
+        continue;
+
+      if (compNames && n_comps < *pNumComps)
+        g_strlcpy ((gchar *) compNames[n_comps], loopback_components[i].name,
+            OMX_MAX_STRINGNAME_SIZE);
+      n_comps++;
+      break;
+    }
+  }
+  *pNumComps = n_comps;
+
+  return OMX_ErrorNone;
+}